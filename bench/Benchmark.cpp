@@ -0,0 +1,2696 @@
+// Runs the same decode -> crop -> resize -> analyze pipeline the plugin
+// does for files, over a set of generated images (and any others you give
+// it), and prints how long each stage took as JSON so runs can be
+// compared with each other.
+//
+// See Readme.md next to this for how to build and run it.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <filesystem>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "stb_image.h"
+#include "stb_image_resize.h"
+#include "stb_image_write.h"
+
+#include "ContentHash.h"
+#include "Counters.h"
+#include "Downsample.h"
+#include "FakeWallpaperSource.h"
+#include "FileWatcher.h"
+#include "Grid.h"
+#include "IconDecoder.h"
+#include "ImageFormat.h"
+#include "ImageView.h"
+#include "MappedFile.h"
+#include "MipPyramid.h"
+#include "PaletteCache.h"
+#include "PixelConvert.h"
+#include "SampleRegistry.h"
+#include "Sampler.h"
+#include "SourceFailures.h"
+#include "Stats.h"
+#include "SummedAreaTable.h"
+#include "ThreadPool.h"
+#include "WallpaperSource.h"
+#include "Worker.h"
+
+namespace fs = std::filesystem;
+
+// ---------------------------------------------------------------------------
+// Allocation tracking
+//
+// On glibc every malloc/free in the process (ours, stb's, libChameleon's and
+// operator new's) comes through here, so each run can report how many
+// allocations it made and how much heap it had at its peak. Anywhere else
+// the counts just come back as unknown.
+
+static std::atomic<uint64_t> allocCount(0);
+static std::atomic<uint64_t> allocBytes(0);
+static std::atomic<int64_t> liveBytes(0);
+static std::atomic<int64_t> peakLiveBytes(0);
+
+#ifdef __GLIBC__
+#define TRACK_ALLOCATIONS 1
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static void trackAlloc(void *ptr)
+{
+	if (ptr == nullptr)
+	{
+		return;
+	}
+
+	size_t size = malloc_usable_size(ptr);
+	allocCount.fetch_add(1, std::memory_order_relaxed);
+	allocBytes.fetch_add(size, std::memory_order_relaxed);
+
+	int64_t live = liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+	int64_t peak = peakLiveBytes.load(std::memory_order_relaxed);
+	while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+	{
+	}
+}
+
+static void trackFree(void *ptr)
+{
+	if (ptr != nullptr)
+	{
+		liveBytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+	}
+}
+
+extern "C" void *malloc(size_t size)
+{
+	void *ptr = __libc_malloc(size);
+	trackAlloc(ptr);
+	return ptr;
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+	void *ptr = __libc_calloc(count, size);
+	trackAlloc(ptr);
+	return ptr;
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+	size_t oldSize = ptr != nullptr ? malloc_usable_size(ptr) : 0;
+	void *moved = __libc_realloc(ptr, size);
+
+	// If it failed the old block is still there
+	if (moved != nullptr || size == 0)
+	{
+		liveBytes.fetch_sub(oldSize, std::memory_order_relaxed);
+	}
+
+	trackAlloc(moved);
+	return moved;
+}
+
+extern "C" void free(void *ptr)
+{
+	trackFree(ptr);
+	__libc_free(ptr);
+}
+#else
+#define TRACK_ALLOCATIONS 0
+#endif
+
+// Peak resident set size of the whole process so far, in KB (or -1)
+static long peakRssKb()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+#ifdef __APPLE__
+		return usage.ru_maxrss / 1024;
+#else
+		return usage.ru_maxrss;
+#endif
+	}
+#endif
+	return -1;
+}
+
+// ---------------------------------------------------------------------------
+// The corpus
+
+enum Pattern
+{
+	PATTERN_GRADIENT,
+	PATTERN_NOISE,
+	PATTERN_PHOTO,
+	PATTERN_FLAT
+};
+
+struct SyntheticImage
+{
+	const char *name;
+	int w;
+	int h;
+	Pattern pattern;
+};
+
+// Sizes and formats that show up as wallpapers and album art. The file
+// extension picks the format it gets written in.
+static const SyntheticImage syntheticImages[] =
+{
+	{ "art-600.png", 600, 600, PATTERN_PHOTO },
+	{ "art-600.jpg", 600, 600, PATTERN_PHOTO },
+	{ "icon-256.tga", 256, 256, PATTERN_GRADIENT },
+	{ "gradient-1080p.png", 1920, 1080, PATTERN_GRADIENT },
+	{ "noise-1080p.jpg", 1920, 1080, PATTERN_NOISE },
+	{ "flat-1440p.bmp", 2560, 1440, PATTERN_FLAT },
+	{ "photo-4k.jpg", 3840, 2160, PATTERN_PHOTO },
+	{ "photo-4k.png", 3840, 2160, PATTERN_PHOTO },
+	{ "photo-8k.jpg", 7680, 4320, PATTERN_PHOTO },
+	{ "ultrawide-5k.jpg", 5120, 1440, PATTERN_PHOTO }
+};
+
+// Small, fast and the same everywhere, so the corpus is too
+static uint32_t nextRandom(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static std::vector<uint8_t> makePixels(const SyntheticImage &image)
+{
+	std::vector<uint8_t> pixels((size_t)image.w * image.h * 3);
+	uint32_t state = 0x9E3779B9u ^ (uint32_t)(image.w * 31 + image.h);
+
+	for (int y = 0; y < image.h; ++y)
+	{
+		for (int x = 0; x < image.w; ++x)
+		{
+			uint8_t *p = &pixels[((size_t)y * image.w + x) * 3];
+			float fx = (float)x / image.w;
+			float fy = (float)y / image.h;
+
+			switch (image.pattern)
+			{
+			case PATTERN_GRADIENT:
+				p[0] = (uint8_t)(255 * fx);
+				p[1] = (uint8_t)(255 * fy);
+				p[2] = (uint8_t)(255 * (1 - fx));
+				break;
+			case PATTERN_NOISE:
+			{
+				uint32_t r = nextRandom(&state);
+				p[0] = (uint8_t)r;
+				p[1] = (uint8_t)(r >> 8);
+				p[2] = (uint8_t)(r >> 16);
+				break;
+			}
+			case PATTERN_PHOTO:
+			{
+				// A few soft blobs of color with a bit of grain, so there's
+				// something for Chameleon to find and JPEG has to work for it
+				float sky = 0.5f + 0.5f * std::sin(fx * 6.0f + fy * 2.0f);
+				float sun = std::exp(-((fx - 0.7f) * (fx - 0.7f) + (fy - 0.3f) * (fy - 0.3f)) * 20.0f);
+				int grain = (int)(nextRandom(&state) % 17) - 8;
+				p[0] = (uint8_t)std::min(255, std::max(0, (int)(40 + 180 * sun + 30 * sky) + grain));
+				p[1] = (uint8_t)std::min(255, std::max(0, (int)(60 + 120 * sun * fy + 80 * sky) + grain));
+				p[2] = (uint8_t)std::min(255, std::max(0, (int)(90 + 140 * (1 - fy) * sky) + grain));
+				break;
+			}
+			case PATTERN_FLAT:
+				p[0] = 32;
+				p[1] = 96;
+				p[2] = 160;
+				break;
+			}
+		}
+	}
+
+	return pixels;
+}
+
+static bool writeImage(const fs::path &path, const SyntheticImage &image)
+{
+	std::vector<uint8_t> pixels = makePixels(image);
+	std::string ext = path.extension().string();
+	std::string file = path.string();
+
+	if (ext == ".png")
+		return stbi_write_png(file.c_str(), image.w, image.h, 3, pixels.data(), image.w * 3) != 0;
+	if (ext == ".jpg")
+		return stbi_write_jpg(file.c_str(), image.w, image.h, 3, pixels.data(), 90) != 0;
+	if (ext == ".bmp")
+		return stbi_write_bmp(file.c_str(), image.w, image.h, 3, pixels.data()) != 0;
+	if (ext == ".tga")
+		return stbi_write_tga(file.c_str(), image.w, image.h, 3, pixels.data()) != 0;
+
+	return false;
+}
+
+// ---------------------------------------------------------------------------
+// Running it
+
+struct BenchCase
+{
+	std::string name;
+	std::string path;
+
+	// Crop (left, top, right, bottom) as a fraction of the image, all zero for none
+	float crop[4];
+};
+
+struct CaseResult
+{
+	bool loaded;
+	int fullW;
+	int fullH;
+	int w;
+	int h;
+	int decodeScale;
+	int viewW;
+	int viewH;
+	long fileBytes;
+	bool icon;
+	ColorSet colors;
+};
+
+// Works out the crop in pixels for a fullW by fullH image
+static SampleCrop makeCrop(const BenchCase &bench, int fullW, int fullH)
+{
+	SampleCrop crop = { 0 };
+
+	crop.custom = bench.crop[2] > 0 && bench.crop[3] > 0;
+	crop.left = (int)(bench.crop[0] * fullW);
+	crop.top = (int)(bench.crop[1] * fullH);
+	crop.right = (int)(bench.crop[2] * fullW);
+	crop.bottom = (int)(bench.crop[3] * fullH);
+
+	return crop;
+}
+
+// Read files through stdio like the plugin used to, rather than mapping them
+static bool useStdio = false;
+
+// Decodes the file the old way, through a FILE*
+static uint32_t *decodeStdio(const BenchCase &bench, CaseResult *result, SampleCrop *crop, int *w, int *h, StageTimer *decodeTimer)
+{
+	FILE *fp = fopen(bench.path.c_str(), "rb");
+	if (fp == nullptr)
+	{
+		return nullptr;
+	}
+
+	// Hashing has to read it all separately
+	{
+		StageTimer hashTimer(STAGE_HASH, decodeTimer);
+		std::vector<uint8_t> buffer(256 * 1024);
+		ContentHasher hasher;
+		size_t length;
+		while ((length = fread(buffer.data(), 1, buffer.size(), fp)) > 0)
+		{
+			hasher.update(buffer.data(), length);
+		}
+		hasher.digest();
+		result->fileBytes = ftell(fp);
+		rewind(fp);
+	}
+
+	int n;
+	if (stbi_info_from_file(fp, &result->fullW, &result->fullH, &n))
+	{
+		int region[4];
+		*crop = makeCrop(bench, result->fullW, result->fullH);
+		cropRegion(*crop, result->fullW, result->fullH, region);
+
+		result->decodeScale = pickDecodeScale(result->fullW, result->fullH, region[0], region[1], region[2], region[3], SAMPLE_MAX_DIMENSION);
+	}
+
+	uint32_t *imgData = (uint32_t*)stbi_load_from_file_scaled(fp, w, h, &n, 4, &result->decodeScale);
+	fclose(fp);
+
+	return imgData;
+}
+
+// And the way the plugin does it now, out of a mapping
+static uint32_t *decodeMapped(const BenchCase &bench, CaseResult *result, SampleCrop *crop, int *w, int *h, StageTimer *decodeTimer)
+{
+	MappedFile file;
+	if (!file.open(fs::path(bench.path).wstring()))
+	{
+		return nullptr;
+	}
+
+	result->fileBytes = (long)file.size();
+
+	// Anything stb can't read is the icon or nothing. The plugin asks the
+	// shell for whatever isn't an .ico or a program with its own icon,
+	// which there's no doing here.
+	ImageFormat format = sniffFormat(file.data(), file.size());
+	if (!stbCanRead(format))
+	{
+		uint32_t *icon = format == FORMAT_ICO || format == FORMAT_EXECUTABLE ? decodeIcon(file.data(), file.size(), w, h) : nullptr;
+		if (icon != nullptr)
+		{
+			result->icon = true;
+			result->fullW = *w;
+			result->fullH = *h;
+			*crop = makeCrop(bench, *w, *h);
+		}
+
+		return icon;
+	}
+
+	StageTimer hashTimer(STAGE_HASH, decodeTimer);
+	hashContent(file.data(), file.size());
+	hashTimer.stop();
+
+	// The crops here are fractions of the image, so it needs the size
+	// before decodeImage can be told what to keep. That's just the header.
+	int fullW, fullH, n;
+	if (file.size() <= INT_MAX && stbi_info_from_memory_format(file.data(), (int)file.size(), &fullW, &fullH, &n, stbFormat(format)))
+	{
+		*crop = makeCrop(bench, fullW, fullH);
+	}
+
+	return decodeImage(file.data(), file.size(), format, *crop, w, h, &result->fullW, &result->fullH, &result->decodeScale);
+}
+
+// What ProcessSample does with a file, minus the palette caches, going
+// through the same decodeImage and cropDecoded it does. The file
+// still gets hashed (it would be on a cache miss) but nothing is looked up,
+// or every run after the first would skip straight to the end. The hash is
+// timed separately and left out of Decode, same as the plugin.
+static CaseResult runPipeline(const BenchCase &bench, SampleMode mode = SAMPLE_MODE_BOX, int budget = SAMPLE_DEFAULT_BUDGET)
+{
+	CaseResult result = { 0 };
+	StageTimer sampleTimer(STAGE_SAMPLE);
+	StageTimer decodeTimer(STAGE_DECODE);
+
+	SampleCrop crop = { 0 };
+	int w, h;
+
+	uint32_t *imgData = useStdio ? decodeStdio(bench, &result, &crop, &w, &h, &decodeTimer) : decodeMapped(bench, &result, &crop, &w, &h, &decodeTimer);
+	decodeTimer.stop();
+
+	if (imgData == nullptr)
+	{
+		return result;
+	}
+
+	bool outOfBounds;
+	ImageView view = cropDecoded(makeView(imgData, w, h), nullptr, result.decodeScale, crop, &outOfBounds);
+
+	result.loaded = true;
+	result.w = w;
+	result.h = h;
+	result.viewW = view.w;
+	result.viewH = view.h;
+
+	if (view.w > 0 && view.h > 0)
+	{
+		analyzeView(view, result.icon, &result.colors, mode, budget);
+	}
+
+	stbi_image_free(imgData);
+
+	return result;
+}
+
+// How fast hashing goes on its own, over a buffer big enough that it's
+// memory rather than the cache being measured. In GB/s.
+#define HASH_BENCH_SIZE (256 * 1024 * 1024)
+
+static double measureHashSpeed(size_t size, int iterations)
+{
+	std::vector<uint8_t> buffer(size);
+	uint32_t state = 0xC0FFEE;
+	for (size_t i = 0; i < size; i += 4)
+	{
+		uint32_t value = nextRandom(&state);
+		memcpy(&buffer[i], &value, std::min<size_t>(4, size - i));
+	}
+
+	// Keeps the compiler from deciding the result isn't needed
+	volatile uint64_t sink = hashContent(buffer.data(), size);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i)
+	{
+		sink = sink + hashContent(buffer.data(), size);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	return seconds > 0 ? (double)size * iterations / 1e9 / seconds : 0;
+}
+
+// Resizing on its own, the way analyzeView does it against the
+// stb_image_resize box filter it replaced, on images too big to want to
+// decode every run. The exact multiples are the ones with their own kernels.
+struct ResizeCase
+{
+	const char *name;
+	int w;
+	int h;
+};
+
+static const ResizeCase resizeCases[] =
+{
+	{ "512x512", 512, 512 },
+	{ "1024x1024", 1024, 1024 },
+	{ "2048x2048", 2048, 2048 },
+	{ "4k", 3840, 2160 },
+	{ "8k", 7680, 4320 },
+	{ "16k", 15360, 8640 },
+};
+
+struct ResizeResult
+{
+	double stbirMs;
+	double fusedMs;
+	double scalarMs;
+	int maxDifference;
+};
+
+template <typename Resize>
+static double timeResize(int iterations, Resize resize)
+{
+	double best = 0;
+
+	for (int i = 0; i < iterations; ++i)
+	{
+		auto start = std::chrono::steady_clock::now();
+		resize();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if (i == 0 || ms < best)
+		{
+			best = ms;
+		}
+	}
+
+	return best;
+}
+
+// Something with a bit of structure so rounding differences show up
+static std::vector<uint32_t> makeStructuredImage(int w, int h)
+{
+	std::vector<uint32_t> source((size_t)w * h);
+	uint32_t state = (uint32_t)w * 31 + h;
+	for (int y = 0; y < h; ++y)
+	{
+		for (int x = 0; x < w; ++x)
+		{
+			uint32_t noise = nextRandom(&state) & 0x1F1F1F;
+			source[(size_t)y * w + x] = 0xFF000000 | ((x * 255 / w) + ((y * 255 / h) << 8) + (((x ^ y) & 0x40) << 16) + noise);
+		}
+	}
+
+	return source;
+}
+
+// The most any channel differs between two images the same size
+static int maxDifference(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b)
+{
+	const uint8_t *x = (const uint8_t*)a.data();
+	const uint8_t *y = (const uint8_t*)b.data();
+	int most = 0;
+
+	for (size_t i = 0; i < a.size() * 4; ++i)
+	{
+		most = std::max(most, std::abs(x[i] - y[i]));
+	}
+
+	return most;
+}
+
+static ResizeResult measureResize(const ResizeCase &resize, int iterations)
+{
+	ResizeResult result = { 0 };
+	std::vector<uint32_t> source = makeStructuredImage(resize.w, resize.h);
+
+	ImageView view = makeView(source.data(), resize.w, resize.h);
+	int dstW = std::min(resize.w, SAMPLE_MAX_DIMENSION);
+	int dstH = std::min(resize.h, SAMPLE_MAX_DIMENSION);
+	std::vector<uint32_t> expected((size_t)dstW * dstH), fused(expected.size()), scalar(expected.size());
+
+	result.stbirMs = timeResize(iterations, [&]() {
+		stbir_resize_uint8_generic(view.data, view.w, view.h, (int)view.stride, (unsigned char*)expected.data(), dstW, dstH, 0, 4, -1, 0,
+			STBIR_EDGE_CLAMP, STBIR_FILTER_BOX, STBIR_COLORSPACE_LINEAR, NULL);
+	});
+	result.fusedMs = timeResize(iterations, [&]() { downsampleView(view, fused.data(), dstW, dstH); });
+	result.scalarMs = timeResize(iterations, [&]() { downsampleView(view, scalar.data(), dstW, dstH, PIXEL_KERNEL_SCALAR); });
+
+	result.maxDifference = maxDifference(expected, fused);
+
+	// The kernels are meant to agree exactly
+	if (memcmp(fused.data(), scalar.data(), fused.size() * sizeof(uint32_t)) != 0)
+	{
+		result.maxDifference = -1;
+	}
+
+	return result;
+}
+
+// Several crops of one 8K image, each shrunk straight from the full size
+// image against from the closest level of a pyramid built once for all of
+// them. Regions are left, top, right, bottom.
+struct PyramidRegion
+{
+	const char *name;
+	int left;
+	int top;
+	int right;
+	int bottom;
+};
+
+static const PyramidRegion pyramidRegions[] =
+{
+	{ "whole", 0, 0, 7680, 4320 },
+	{ "centre", 1920, 1080, 5760, 3240 },
+	{ "corner", 0, 0, 1920, 1080 },
+	{ "strip", 0, 3840, 7680, 4320 },
+	{ "tile", 5000, 1000, 5512, 1512 },
+};
+
+static void printPyramid(FILE *out, int iterations)
+{
+	const int w = 7680, h = 4320;
+	std::vector<uint32_t> source = makeStructuredImage(w, h);
+	ImageView view = makeView(source.data(), w, h);
+
+	double buildMs = timeResize(iterations, [&]() { MipPyramid pyramid(view, SAMPLE_MAX_DIMENSION); });
+
+	MipPyramid pyramid(view, SAMPLE_MAX_DIMENSION);
+	MipPyramid scalar(view, SAMPLE_MAX_DIMENSION, PIXEL_KERNEL_SCALAR);
+
+	// The kernels are meant to agree exactly
+	bool agree = true;
+	for (int l = 1; l < pyramid.levels(); ++l)
+	{
+		const ImageView &a = pyramid.level(l);
+		agree = agree && memcmp(a.data, scalar.level(l).data, (size_t)a.h * a.stride) == 0;
+	}
+
+	fprintf(out, "    \"width\": %d, \"height\": %d, \"levels\": %d, \"buildMs\": %.3f, \"kernelsAgree\": %s,\n    \"regions\": [\n",
+		w, h, pyramid.levels(), buildMs, agree ? "true" : "false");
+
+	size_t regionCount = sizeof(pyramidRegions) / sizeof(pyramidRegions[0]);
+	double directTotal = 0, pyramidTotal = 0;
+
+	for (size_t r = 0; r < regionCount; ++r)
+	{
+		const PyramidRegion &region = pyramidRegions[r];
+		ImageView crop = cropView(view, region.left, region.top, region.right, region.bottom);
+		int level;
+		ImageView reduced = pyramid.region(region.left, region.top, region.right, region.bottom, SAMPLE_MAX_DIMENSION, &level);
+
+		int dstW = std::min(crop.w, SAMPLE_MAX_DIMENSION);
+		int dstH = std::min(crop.h, SAMPLE_MAX_DIMENSION);
+		std::vector<uint32_t> direct((size_t)dstW * dstH), fromPyramid(direct.size());
+
+		double directMs = timeResize(iterations, [&]() { downsampleView(crop, direct.data(), dstW, dstH); });
+		double pyramidMs = timeResize(iterations, [&]() { downsampleView(reduced, fromPyramid.data(), dstW, dstH); });
+
+		directTotal += directMs;
+		pyramidTotal += pyramidMs;
+
+		fprintf(out, "      { \"name\": \"%s\", \"width\": %d, \"height\": %d, \"level\": %d, \"directMs\": %.3f, \"pyramidMs\": %.3f, \"maxDifference\": %d }%s\n",
+			region.name, crop.w, crop.h, level, directMs, pyramidMs, maxDifference(direct, fromPyramid),
+			r + 1 < regionCount ? "," : "");
+	}
+
+	fprintf(out, "    ],\n    \"directTotalMs\": %.3f, \"pyramidTotalMs\": %.3f\n",
+		directTotal, buildMs + pyramidTotal);
+}
+
+// The stage names are plain ASCII, so this is all JSON needs
+static std::string narrow(const wchar_t *text)
+{
+	std::string out;
+	while (*text)
+	{
+		out += (char)*text++;
+	}
+	return out;
+}
+
+static std::string escape(const std::string &text)
+{
+	std::string out;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+		}
+		out += c;
+	}
+	return out;
+}
+
+// Files stb can't read, for the formats section. Only the first few bytes
+// matter to the sniffer, the rest is just there for hashing to get
+// through like it would have with a real one.
+struct OtherFile
+{
+	const char *name;
+	const char *header;
+	size_t headerLength;
+	size_t size;
+};
+
+static const OtherFile otherFiles[] =
+{
+	{ "program.exe", "MZ", 2, 4 * 1024 * 1024 },
+	{ "picture.webp", "RIFF\0\0\0\0WEBPVP8 ", 16, 300 * 1024 },
+	{ "shortcut.lnk", "\x4C\0\0\0\x01\x14\x02\0", 8, 2 * 1024 }
+};
+
+static bool writeBytes(const fs::path &path, const std::vector<uint8_t> &bytes)
+{
+	FILE *fp = fopen(path.string().c_str(), "wb");
+	if (fp == nullptr)
+	{
+		return false;
+	}
+
+	bool written = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+	fclose(fp);
+
+	return written;
+}
+
+static bool writeOtherFile(const fs::path &path, const OtherFile &other)
+{
+	std::vector<uint8_t> bytes(other.size);
+	uint32_t state = 0x51F15EED ^ (uint32_t)other.size;
+	for (size_t i = 0; i < bytes.size(); ++i)
+	{
+		bytes[i] = (uint8_t)nextRandom(&state);
+	}
+	memcpy(bytes.data(), other.header, other.headerLength);
+
+	return writeBytes(path, bytes);
+}
+
+static void appendBytes(void *context, void *data, int size)
+{
+	std::vector<uint8_t> *bytes = (std::vector<uint8_t>*)context;
+	bytes->insert(bytes->end(), (uint8_t*)data, (uint8_t*)data + size);
+}
+
+// Little-endian, the way everything in .ico files and programs is
+static void putBytes(std::vector<uint8_t> &bytes, size_t offset, uint32_t value, int length)
+{
+	if (bytes.size() < offset + length)
+	{
+		bytes.resize(offset + length);
+	}
+
+	for (int b = 0; b < length; ++b)
+	{
+		bytes[offset + b] = (uint8_t)(value >> (b * 8));
+	}
+}
+
+// One size of a made-up icon, as it'd be stored in an .ico or a program
+struct IconImage
+{
+	int size;
+	int bitCount;
+	std::vector<uint8_t> data;
+};
+
+static IconImage makePngIcon(int size)
+{
+	SyntheticImage image = { "icon", size, size, PATTERN_GRADIENT };
+	std::vector<uint8_t> pixels = makePixels(image);
+
+	IconImage icon = { size, 32 };
+	stbi_write_png_to_func(appendBytes, &icon.data, size, size, 3, pixels.data(), size * 3);
+
+	return icon;
+}
+
+// The old style: BITMAPINFOHEADER, palette, colors bottom-up, then the mask.
+// Paletted ones get the gradient's red channel run through a grey palette.
+static IconImage makeDibIcon(int size, int bitCount)
+{
+	SyntheticImage image = { "icon", size, size, PATTERN_GRADIENT };
+	std::vector<uint8_t> pixels = makePixels(image);
+
+	int paletteSize = bitCount <= 8 ? 1 << bitCount : 0;
+	size_t colorStride = (((size_t)size * bitCount + 31) / 32) * 4;
+	size_t maskStride = (((size_t)size + 31) / 32) * 4;
+	size_t colorOffset = 40 + paletteSize * 4;
+
+	IconImage icon = { size, bitCount };
+	std::vector<uint8_t> &bytes = icon.data;
+	bytes.assign(colorOffset + (colorStride + maskStride) * size, 0);
+
+	putBytes(bytes, 0, 40, 4);
+	putBytes(bytes, 4, size, 4);
+	putBytes(bytes, 8, size * 2, 4);
+	putBytes(bytes, 12, 1, 2);
+	putBytes(bytes, 14, bitCount, 2);
+
+	for (int i = 0; i < paletteSize; ++i)
+	{
+		uint8_t grey = (uint8_t)(i * 255 / (paletteSize - 1));
+		putBytes(bytes, 40 + i * 4, grey | (grey << 8) | (grey << 16), 4);
+	}
+
+	for (int y = 0; y < size; ++y)
+	{
+		uint8_t *row = &bytes[colorOffset + colorStride * (size - 1 - y)];
+		uint8_t *mask = &bytes[colorOffset + colorStride * size + maskStride * (size - 1 - y)];
+
+		for (int x = 0; x < size; ++x)
+		{
+			const uint8_t *p = &pixels[((size_t)y * size + x) * 3];
+
+			if (bitCount == 32 || bitCount == 24)
+			{
+				uint8_t *dst = row + x * (bitCount / 8);
+				dst[0] = p[2];
+				dst[1] = p[1];
+				dst[2] = p[0];
+				if (bitCount == 32)
+				{
+					dst[3] = 255;
+				}
+			}
+			else
+			{
+				int index = p[0] * (paletteSize - 1) / 255;
+				int bit = x * bitCount;
+				row[bit / 8] |= (uint8_t)(index << (8 - bitCount - bit % 8));
+			}
+
+			// A transparent border, like real icons have
+			if (x == 0 || y == 0 || x == size - 1 || y == size - 1)
+			{
+				mask[x / 8] |= (uint8_t)(0x80 >> (x % 8));
+			}
+		}
+	}
+
+	return icon;
+}
+
+// ICONDIR, an ICONDIRENTRY for each image, then the images
+static std::vector<uint8_t> makeIconFile(const std::vector<IconImage> &images)
+{
+	std::vector<uint8_t> bytes;
+	putBytes(bytes, 0, 0, 2);
+	putBytes(bytes, 2, 1, 2);
+	putBytes(bytes, 4, (uint32_t)images.size(), 2);
+
+	size_t offset = 6 + images.size() * 16;
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		size_t entry = 6 + i * 16;
+
+		// 0 meaning 256 for the size
+		putBytes(bytes, entry, images[i].size & 0xFF, 1);
+		putBytes(bytes, entry + 1, images[i].size & 0xFF, 1);
+		putBytes(bytes, entry + 4, 1, 2);
+		putBytes(bytes, entry + 6, images[i].bitCount, 2);
+		putBytes(bytes, entry + 8, (uint32_t)images[i].data.size(), 4);
+		putBytes(bytes, entry + 12, (uint32_t)offset, 4);
+		offset += images[i].data.size();
+	}
+
+	for (const IconImage &image : images)
+	{
+		bytes.insert(bytes.end(), image.data.begin(), image.data.end());
+	}
+
+	return bytes;
+}
+
+// Just enough of a 64 bit program for its icons to be found: the headers,
+// and one .rsrc section with an RT_ICON for each image and an
+// RT_GROUP_ICON listing them
+static std::vector<uint8_t> makeProgram(const std::vector<IconImage> &images)
+{
+	const uint32_t fileAlign = 0x200, sectionRva = 0x1000;
+	size_t count = images.size();
+
+	// Where everything goes in the section: the type directory with its
+	// two entries, a name directory for each type, a language directory
+	// for each resource, a data entry for each resource and then the data
+	size_t typeDir = 0;
+	size_t iconNames = typeDir + 16 + 2 * 8;
+	size_t groupNames = iconNames + 16 + count * 8;
+	size_t languages = groupNames + 16 + 8;
+	size_t dataEntries = languages + (count + 1) * (16 + 8);
+	size_t data = dataEntries + (count + 1) * 16;
+
+	std::vector<uint8_t> rsrc;
+	putBytes(rsrc, typeDir + 14, 2, 2);
+	putBytes(rsrc, typeDir + 16, 3, 4);
+	putBytes(rsrc, typeDir + 20, 0x80000000 | (uint32_t)iconNames, 4);
+	putBytes(rsrc, typeDir + 24, 14, 4);
+	putBytes(rsrc, typeDir + 28, 0x80000000 | (uint32_t)groupNames, 4);
+
+	putBytes(rsrc, iconNames + 14, (uint32_t)count, 2);
+	putBytes(rsrc, groupNames + 14, 1, 2);
+
+	// The group, which goes after all the icons
+	std::vector<uint8_t> group;
+	putBytes(group, 2, 1, 2);
+	putBytes(group, 4, (uint32_t)count, 2);
+
+	for (size_t i = 0; i <= count; ++i)
+	{
+		bool isGroup = i == count;
+		size_t language = languages + i * (16 + 8);
+		size_t entry = dataEntries + i * 16;
+
+		putBytes(rsrc, isGroup ? groupNames + 16 : iconNames + 16 + i * 8, isGroup ? 1 : (uint32_t)(i + 1), 4);
+		putBytes(rsrc, (isGroup ? groupNames + 16 : iconNames + 16 + i * 8) + 4, 0x80000000 | (uint32_t)language, 4);
+
+		putBytes(rsrc, language + 14, 1, 2);
+		putBytes(rsrc, language + 16, 1033, 4);
+		putBytes(rsrc, language + 20, (uint32_t)entry, 4);
+
+		if (!isGroup)
+		{
+			size_t groupEntry = 6 + i * 14;
+			putBytes(group, groupEntry, images[i].size & 0xFF, 1);
+			putBytes(group, groupEntry + 1, images[i].size & 0xFF, 1);
+			putBytes(group, groupEntry + 4, 1, 2);
+			putBytes(group, groupEntry + 6, images[i].bitCount, 2);
+			putBytes(group, groupEntry + 8, (uint32_t)images[i].data.size(), 4);
+			putBytes(group, groupEntry + 12, (uint32_t)(i + 1), 2);
+		}
+
+		const std::vector<uint8_t> &blob = isGroup ? group : images[i].data;
+		putBytes(rsrc, entry, sectionRva + (uint32_t)data, 4);
+		putBytes(rsrc, entry + 4, (uint32_t)blob.size(), 4);
+
+		rsrc.resize(data);
+		rsrc.insert(rsrc.end(), blob.begin(), blob.end());
+		data = (rsrc.size() + 3) & ~(size_t)3;
+	}
+
+	uint32_t rsrcSize = (uint32_t)rsrc.size();
+	rsrc.resize((rsrc.size() + fileAlign - 1) & ~(size_t)(fileAlign - 1));
+
+	// MZ, then PE, the COFF header, a PE32+ optional header with all 16
+	// data directories and the one section header
+	std::vector<uint8_t> bytes(fileAlign, 0);
+	bytes[0] = 'M';
+	bytes[1] = 'Z';
+	putBytes(bytes, 0x3C, 64, 4);
+	memcpy(&bytes[64], "PE\0\0", 4);
+	putBytes(bytes, 68, 0x8664, 2);
+	putBytes(bytes, 70, 1, 2);
+	putBytes(bytes, 84, 112 + 16 * 8, 2);
+	putBytes(bytes, 86, 0x22, 2);
+
+	size_t optional = 88;
+	putBytes(bytes, optional, 0x20B, 2);
+	putBytes(bytes, optional + 32, sectionRva, 4);
+	putBytes(bytes, optional + 36, fileAlign, 4);
+	putBytes(bytes, optional + 108, 16, 4);
+	putBytes(bytes, optional + 112 + 2 * 8, sectionRva, 4);
+	putBytes(bytes, optional + 112 + 2 * 8 + 4, rsrcSize, 4);
+
+	size_t section = optional + 112 + 16 * 8;
+	memcpy(&bytes[section], ".rsrc", 5);
+	putBytes(bytes, section + 8, rsrcSize, 4);
+	putBytes(bytes, section + 12, sectionRva, 4);
+	putBytes(bytes, section + 16, (uint32_t)rsrc.size(), 4);
+	putBytes(bytes, section + 20, fileAlign, 4);
+
+	bytes.insert(bytes.end(), rsrc.begin(), rsrc.end());
+
+	return bytes;
+}
+
+// A 256x256 icon the way Vista onwards stores them, as a PNG inside the .ico
+static bool writeIcon(const fs::path &path)
+{
+	return writeBytes(path, makeIconFile({ makePngIcon(256) }));
+}
+
+// An old style icon with every size in it, and a program with the usual
+// sizes and a PNG for the big one, for timing reading icons
+static bool writeIcons(const fs::path &path)
+{
+	return writeBytes(path, makeIconFile({ makeDibIcon(16, 4), makeDibIcon(32, 8), makeDibIcon(48, 24), makeDibIcon(256, 32) }));
+}
+
+static bool writeProgram(const fs::path &path)
+{
+	return writeBytes(path, makeProgram({ makeDibIcon(16, 4), makeDibIcon(32, 8), makeDibIcon(48, 32), makePngIcon(256) }));
+}
+
+// Everything that happens to a file that's already in memory before stb
+// starts on its pixels, which is all sniffing changes. probed is the way
+// it used to go: hashed for the content cache, then stb tries each decoder
+// in turn until one says yes (or none do, and loading goes through them
+// all again before giving up). Otherwise the format gets sniffed first,
+// images go straight to their decoder and anything else is left for the
+// icon without being hashed.
+static void routeBuffer(const MappedFile &file, bool probed)
+{
+	ImageFormat format = probed ? FORMAT_UNKNOWN : sniffFormat(file.data(), file.size());
+	if (!stbCanRead(format))
+	{
+		return;
+	}
+
+	hashContent(file.data(), file.size());
+
+	int fileSize = (int)file.size();
+	int w, h, n;
+	if (!stbi_info_from_memory_format(file.data(), fileSize, &w, &h, &n, stbFormat(format)))
+	{
+		int scale = 0;
+		stbi_image_free(stbi_load_from_memory_format(file.data(), fileSize, &w, &h, &n, 4, &scale, stbFormat(format)));
+	}
+}
+
+static void printFormats(FILE *out, const std::vector<BenchCase> &cases, const fs::path &corpusDir, bool synthetic, int iterations)
+{
+	std::vector<BenchCase> files = cases;
+
+	if (synthetic)
+	{
+		for (const OtherFile &other : otherFiles)
+		{
+			fs::path path = corpusDir / other.name;
+			if (fs::exists(path) || writeOtherFile(path, other))
+			{
+				files.push_back({ other.name, path.string(), { 0, 0, 0, 0 } });
+			}
+		}
+
+		fs::path icon = corpusDir / "icon.ico";
+		if (fs::exists(icon) || writeIcon(icon))
+		{
+			files.push_back({ "icon.ico", icon.string(), { 0, 0, 0, 0 } });
+		}
+	}
+
+	double savedTotal = 0;
+	int nonJpeg = 0;
+	bool first = true;
+
+	fprintf(out, "    \"files\": [\n");
+
+	for (const BenchCase &bench : files)
+	{
+		// Crops of the same file don't make any difference here
+		if (bench.name.find('@') != std::string::npos)
+		{
+			continue;
+		}
+
+		MappedFile file;
+		if (!file.open(fs::path(bench.path).wstring()))
+		{
+			continue;
+		}
+
+		ImageFormat format = sniffFormat(file.data(), file.size());
+		double probedMs = timeResize(iterations, [&]() { routeBuffer(file, true); });
+		double sniffedMs = timeResize(iterations, [&]() { routeBuffer(file, false); });
+
+		if (format != FORMAT_JPEG)
+		{
+			savedTotal += probedMs - sniffedMs;
+			nonJpeg++;
+		}
+
+		fprintf(out, "%s      { \"name\": \"%s\", \"format\": \"%s\", \"fileBytes\": %lu, \"probedMs\": %.4f, \"sniffedMs\": %.4f, \"savedMs\": %.4f }",
+			first ? "" : ",\n", escape(bench.name).c_str(), narrow(formatName(format)).c_str(), (unsigned long)file.size(), probedMs, sniffedMs, probedMs - sniffedMs);
+		first = false;
+	}
+
+	fprintf(out, "\n    ],\n    \"nonJpegFiles\": %d, \"savedPerNonJpegMs\": %.4f\n", nonJpeg, nonJpeg > 0 ? savedTotal / nonJpeg : 0);
+}
+
+// Reading the best icon out of .ico files and programs, which the plugin
+// used to have to ask the shell for (that part can't be timed here)
+static void printIcons(FILE *out, const std::vector<BenchCase> &cases, const fs::path &corpusDir, bool synthetic, int iterations)
+{
+	std::vector<BenchCase> files;
+
+	if (synthetic)
+	{
+		struct { const char *name; bool (*write)(const fs::path&); } generated[] =
+		{
+			{ "icon.ico", writeIcon },
+			{ "icons.ico", writeIcons },
+			{ "icons.exe", writeProgram }
+		};
+
+		for (const auto &icon : generated)
+		{
+			fs::path path = corpusDir / icon.name;
+			if (fs::exists(path) || icon.write(path))
+			{
+				files.push_back({ icon.name, path.string(), { 0, 0, 0, 0 } });
+			}
+		}
+	}
+
+	// And anything from the command line that has icons in it
+	for (const BenchCase &bench : cases)
+	{
+		MappedFile file;
+		if (file.open(fs::path(bench.path).wstring()))
+		{
+			ImageFormat format = sniffFormat(file.data(), file.size());
+			if (format == FORMAT_ICO || format == FORMAT_EXECUTABLE)
+			{
+				files.push_back(bench);
+			}
+		}
+	}
+
+	for (size_t f = 0; f < files.size(); ++f)
+	{
+		const BenchCase &bench = files[f];
+		MappedFile file;
+		file.open(fs::path(bench.path).wstring());
+
+		int w = -1, h = -1;
+		double decodeMs = timeResize(iterations, [&]()
+		{
+			stbi_image_free(decodeIcon(file.data(), file.size(), &w, &h));
+		});
+
+		// What finding it in the icon cache costs instead
+		uint64_t hash = 0;
+		double hashMs = timeResize(iterations, [&]()
+		{
+			hashIcon(file.data(), file.size(), &hash);
+		});
+
+		fprintf(out, "    { \"name\": \"%s\", \"format\": \"%s\", \"fileBytes\": %lu, \"found\": %s, \"width\": %d, \"height\": %d, \"decodeMs\": %.4f, \"hashMs\": %.4f }%s\n",
+			escape(bench.name).c_str(), narrow(formatName(sniffFormat(file.data(), file.size()))).c_str(), (unsigned long)file.size(),
+			w > 0 ? "true" : "false", w, h, decodeMs, hashMs, f + 1 < files.size() ? "," : "");
+	}
+}
+
+// How the parts of sampling that get split across threads speed up with
+// more of them: shrinking an 8K image, converting a 4K BGRX capture and
+// building the summed-area table for one. Best of a few runs, in ms.
+struct ScalingResult
+{
+	double downsampleMs;
+	double convertMs;
+	double tableMs;
+};
+
+static ScalingResult measureScaling(size_t threads, int iterations)
+{
+	static std::vector<uint32_t> big, capture, converted;
+
+	if (big.empty())
+	{
+		uint32_t state = 0x5CA1AB1E;
+
+		big.resize((size_t)7680 * 4320);
+		for (uint32_t &pixel : big)
+		{
+			pixel = nextRandom(&state) | 0xFF000000;
+		}
+
+		capture.assign(big.begin(), big.begin() + (size_t)3840 * 2160);
+		converted.resize(capture.size());
+	}
+
+	setParallelThreads(threads);
+
+	ImageView bigView = makeView(big.data(), 7680, 4320);
+	ImageView captureView = makeView(capture.data(), 3840, 2160);
+	PixelFormat bgrx = { 4, 0x00FF0000, 0x0000FF00, 0x000000FF };
+	std::vector<uint32_t> sample((size_t)SAMPLE_MAX_DIMENSION * SAMPLE_MAX_DIMENSION);
+
+	ScalingResult result;
+	result.downsampleMs = timeResize(iterations, [&]() { downsampleView(bigView, sample.data(), SAMPLE_MAX_DIMENSION, SAMPLE_MAX_DIMENSION); });
+	result.convertMs = timeResize(iterations, [&]() {
+		convertPixels(converted.data(), (const uint8_t*)capture.data(), 3840, 2160, 3840 * 4, &bgrx);
+	});
+	result.tableMs = timeResize(iterations, [&]() { SummedAreaTable table(captureView); });
+
+	return result;
+}
+
+// How far apart two colors are, straight line distance in RGB
+static double colorDistance(uint32_t a, uint32_t b)
+{
+	double total = 0;
+
+	// Rainmeter order, RRGGBBAA
+	for (int shift = 8; shift < 32; shift += 8)
+	{
+		int difference = (int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF);
+		total += difference * difference;
+	}
+
+	return sqrt(total);
+}
+
+// Compares every color in two palettes
+static void comparePalettes(const ColorSet &a, const ColorSet &b, double *mean, double *maximum)
+{
+	const uint32_t ColorSet::*colors[] =
+	{
+		&ColorSet::bg1, &ColorSet::bg2, &ColorSet::fg1, &ColorSet::fg2,
+		&ColorSet::l1, &ColorSet::l2, &ColorSet::l3, &ColorSet::l4,
+		&ColorSet::d1, &ColorSet::d2, &ColorSet::d3, &ColorSet::d4,
+		&ColorSet::avg
+	};
+	size_t count = sizeof(colors) / sizeof(colors[0]);
+
+	*mean = 0;
+	*maximum = 0;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		double distance = colorDistance(a.*colors[i], b.*colors[i]);
+		*mean += distance / count;
+		*maximum = std::max(*maximum, distance);
+	}
+}
+
+// Runs a case a few times the way a skin with SampleMode/SampleBudget set
+// would, and prints how long it took and how close it got to averaging
+// every pixel
+static void printSampling(FILE *out, const BenchCase &bench, int iterations, const ColorSet &reference, SampleMode mode, int budget, bool last)
+{
+	CaseResult result = runPipeline(bench, mode, budget);
+
+	resetStats();
+	for (int i = 0; i < iterations; ++i)
+	{
+		result = runPipeline(bench, mode, budget);
+	}
+
+	double mean, maximum;
+	comparePalettes(reference, result.colors, &mean, &maximum);
+
+	fprintf(out, "        { \"mode\": \"%s\", \"budget\": %d, \"resizeMs\": %.3f, \"sampleMs\": %.3f, \"meanDistance\": %.2f, \"maxDistance\": %.2f, \"luminanceDifference\": %.4f }%s\n",
+		mode == SAMPLE_MODE_BOX ? "Box" : "Stratified", mode == SAMPLE_MODE_BOX ? 0 : budget, readStage(STAGE_RESIZE).average, readStage(STAGE_SAMPLE).average,
+		mean, maximum, fabs(reference.lum - result.colors.lum), last ? "" : ",");
+}
+
+// ---------------------------------------------------------------------------
+// Checks
+//
+// Not timings: each of these runs the fast way of doing something against
+// the plain way and counts how often they disagree. Any failure makes the
+// bench exit with 2.
+
+struct CheckResult
+{
+	int cases;
+	int failures;
+
+	// What the first failure was, to start looking from
+	std::string firstFailure;
+};
+
+static int failedChecks = 0;
+
+static void checkThat(CheckResult *result, bool passed, const std::string &what)
+{
+	++result->cases;
+
+	if (!passed)
+	{
+		if (result->failures++ == 0)
+		{
+			result->firstFailure = what;
+		}
+	}
+}
+
+static void printCheck(FILE *out, const char *name, const CheckResult &result, bool last)
+{
+	if (result.failures > 0)
+	{
+		++failedChecks;
+	}
+
+	fprintf(out, "    \"%s\": { \"passed\": %s, \"cases\": %d, \"failures\": %d, \"firstFailure\": \"%s\" }%s\n",
+		name, result.failures == 0 ? "true" : "false", result.cases, result.failures, escape(result.firstFailure).c_str(), last ? "" : ",");
+	fflush(out);
+}
+
+// The conversion SampleImage used to do inline: shift each channel down and
+// mask it, no expanding narrow channels and no row padding
+static void convertOldLoop(uint32_t *dst, const uint8_t *src, int w, int h, const PixelFormat &format)
+{
+	// What _BitScanForward worked out
+	auto lowestBit = [](uint32_t mask) { int shift = 0; while (!(mask & (1u << shift))) ++shift; return shift; };
+
+	int rShift = lowestBit(format.rMask);
+	int gShift = lowestBit(format.gMask);
+	int bShift = lowestBit(format.bMask);
+	uint32_t rMask = format.rMask >> rShift;
+	uint32_t gMask = format.gMask >> gShift;
+	uint32_t bMask = format.bMask >> bShift;
+
+	for (size_t i = 0; i < (size_t)w * h; ++i)
+	{
+		uint32_t pixel;
+		memcpy(&pixel, src + i * format.bytesPerPixel, sizeof(pixel));
+
+		uint8_t r = (pixel >> rShift) & rMask;
+		uint8_t g = (pixel >> gShift) & gMask;
+		uint8_t b = (pixel >> bShift) & bMask;
+
+		dst[i] = 0xFF000000 | (b << 16) | (g << 8) | r;
+	}
+}
+
+// Every convertPixels kernel against the scalar one for every layout a
+// desktop capture can come in, at awkward widths and with padded rows.
+// For the 8 bit per channel layouts (the only ones it got right) the
+// scalar one is also checked against the old inline loop.
+static CheckResult checkPixelConvert()
+{
+	struct Layout
+	{
+		const char *name;
+		PixelFormat format;
+	};
+
+	static const Layout layouts[] =
+	{
+		{ "BGRX", { 4, 0x00FF0000, 0x0000FF00, 0x000000FF } },
+		{ "RGBX bitfields", { 4, 0x000000FF, 0x0000FF00, 0x00FF0000 } },
+		{ "10 bit bitfields", { 4, 0x3FF00000, 0x000FFC00, 0x000003FF } },
+		{ "R5G6B5", { 2, 0x0000F800, 0x000007E0, 0x0000001F } },
+		{ "X1R5G5B5", { 2, 0x00007C00, 0x000003E0, 0x0000001F } },
+		{ "BGR 24 bit", { 3, 0x00FF0000, 0x0000FF00, 0x000000FF } }
+	};
+
+	static const int widths[] = { 1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 65, 257 };
+	static const PixelKernel kernels[] = { PIXEL_KERNEL_AUTO, PIXEL_KERNEL_SSE2, PIXEL_KERNEL_AVX2 };
+
+	CheckResult result = { 0, 0 };
+	uint32_t state = 0xC0FFEE;
+
+	for (const Layout &layout : layouts)
+	{
+		bool eightBit = layout.format.bytesPerPixel != 2 && layout.format.rMask != 0x3FF00000;
+
+		for (int w : widths)
+		{
+			for (int padding = 0; padding <= 12; padding += 4)
+			{
+				int h = 3;
+
+				// DIB rows are padded to 4 bytes, and then some extra on top
+				ptrdiff_t stride = ((w * layout.format.bytesPerPixel + 3) & ~3) + padding;
+
+				// A few bytes past the end too, since the old loop reads a
+				// whole uint32_t for every pixel
+				std::vector<uint8_t> src(stride * h + 4);
+				for (uint8_t &byte : src)
+				{
+					byte = (uint8_t)nextRandom(&state);
+				}
+
+				std::vector<uint32_t> expected((size_t)w * h), actual((size_t)w * h);
+				convertPixels(expected.data(), src.data(), w, h, stride, &layout.format, PIXEL_KERNEL_SCALAR);
+
+				std::string what = std::string(layout.name) + " " + std::to_string(w) + " wide, stride " + std::to_string(stride);
+
+				for (PixelKernel kernel : kernels)
+				{
+					std::fill(actual.begin(), actual.end(), 0);
+					bool converted = convertPixels(actual.data(), src.data(), w, h, stride, &layout.format, kernel);
+
+					checkThat(&result, converted && actual == expected, what + ", kernel " + std::to_string((int)kernel));
+				}
+
+				// The old loop only did packed rows
+				if (eightBit && stride == w * layout.format.bytesPerPixel)
+				{
+					convertOldLoop(actual.data(), src.data(), w, h, layout.format);
+					checkThat(&result, actual == expected, what + ", against the old loop");
+				}
+			}
+		}
+	}
+
+	return result;
+}
+
+// Adds up [left, right) x [top, bottom) a pixel at a time
+static uint64_t bruteForceSum(const std::vector<uint32_t> &pixels, int w, int left, int top, int right, int bottom, uint64_t totals[3])
+{
+	totals[0] = totals[1] = totals[2] = 0;
+
+	for (int y = top; y < bottom; ++y)
+	{
+		for (int x = left; x < right; ++x)
+		{
+			uint32_t pixel = pixels[(size_t)y * w + x];
+			totals[0] += pixel & 0xFF;
+			totals[1] += (pixel >> 8) & 0xFF;
+			totals[2] += (pixel >> 16) & 0xFF;
+		}
+	}
+
+	return (uint64_t)(right - left) * (bottom - top);
+}
+
+// The summed-area table against adding up every pixel under random
+// rectangles, built on one thread and split into bands over several. Then a frame too big for its 32 bit totals, which
+// sum() has to split into bands of its own.
+static CheckResult checkSummedArea(int threads)
+{
+	CheckResult result = { 0, 0 };
+	uint32_t state = 0x5A7AB1E;
+	size_t restoreThreads = parallelThreads();
+
+	for (int useThreads : { 1, std::max(threads, 2) })
+	{
+		setParallelThreads((size_t)useThreads);
+
+		// Tall enough for several bands
+		static const int sizes[][2] = { { 1, 1 }, { 7, 5 }, { 640, 480 }, { 333, 1111 }, { 97, 4099 } };
+
+		for (const auto &size : sizes)
+		{
+			int w = size[0], h = size[1];
+			std::vector<uint32_t> pixels((size_t)w * h);
+			for (uint32_t &pixel : pixels)
+			{
+				pixel = nextRandom(&state);
+			}
+
+			ImageView view = makeView(pixels.data(), w, h);
+
+			SummedAreaTable table(view);
+
+			for (int r = 0; r < 800; ++r)
+			{
+				// Sometimes hanging off the edges, sometimes the whole thing
+				int left = (int)(nextRandom(&state) % (w + 4)) - 2;
+				int top = (int)(nextRandom(&state) % (h + 4)) - 2;
+				int right = left + 1 + (int)(nextRandom(&state) % (w + 4));
+				int bottom = top + 1 + (int)(nextRandom(&state) % (h + 4));
+				if (r == 0)
+				{
+					left = top = 0;
+					right = w;
+					bottom = h;
+				}
+
+				int clampedLeft = std::max(left, 0), clampedTop = std::max(top, 0);
+				int clampedRight = std::min(right, w), clampedBottom = std::min(bottom, h);
+
+				uint64_t totals[3], expected[3] = { 0, 0, 0 };
+				uint64_t count = table.sum(left, top, right, bottom, totals);
+				uint64_t expectedCount = 0;
+
+				if (clampedRight > clampedLeft && clampedBottom > clampedTop)
+				{
+					expectedCount = bruteForceSum(pixels, w, clampedLeft, clampedTop, clampedRight, clampedBottom, expected);
+				}
+
+				checkThat(&result, count == expectedCount && totals[0] == expected[0] && totals[1] == expected[1] && totals[2] == expected[2],
+					std::to_string(w) + "x" + std::to_string(h) + " on " + std::to_string(useThreads) + " threads, rectangle " +
+					std::to_string(left) + "," + std::to_string(top) + " to " + std::to_string(right) + "," + std::to_string(bottom));
+			}
+		}
+	}
+
+	// Over 16.8 megapixels of white can't be totalled in 32 bits, so this
+	// only comes out right if sum() splits it up
+	int w = 4200, h = 4200;
+	std::vector<uint32_t> pixels((size_t)w * h, 0xFFFFFFFF);
+	for (size_t i = 0; i < pixels.size(); i += 97)
+	{
+		pixels[i] = nextRandom(&state);
+	}
+
+	SummedAreaTable table(makeView(pixels.data(), w, h));
+
+	static const int rectangles[][4] = { { 0, 0, 4200, 4200 }, { 4, 8, 4196, 4196 }, { 0, 0, 4200, 3900 } };
+	for (const auto &rect : rectangles)
+	{
+		uint64_t totals[3], expected[3];
+		uint64_t count = table.sum(rect[0], rect[1], rect[2], rect[3], totals);
+		uint64_t expectedCount = bruteForceSum(pixels, w, rect[0], rect[1], rect[2], rect[3], expected);
+
+		checkThat(&result, count == expectedCount && totals[0] == expected[0] && totals[1] == expected[1] && totals[2] == expected[2],
+			"4200x4200 frame, rectangle " + std::to_string(rect[0]) + "," + std::to_string(rect[1]) + " to " + std::to_string(rect[2]) + "," + std::to_string(rect[3]));
+	}
+
+	setParallelThreads(restoreThreads);
+
+	return result;
+}
+
+// What analyzeGrid should make of one cell, worked out the slow way from
+// where the edges of the cell ought to be
+static CellColors bruteForceCell(const ImageView &view, int columns, int rows, int column, int row)
+{
+	int left = (int)((int64_t)column * view.w / columns);
+	int right = (int)((int64_t)(column + 1) * view.w / columns);
+	int top = (int)((int64_t)row * view.h / rows);
+	int bottom = (int)((int64_t)(row + 1) * view.h / rows);
+
+	uint64_t sum[3] = { 0, 0, 0 }, count = 0;
+	std::vector<uint64_t> binCount(512), binSum(512 * 3);
+
+	for (int y = top; y < bottom; ++y)
+	{
+		for (int x = left; x < right; ++x)
+		{
+			const uint8_t *pixel = view.row(y) + x * 4;
+			int bin = (pixel[0] / 32) * 64 + (pixel[1] / 32) * 8 + pixel[2] / 32;
+
+			for (int c = 0; c < 3; ++c)
+			{
+				sum[c] += pixel[c];
+				binSum[bin * 3 + c] += pixel[c];
+			}
+
+			count++;
+			binCount[bin]++;
+		}
+	}
+
+	auto pack = [](const uint64_t *totals, uint64_t n) -> uint32_t
+	{
+		if (n == 0)
+			return 0xFF;
+
+		return (uint32_t)(((totals[0] + n / 2) / n) << 24 | ((totals[1] + n / 2) / n) << 16 | ((totals[2] + n / 2) / n) << 8 | 0xFF);
+	};
+
+	// The lowest bin wins a tie
+	int best = (int)(std::max_element(binCount.begin(), binCount.end()) - binCount.begin());
+
+	CellColors cell;
+	cell.avg = pack(sum, count);
+	cell.lum = (0.299f * ((cell.avg >> 24) & 0xFF) + 0.587f * ((cell.avg >> 16) & 0xFF) + 0.114f * ((cell.avg >> 8) & 0xFF)) / 255.0f;
+	cell.dominant = pack(&binSum[best * 3], binCount[best]);
+
+	return cell;
+}
+
+// Grid= against working out every cell on its own: odd sizes, grids with
+// more cells than pixels (the extra ones empty and black), views that
+// are part of something wider, and a cell where the most common color
+// isn't anywhere near the average.
+static CheckResult checkGrid()
+{
+	CheckResult result = { 0, 0 };
+	uint32_t state = 0x6121D;
+
+	// w, h, columns, rows
+	static const int sizes[][4] = { { 1, 1, 1, 1 }, { 3, 3, 2, 2 }, { 3, 5, 5, 3 }, { 7, 5, 16, 16 }, { 100, 37, 3, 4 }, { 640, 480, 16, 9 }, { 1920, 1080, 7, 1 } };
+
+	for (const auto &size : sizes)
+	{
+		int w = size[0], h = size[1], columns = size[2], rows = size[3];
+
+		// A handful of colors with a bit of noise, so pixels share bins
+		// without all being the same. Two spare columns either side so
+		// the view doesn't start at the start of its rows.
+		static const uint32_t palette[] = { 0x2040C0, 0xE0E0E0, 0x101010, 0x30A050 };
+		std::vector<uint32_t> pixels((size_t)(w + 4) * h);
+		for (uint32_t &pixel : pixels)
+		{
+			uint32_t r = nextRandom(&state);
+			pixel = (palette[r % 4] + (r >> 8 & 0x0F0F0F)) | 0xFF000000;
+		}
+
+		ImageView view = cropView(makeView(pixels.data(), w + 4, h), 2, 0, w + 2, h);
+
+		GridColors grid;
+		analyzeGrid(view, columns, rows, &grid);
+
+		std::string name = std::to_string(w) + "x" + std::to_string(h) + " in " + std::to_string(columns) + "x" + std::to_string(rows);
+		checkThat(&result, grid.columns == columns && grid.rows == rows && grid.cells.size() == (size_t)columns * rows, name + " cell count");
+
+		bool same = true;
+		for (int row = 0; row < rows && same; ++row)
+		{
+			for (int column = 0; column < columns && same; ++column)
+			{
+				CellColors expected = bruteForceCell(view, columns, rows, column, row);
+				const CellColors *cell = grid.cell(column, row);
+
+				same = cell != nullptr && cell->avg == expected.avg && cell->dominant == expected.dominant && fabs(cell->lum - expected.lum) < 1e-6f;
+				checkThat(&result, same, name + " cell " + std::to_string(column) + "," + std::to_string(row));
+			}
+		}
+	}
+
+	// 3 pixels across 5 columns puts the edges at 0, 0, 1, 1, 2 and 3, so
+	// columns 0 and 2 get nothing and come out black
+	std::vector<uint32_t> white(3, 0xFFFFFFFF);
+	GridColors sparse;
+	analyzeGrid(makeView(white.data(), 3, 1), 5, 1, &sparse);
+
+	std::string got;
+	for (const CellColors &cell : sparse.cells)
+	{
+		bool black = cell.avg == 0xFF && cell.dominant == 0xFF && cell.lum == 0.0f;
+		bool full = cell.avg == 0xFFFFFFFF && cell.dominant == 0xFFFFFFFF;
+		got += black ? 'b' : full ? 'w' : '?';
+	}
+
+	checkThat(&result, got == "bwbww", "more cells than pixels leaves empty ones black");
+
+	// Six dark blues (red 0 or 1) and four bright yellows: the average is
+	// muddy, the dominant color is the blues averaged together
+	std::vector<uint32_t> mixed(10);
+	for (int i = 0; i < 10; ++i)
+	{
+		mixed[i] = i < 6 ? 0xFF800000 | (i & 1) : 0xFF00FFFF;
+	}
+
+	GridColors single;
+	analyzeGrid(makeView(mixed.data(), 10, 1), 1, 1, &single);
+	checkThat(&result, single.cells[0].dominant == 0x010080FF, "dominant is the most common bin");
+	checkThat(&result, single.cells[0].avg == 0x66664DFF, "average of the lot");
+
+	// Outside the grid
+	checkThat(&result, single.cell(1, 0) == nullptr && single.cell(0, -1) == nullptr, "cell() outside the grid");
+
+	return result;
+}
+
+// Records first ms, first + 1 ms, ... last ms against the stage
+static void recordMilliseconds(Stage stage, int first, int last)
+{
+	for (int ms = first; ms <= last; ++ms)
+	{
+		recordStage(stage, std::chrono::milliseconds(ms));
+	}
+}
+
+static bool sameMs(double a, double b)
+{
+	return fabs(a - b) < 1e-9;
+}
+
+// The stage timings skins read with Color=Stats: the figures from a known
+// set of timings, the window dropping the oldest once it's full, p95 by
+// nearest rank, nested timers not counting twice, and looking stages and
+// stats up by name
+static CheckResult checkStats()
+{
+	CheckResult result = { 0, 0 };
+	Stage stage = STAGE_GRID;
+
+	resetStats();
+	StageStats stats = readStage(stage);
+	checkThat(&result, stats.count == 0 && stats.minimum == 0 && stats.average == 0 && stats.p95 == 0 && stats.maximum == 0, "nothing recorded");
+
+	// With only 10 the nearest rank for p95 is the slowest
+	recordMilliseconds(stage, 1, 10);
+	stats = readStage(stage);
+	checkThat(&result, stats.count == 10 && sameMs(stats.minimum, 1) && sameMs(stats.average, 5.5) && sameMs(stats.p95, 10) && sameMs(stats.maximum, 10), "1 to 10ms");
+
+	resetStats();
+	recordMilliseconds(stage, 1, 100);
+	stats = readStage(stage);
+	checkThat(&result, stats.count == 100 && sameMs(stats.p95, 95) && sameMs(stats.average, 50.5), "1 to 100ms");
+
+	// Past the window only the newest STATS_WINDOW count, apart from the
+	// count itself
+	resetStats();
+	int last = STATS_WINDOW + 72;
+	recordMilliseconds(stage, 1, last);
+	stats = readStage(stage);
+
+	int oldest = last - STATS_WINDOW + 1;
+	int rank = (STATS_WINDOW * 95 + 99) / 100;
+	checkThat(&result, stats.count == (uint64_t)last, "count after rolling over");
+	checkThat(&result, sameMs(stats.minimum, oldest) && sameMs(stats.maximum, last), "min/max after rolling over");
+	checkThat(&result, sameMs(stats.average, (oldest + last) / 2.0), "average after rolling over");
+	checkThat(&result, sameMs(stats.p95, oldest + rank - 1), "p95 after rolling over");
+
+	// readStat hands out the same figures one at a time
+	checkThat(&result, sameMs(readStat(stage, STAT_MINIMUM), stats.minimum) && sameMs(readStat(stage, STAT_AVERAGE), stats.average) &&
+		sameMs(readStat(stage, STAT_P95), stats.p95) && sameMs(readStat(stage, STAT_MAXIMUM), stats.maximum) &&
+		sameMs(readStat(stage, STAT_COUNT), (double)last), "readStat");
+
+	// Other stages aren't touched
+	checkThat(&result, readStage(STAGE_DECODE).count == 0, "other stages");
+
+	resetStats();
+
+	// A timer inside another one takes its time back out of the outer one,
+	// like hashing does out of decoding
+	{
+		StageTimer outer(stage);
+		{
+			StageTimer inner(STAGE_CONTEXT, &outer);
+			std::this_thread::sleep_for(std::chrono::milliseconds(40));
+		}
+	}
+
+	checkThat(&result, readStage(STAGE_CONTEXT).minimum >= 40 && readStage(stage).maximum < 20, "nested timers");
+
+	resetStats();
+
+	// Every name skins can use comes back to the same stage/stat
+	for (int i = 0; i < STAGE_MAX; ++i)
+	{
+		checkThat(&result, findStage(stageName((Stage)i)) == (Stage)i, "findStage(" + narrow(stageName((Stage)i)) + ")");
+	}
+
+	static const wchar_t *statNames[] = { L"Min", L"Avg", L"P95", L"Max", L"Count" };
+	for (int i = 0; i < STAT_MAX; ++i)
+	{
+		checkThat(&result, findStat(statNames[i]) == (Stat)i, "findStat(" + narrow(statNames[i]) + ")");
+	}
+
+	checkThat(&result, findStage(L"Bogus") == STAGE_MAX && findStage(L"") == STAGE_MAX && findStage(L"decode") == STAGE_MAX, "findStage with a bad name");
+	checkThat(&result, findStat(L"Bogus") == STAT_MAX && findStat(L"") == STAT_MAX && findStat(L"p95") == STAT_MAX, "findStat with a bad name");
+
+	return result;
+}
+
+// The path of the monitor a window is mostly on, empty if none
+static std::wstring wallpaperFor(const WallpaperCache &cache, int left, int top, int right, int bottom)
+{
+	const MonitorWallpaper *monitor = cache.monitorFor(left, top, right, bottom);
+	return monitor != nullptr ? monitor->path : L"";
+}
+
+// WallpaperCache against a fake source: only asking again when told
+// something changed, the last try failed or the recheck interval ran out,
+// dropping what it had when a query fails, and picking the monitor a
+// window is mostly on (or closest to)
+static CheckResult checkWallpapers()
+{
+	CheckResult result = { 0, 0 };
+	auto interval = std::chrono::milliseconds(100);
+
+	// The cache owns the source, but we still need to poke it
+	FakeWallpaperSource *source = new FakeWallpaperSource;
+	source->monitors = { { 0, 0, 1920, 1080, L"left.jpg" }, { 1920, 0, 3840, 1080, L"right.jpg" } };
+
+	WallpaperCache cache(source, interval);
+	checkThat(&result, wallpaperFor(cache, 0, 0, 100, 100).empty(), "nothing known before the first update");
+
+	uint64_t startHits = readCounter(COUNTER_WALLPAPER_HITS);
+	uint64_t startMisses = readCounter(COUNTER_WALLPAPER_MISSES);
+
+	cache.update();
+	checkThat(&result, source->queryCount == 1 && cache.queries() == 1, "first update asks");
+	checkThat(&result, wallpaperFor(cache, 10, 10, 110, 110) == L"left.jpg", "window on the left monitor");
+
+	// Nothing changed, so nothing to ask. Not even when the monitors
+	// really did change, if nobody said so.
+	auto start = std::chrono::steady_clock::now();
+	cache.update();
+	source->monitors[0].path = L"changed.jpg";
+	cache.update();
+	bool quick = std::chrono::steady_clock::now() - start < interval;
+	checkThat(&result, !quick || source->queryCount == 1, "updates with nothing changed don't ask");
+	checkThat(&result, !quick || wallpaperFor(cache, 10, 10, 110, 110) == L"left.jpg", "still the old wallpaper until told");
+
+	source->notify();
+	cache.update();
+	checkThat(&result, source->queryCount == 2 && wallpaperFor(cache, 10, 10, 110, 110) == L"changed.jpg", "asks again once told");
+
+	// Nobody said anything, but it's been long enough to check anyway
+	std::this_thread::sleep_for(interval + std::chrono::milliseconds(20));
+	cache.update();
+	checkThat(&result, source->queryCount == 3, "asks again after the recheck interval");
+
+	// A failed query leaves nothing rather than something stale, and gets
+	// tried again next update whether or not anything changed
+	source->failing = true;
+	source->notify();
+	cache.update();
+	checkThat(&result, source->queryCount == 4 && wallpaperFor(cache, 10, 10, 110, 110).empty(), "failed query forgets the monitors");
+
+	source->failing = false;
+	cache.update();
+	checkThat(&result, source->queryCount == 5 && wallpaperFor(cache, 10, 10, 110, 110) == L"changed.jpg", "retries after a failed query");
+	checkThat(&result, cache.queries() == 5, "queries() counts every ask");
+
+	uint64_t hits = readCounter(COUNTER_WALLPAPER_HITS) - startHits;
+	uint64_t misses = readCounter(COUNTER_WALLPAPER_MISSES) - startMisses;
+	checkThat(&result, misses == 5 && (!quick || hits == 2), "WallpaperHits/WallpaperMisses");
+
+	// Straddling both, but more of it on the right
+	checkThat(&result, wallpaperFor(cache, 1900, 100, 1950, 200) == L"right.jpg", "window mostly on the right monitor");
+	checkThat(&result, wallpaperFor(cache, 1890, 100, 1940, 200) == L"changed.jpg", "window mostly on the left monitor");
+
+	// Off every monitor, so whichever's closest
+	checkThat(&result, wallpaperFor(cache, 4000, 500, 4100, 600) == L"right.jpg", "window past the right monitor");
+	checkThat(&result, wallpaperFor(cache, -500, -500, -400, -400) == L"changed.jpg", "window above and left of everything");
+	checkThat(&result, wallpaperFor(cache, 1000, 2000, 1100, 2100) == L"changed.jpg", "window below the left monitor");
+
+	// No source at all (not on Windows) just never knows anything
+	WallpaperCache empty(nullptr);
+	empty.update();
+	checkThat(&result, empty.queries() == 0 && wallpaperFor(empty, 0, 0, 100, 100).empty(), "no source");
+
+	return result;
+}
+
+// A made up key and palette for the palette cache check, different for
+// every i
+static PaletteKey paletteKeyFor(int i)
+{
+	PaletteKey key = {};
+	key.path = L"C:\\Wallpapers\\" + std::to_wstring(i) + L".jpg";
+	key.modified = 132000000000000000ULL + i;
+	key.size = 1000 + i;
+	key.sampleMode = SAMPLE_MODE_BOX;
+
+	return key;
+}
+
+static ColorSet paletteFor(int i)
+{
+	ColorSet colors = {};
+	colors.bg1 = 0xFF000000 | i;
+	colors.fg1 = 0xFF000000 | (i * 7);
+	colors.avg = 0xFF000000 | (i * 13);
+	colors.lum = i / 1000.0f;
+
+	return colors;
+}
+
+static bool hasPalette(PaletteCache &cache, int i)
+{
+	ColorSet colors;
+	ColorSet expected = paletteFor(i);
+
+	return cache.find(paletteKeyFor(i), &colors) && memcmp(&colors, &expected, sizeof(ColorSet)) == 0;
+}
+
+static CheckResult checkPaletteCache()
+{
+	CheckResult result = { 0, 0 };
+
+	// Full up, then one more pushes out the least recently used. Looking
+	// one up counts as using it.
+	PaletteCache cache;
+	for (int i = 0; i < 512; ++i)
+	{
+		cache.insert(paletteKeyFor(i), paletteFor(i));
+	}
+
+	checkThat(&result, hasPalette(cache, 0) && hasPalette(cache, 511), "holds 512");
+	checkThat(&result, cache.changed(), "changed after inserting");
+
+	cache.insert(paletteKeyFor(512), paletteFor(512));
+	checkThat(&result, hasPalette(cache, 0) && !hasPalette(cache, 1) && hasPalette(cache, 2) && hasPalette(cache, 512), "513th drops the least recently used");
+
+	// Anything that's part of the key makes it a different palette
+	PaletteKey cropped = paletteKeyFor(2);
+	cropped.crop[2] = 100;
+	ColorSet colors;
+	checkThat(&result, !cache.find(cropped, &colors), "different crop misses");
+
+	FILE *fp = tmpfile();
+	checkThat(&result, fp != nullptr && cache.save(fp), "save");
+	if (fp == nullptr)
+	{
+		return result;
+	}
+
+	checkThat(&result, !cache.changed(), "not changed after saving");
+
+	// Everything comes back, and in the same order, so the next one in
+	// still pushes out whatever was used longest ago before saving
+	rewind(fp);
+	PaletteCache loaded;
+	checkThat(&result, loaded.load(fp), "load");
+
+	loaded.insert(paletteKeyFor(1000), paletteFor(1000));
+	checkThat(&result, !hasPalette(loaded, 3) && hasPalette(loaded, 1000), "round trip keeps the order");
+
+	bool all = hasPalette(loaded, 0);
+	for (int i = 4; i <= 512; ++i)
+	{
+		all = all && hasPalette(loaded, i);
+	}
+
+	checkThat(&result, all && hasPalette(loaded, 2), "round trip keeps every palette");
+	fclose(fp);
+
+	// The same file from a version that sampled differently gets thrown out
+	fp = tmpfile();
+	if (fp == nullptr)
+	{
+		return result;
+	}
+
+	cache.save(fp);
+	fseek(fp, 4, SEEK_SET);
+	uint32_t version;
+	fread(&version, sizeof(version), 1, fp);
+	version--;
+	fseek(fp, 4, SEEK_SET);
+	fwrite(&version, sizeof(version), 1, fp);
+	rewind(fp);
+	checkThat(&result, !loaded.load(fp) && !hasPalette(loaded, 512) && !hasPalette(loaded, 1000), "older version rejected, cache left empty");
+	fclose(fp);
+
+	// And so does one that got cut off part way
+	fp = tmpfile();
+	if (fp == nullptr)
+	{
+		return result;
+	}
+
+	cache.save(fp);
+	long size = ftell(fp);
+	rewind(fp);
+	std::vector<char> bytes(size);
+	fread(bytes.data(), 1, bytes.size(), fp);
+	fclose(fp);
+
+	fp = tmpfile();
+	if (fp == nullptr)
+	{
+		return result;
+	}
+
+	fwrite(bytes.data(), 1, bytes.size() / 2, fp);
+	rewind(fp);
+	checkThat(&result, !loaded.load(fp) && !hasPalette(loaded, 2), "truncated file rejected, cache left empty");
+	fclose(fp);
+
+	cache.clear();
+	checkThat(&result, !hasPalette(cache, 512) && cache.changed(), "clear");
+
+	return result;
+}
+
+static CheckResult checkSampleRegistry()
+{
+	CheckResult result = { 0, 0 };
+	SampleRegistry registry;
+	bool created;
+
+	// Two containers with the same inputs share one sample, a third with
+	// a different crop gets its own
+	std::shared_ptr<SharedSample> first = registry.subscribe(paletteKeyFor(1), &created);
+	checkThat(&result, first != nullptr && created, "first subscriber creates it");
+
+	std::shared_ptr<SharedSample> second = registry.subscribe(paletteKeyFor(1), &created);
+	checkThat(&result, second == first && !created, "same key shares it");
+
+	PaletteKey cropped = paletteKeyFor(1);
+	cropped.crop[2] = 100;
+	std::shared_ptr<SharedSample> other = registry.subscribe(cropped, &created);
+	checkThat(&result, other != first && created, "different key gets its own");
+	checkThat(&result, registry.size() == 2, "size counts distinct samples");
+
+	// Whatever one publishes, the other sees
+	first->publish(std::make_shared<ColorSet>(paletteFor(1)), nullptr);
+	std::shared_ptr<const ColorSet> palette = std::atomic_load(&second->palette);
+	checkThat(&result, second->generation == 1 && palette != nullptr && palette->bg1 == paletteFor(1).bg1, "subscribers see what's published");
+
+	// Stays as long as anyone has it
+	first = nullptr;
+	checkThat(&result, registry.size() == 2, "still there with a subscriber left");
+
+	std::shared_ptr<SharedSample> third = registry.subscribe(paletteKeyFor(1), &created);
+	checkThat(&result, third == second && !created, "joining late gets the published one");
+	checkThat(&result, third->generation == 1, "joining late keeps the generation");
+
+	second = nullptr;
+	third = nullptr;
+	checkThat(&result, registry.size() == 1, "last one letting go expires it");
+
+	// Coming back afterwards starts from nothing
+	std::shared_ptr<SharedSample> again = registry.subscribe(paletteKeyFor(1), &created);
+	checkThat(&result, created && again->generation == 0 && std::atomic_load(&again->palette) == nullptr, "subscribing again starts over");
+	checkThat(&result, registry.size() == 2, "size after subscribing again");
+
+	other = nullptr;
+	again = nullptr;
+	checkThat(&result, registry.size() == 0, "empty once everyone lets go");
+
+	return result;
+}
+
+// Whether a file that failed at some point between before and after got
+// put off by exactly delay
+static bool retriesAfter(RetryBackoff &backoff, const std::wstring &path, std::chrono::steady_clock::time_point before, std::chrono::steady_clock::time_point after, std::chrono::steady_clock::duration delay)
+{
+	std::chrono::steady_clock::time_point retryAt = backoff.retryAt(path);
+
+	return retryAt >= before + delay && retryAt <= after + delay;
+}
+
+static CheckResult checkSourceFailures()
+{
+	CheckResult result = { 0, 0 };
+
+	// Long enough that nothing comes due while the check is running
+	auto minDelay = std::chrono::seconds(10);
+	auto maxDelay = std::chrono::seconds(80);
+
+	RetryBackoff backoff(minDelay, maxDelay, 3);
+	checkThat(&result, backoff.ready(L"a"), "never failed is ready");
+
+	// 10, 20, 40, 80, then stuck at 80
+	auto delay = std::chrono::steady_clock::duration(minDelay);
+	for (int i = 1; i <= 6; ++i)
+	{
+		auto before = std::chrono::steady_clock::now();
+		backoff.failed(L"a");
+		auto after = std::chrono::steady_clock::now();
+
+		checkThat(&result, retriesAfter(backoff, L"a", before, after, delay), "failure " + std::to_string(i) + " waits " + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(delay).count()) + "s");
+		checkThat(&result, !backoff.ready(L"a"), "not ready after failure " + std::to_string(i));
+
+		delay = std::min<std::chrono::steady_clock::duration>(delay * 2, maxDelay);
+	}
+
+	// Success forgets the lot, so the next failure starts from the bottom
+	backoff.succeeded(L"a");
+	checkThat(&result, backoff.ready(L"a"), "ready after succeeding");
+
+	auto before = std::chrono::steady_clock::now();
+	backoff.failed(L"a");
+	auto after = std::chrono::steady_clock::now();
+	checkThat(&result, retriesAfter(backoff, L"a", before, after, minDelay), "back to the shortest wait after succeeding");
+
+	// Room for three. Failing one of them again doesn't make room, but a
+	// fourth file starts over.
+	backoff.failed(L"b");
+	backoff.failed(L"c");
+	backoff.failed(L"a");
+	checkThat(&result, !backoff.ready(L"a") && !backoff.ready(L"b") && !backoff.ready(L"c"), "failing a known file at capacity keeps the rest");
+
+	backoff.failed(L"d");
+	checkThat(&result, backoff.ready(L"a") && backoff.ready(L"b") && backoff.ready(L"c") && !backoff.ready(L"d"), "a new file at capacity starts over");
+
+	backoff.clear();
+	checkThat(&result, backoff.ready(L"d"), "clear");
+
+	DecodeRoutes routes(3);
+	checkThat(&result, routes.find(L"a", 1, 100) == DECODE_IMAGE, "unknown file is an image");
+
+	routes.insert(L"a", 1, 100, DECODE_ICON);
+	routes.insert(L"b", 1, 100, DECODE_NOTHING);
+	checkThat(&result, routes.find(L"a", 1, 100) == DECODE_ICON && routes.find(L"b", 1, 100) == DECODE_NOTHING, "remembers the route");
+
+	// Only good for the exact file, and a changed one is forgotten rather
+	// than just skipped
+	checkThat(&result, routes.find(L"a", 2, 100) == DECODE_IMAGE, "modified time changed");
+	checkThat(&result, routes.find(L"a", 1, 100) == DECODE_IMAGE, "changed file forgotten");
+	checkThat(&result, routes.find(L"b", 1, 101) == DECODE_IMAGE, "size changed");
+
+	routes.insert(L"a", 1, 100, DECODE_ICON);
+	routes.insert(L"a", 1, 100, DECODE_IMAGE);
+	checkThat(&result, routes.find(L"a", 1, 100) == DECODE_IMAGE, "inserting DECODE_IMAGE forgets it");
+
+	routes.insert(L"a", 1, 100, DECODE_ICON);
+	routes.insert(L"b", 1, 100, DECODE_ICON);
+	routes.insert(L"c", 1, 100, DECODE_ICON);
+	routes.insert(L"a", 2, 200, DECODE_NOTHING);
+	checkThat(&result, routes.find(L"a", 2, 200) == DECODE_NOTHING && routes.find(L"b", 1, 100) == DECODE_ICON && routes.find(L"c", 1, 100) == DECODE_ICON, "updating a known file at capacity keeps the rest");
+
+	routes.insert(L"d", 1, 100, DECODE_ICON);
+	checkThat(&result, routes.find(L"b", 1, 100) == DECODE_IMAGE && routes.find(L"c", 1, 100) == DECODE_IMAGE && routes.find(L"d", 1, 100) == DECODE_ICON, "a new file at capacity starts over");
+
+	routes.clear();
+	checkThat(&result, routes.find(L"d", 1, 100) == DECODE_IMAGE, "clear");
+
+	return result;
+}
+
+// Holds a worker job until the check lets it go, so there's something
+// running while the rest get queued up behind it
+struct Gate
+{
+	std::mutex lock;
+	std::condition_variable changed;
+	bool entered = false;
+	bool open = false;
+
+	// From the job: say it's started, then wait to be let go
+	void hold()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		entered = true;
+		changed.notify_all();
+		changed.wait(guard, [this] { return open; });
+	}
+
+	// From the check: wait for the job to start
+	void waitForEntry()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [this] { return entered; });
+	}
+
+	void release()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		open = true;
+		changed.notify_all();
+	}
+};
+
+// Which jobs ran, in the order they did
+struct JobLog
+{
+	std::mutex lock;
+	std::string ran;
+
+	std::function<void()> job(char name)
+	{
+		return [this, name]()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			ran += name;
+		};
+	}
+
+	std::string read()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return ran;
+	}
+};
+
+// The worker thread samples run on: a job queued for a key that's still
+// waiting replaces it, cancel drops a waiting one without touching the
+// one running, wait() lasts until the queue's empty, and shutting down
+// with jobs queued finishes the one running and drops the rest
+static CheckResult checkWorker()
+{
+	CheckResult result = { 0, 0 };
+	int a, b, c, d;
+
+	{
+		std::atomic<int> starts(0);
+		std::atomic<int> stops(0);
+		Worker worker([&] { ++starts; }, [&] { ++stops; });
+		JobLog log;
+		Gate gate;
+
+		worker.wait();
+		checkThat(&result, worker.pending() == 0, "nothing pending to start with");
+
+		worker.enqueue(&a, [&] { gate.hold(); log.job('A')(); });
+		gate.waitForEntry();
+		checkThat(&result, worker.pending() == 1, "running job counts as pending");
+
+		// Replacing the waiting one for b keeps its place in line
+		worker.enqueue(&b, log.job('1'));
+		worker.enqueue(&c, log.job('C'));
+		worker.enqueue(&b, log.job('B'));
+		checkThat(&result, worker.pending() == 3, "replaced job isn't queued twice");
+
+		// The running job for a isn't replaced, so this one runs after it
+		worker.enqueue(&a, log.job('a'));
+		checkThat(&result, worker.pending() == 4, "key of the running job queues again");
+
+		worker.enqueue(&d, log.job('D'));
+		worker.cancel(&d);
+		worker.cancel(&d);
+		checkThat(&result, worker.pending() == 4, "cancel drops the waiting job");
+
+		// Cancelling the running job's key only drops the one waiting
+		worker.cancel(&a);
+		checkThat(&result, worker.pending() == 3, "cancel leaves the running job alone");
+
+		gate.release();
+		worker.wait();
+		checkThat(&result, log.read() == "ABC", "ran " + log.read() + ", wanted ABC");
+		checkThat(&result, worker.pending() == 0, "nothing pending after wait");
+
+		// Nothing queued, wait() shouldn't block
+		worker.wait();
+		checkThat(&result, starts == 1 && stops == 0, "onStart ran once on the worker");
+	}
+
+	// Shutting down with jobs waiting: the running one gets to finish,
+	// the rest never run, and onStop still happens
+	{
+		std::atomic<int> stops(0);
+		JobLog log;
+		Gate gate;
+		Worker *worker = new Worker(nullptr, [&] { ++stops; });
+
+		worker->enqueue(&a, [&] { gate.hold(); log.job('A')(); });
+		gate.waitForEntry();
+		worker->enqueue(&b, log.job('B'));
+		worker->enqueue(&c, log.job('C'));
+
+		// Only let A go once the destructor has dropped B and C, or the
+		// worker could get to them first. It's still joining the thread
+		// (which can't finish until A does), so it's all still there.
+		// Give up after a couple of seconds so a worker that never drops
+		// them fails the check instead of hanging the bench.
+		std::thread releaser([&]
+		{
+			for (int waited = 0; worker->pending() > 1 && waited < 2000; ++waited)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+			gate.release();
+		});
+
+		delete worker;
+		releaser.join();
+
+		checkThat(&result, log.read() == "A", "shut down ran " + log.read() + ", wanted A");
+		checkThat(&result, stops == 1, "onStop ran on shut down");
+	}
+
+	return result;
+}
+
+// What the notifier says about path over that many calls in a row, y for
+// changed and n for not
+static std::string changedRun(ChangeNotifier *notifier, const fs::path &path, uint64_t *seen, int calls)
+{
+	std::string run;
+
+	for (int i = 0; i < calls; ++i)
+	{
+		run += notifier->changed(path.wstring(), seen) ? 'y' : 'n';
+	}
+
+	return run;
+}
+
+static void expectChanges(CheckResult *result, ChangeNotifier *notifier, const fs::path &path, uint64_t *seen, const char *expected, const char *what)
+{
+	std::string run = changedRun(notifier, path, seen, (int)strlen(expected));
+	checkThat(result, run == expected, std::string(what) + ": " + run + ", wanted " + expected);
+}
+
+// The file change tracking containers share, on top of the real watcher
+// for this platform: a write and a file renamed into the folder each
+// showing up once, nothing showing up when nothing happened, the folder
+// only being let go once its last subscriber has, and a folder that
+// can't be watched (or stops being watchable) getting polled instead
+static CheckResult checkFileWatcher(const fs::path &corpusDir)
+{
+	CheckResult result = { 0, 0 };
+	fs::path root = corpusDir / "watch";
+	fs::path watched = root / "watched";
+	fs::path outside = root / "outside";
+	fs::path file = watched / "cover.jpg";
+	std::error_code error;
+
+	fs::remove_all(root, error);
+	fs::create_directories(watched, error);
+	fs::create_directories(outside, error);
+
+	if (!writeBytes(file, { 1, 2, 3 }))
+	{
+		checkThat(&result, false, "couldn't write to " + root.string());
+		return result;
+	}
+
+	FileWatcher *watcher = createFileWatcher();
+	if (watcher != nullptr)
+	{
+		// An hour between polls, so anything that shows up came from the
+		// watcher
+		ChangeNotifier notifier(watcher, std::chrono::hours(1));
+		uint64_t seen = 0;
+
+		notifier.subscribe(file.wstring());
+		notifier.update();
+		expectChanges(&result, &notifier, file, &seen, "yn", "first look");
+
+		notifier.update();
+		expectChanges(&result, &notifier, file, &seen, "n", "nothing happened");
+
+		writeBytes(file, { 4, 5, 6 });
+		notifier.update();
+		expectChanges(&result, &notifier, file, &seen, "yn", "write");
+
+		writeBytes(outside / "next.jpg", { 7 });
+		notifier.update();
+		expectChanges(&result, &notifier, file, &seen, "n", "write somewhere else");
+
+		fs::rename(outside / "next.jpg", watched / "next.jpg", error);
+		notifier.update();
+		expectChanges(&result, &notifier, file, &seen, "yn", "rename into the folder");
+
+		// Two subscribers, so letting go of one keeps the watch
+		notifier.subscribe(file.wstring());
+		notifier.unsubscribe(file.wstring());
+		writeBytes(file, { 8 });
+		notifier.update();
+		expectChanges(&result, &notifier, file, &seen, "yn", "write with one of two subscribers left");
+
+		// Nobody left, so it knows nothing and can only say maybe. Anything
+		// written meanwhile (still sitting unread in the watcher) mustn't
+		// show up once it's subscribed to again.
+		notifier.unsubscribe(file.wstring());
+		expectChanges(&result, &notifier, file, &seen, "yy", "unsubscribed");
+
+		writeBytes(file, { 9 });
+		notifier.subscribe(file.wstring());
+		expectChanges(&result, &notifier, file, &seen, "yn", "subscribed again");
+
+		notifier.update();
+		expectChanges(&result, &notifier, file, &seen, "n", "nothing from before subscribing again");
+
+		writeBytes(file, { 10 });
+		notifier.update();
+		expectChanges(&result, &notifier, file, &seen, "yn", "write after subscribing again");
+
+		// The folder itself going away is one last change, then it's
+		// polled like anything else that can't be watched
+		fs::remove_all(watched, error);
+		notifier.update();
+		expectChanges(&result, &notifier, file, &seen, "yn", "folder removed");
+
+		notifier.unsubscribe(file.wstring());
+	}
+
+	// No watcher at all, so everything gets polled
+	fs::create_directories(watched, error);
+	writeBytes(file, { 1 });
+
+	auto interval = std::chrono::milliseconds(50);
+	ChangeNotifier polled(nullptr, interval);
+	uint64_t seen = 0;
+
+	polled.subscribe(file.wstring());
+	expectChanges(&result, &polled, file, &seen, "yn", "polled first look");
+
+	auto start = std::chrono::steady_clock::now();
+	polled.update();
+	if (std::chrono::steady_clock::now() - start < interval)
+	{
+		expectChanges(&result, &polled, file, &seen, "n", "polled before the interval");
+	}
+
+	std::this_thread::sleep_for(interval + std::chrono::milliseconds(10));
+	polled.update();
+	expectChanges(&result, &polled, file, &seen, "yn", "polled after the interval");
+
+	polled.unsubscribe(file.wstring());
+	fs::remove_all(root, error);
+
+	return result;
+}
+
+static void printUsage()
+{
+	fprintf(stderr,
+		"Usage: chameleon-bench [options] [image...]\n"
+		"\n"
+		"  --iterations N   Timed runs per image (default 20, at most %d)\n"
+		"  --corpus DIR     Where to write the generated images (default: a temp directory)\n"
+		"  --no-synthetic   Only run the images given on the command line\n"
+		"  --stdio          Read files through stdio instead of mapping them\n"
+		"  --threads N      Split work over N threads, including the main one (default %d)\n"
+		"  --no-scaling     Skip timing 1 up to --threads threads against each other\n"
+		"  --no-resize      Skip timing resizing on its own\n"
+		"  --no-pyramid     Skip timing crops read from a pyramid against the full image\n"
+		"  --no-formats     Skip timing sniffing file formats against letting stb guess\n"
+		"  --no-icons       Skip timing reading icons out of .ico files and programs\n"
+		"  --no-sampling    Skip comparing SampleMode=Stratified against Box\n"
+		"  --no-checks      Skip checking the fast paths against the plain ones\n"
+		"  --out FILE       Write the JSON there instead of stdout\n",
+		STATS_WINDOW, (int)parallelThreads());
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 20;
+	bool synthetic = true;
+	bool timeResizing = true;
+	bool timePyramid = true;
+	bool timeFormats = true;
+	bool timeIcons = true;
+	bool compareSampling = true;
+	bool timeScaling = true;
+	bool runChecks = true;
+	int threads = (int)parallelThreads();
+	fs::path corpusDir = fs::temp_directory_path() / "chameleon-bench";
+	const char *outPath = nullptr;
+	std::vector<BenchCase> cases;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "--iterations" && i + 1 < argc)
+		{
+			iterations = std::max(1, std::min(STATS_WINDOW, atoi(argv[++i])));
+		}
+		else if (arg == "--corpus" && i + 1 < argc)
+		{
+			corpusDir = argv[++i];
+		}
+		else if (arg == "--threads" && i + 1 < argc)
+		{
+			threads = atoi(argv[++i]);
+		}
+		else if (arg == "--no-pyramid")
+		{
+			timePyramid = false;
+		}
+		else if (arg == "--no-icons")
+		{
+			timeIcons = false;
+		}
+		else if (arg == "--no-formats")
+		{
+			timeFormats = false;
+		}
+		else if (arg == "--no-scaling")
+		{
+			timeScaling = false;
+		}
+		else if (arg == "--no-checks")
+		{
+			runChecks = false;
+		}
+		else if (arg == "--no-sampling")
+		{
+			compareSampling = false;
+		}
+		else if (arg == "--no-resize")
+		{
+			timeResizing = false;
+		}
+		else if (arg == "--stdio")
+		{
+			useStdio = true;
+		}
+		else if (arg == "--no-synthetic")
+		{
+			synthetic = false;
+		}
+		else if (arg == "--out" && i + 1 < argc)
+		{
+			outPath = argv[++i];
+		}
+		else if (arg.compare(0, 2, "--") == 0)
+		{
+			printUsage();
+			return 1;
+		}
+		else
+		{
+			cases.push_back({ fs::path(arg).filename().string(), arg, { 0, 0, 0, 0 } });
+		}
+	}
+
+	if (synthetic)
+	{
+		std::error_code error;
+		fs::create_directories(corpusDir, error);
+
+		std::vector<BenchCase> generated;
+
+		for (const SyntheticImage &image : syntheticImages)
+		{
+			fs::path path = corpusDir / image.name;
+
+			// Keep what's already there so repeated runs decode identical files
+			if (!fs::exists(path) && !writeImage(path, image))
+			{
+				fprintf(stderr, "Could not write %s\n", path.string().c_str());
+				return 1;
+			}
+
+			generated.push_back({ image.name, path.string(), { 0, 0, 0, 0 } });
+		}
+
+		// Skins cropping a small part out of a big wallpaper are the case
+		// reduced size decoding is for
+		generated.push_back({ "photo-8k.jpg@corner", (corpusDir / "photo-8k.jpg").string(), { 0.0f, 0.0f, 0.25f, 0.25f } });
+		generated.push_back({ "photo-4k.jpg@center", (corpusDir / "photo-4k.jpg").string(), { 0.25f, 0.25f, 0.75f, 0.75f } });
+
+		cases.insert(cases.begin(), generated.begin(), generated.end());
+	}
+
+	if (cases.empty())
+	{
+		printUsage();
+		return 1;
+	}
+
+	threads = std::max(1, threads);
+	setParallelThreads((size_t)threads);
+
+	FILE *out = stdout;
+	if (outPath != nullptr && (out = fopen(outPath, "w")) == nullptr)
+	{
+		fprintf(stderr, "Could not open %s\n", outPath);
+		return 1;
+	}
+
+	static const Stage reported[] = { STAGE_HASH, STAGE_DECODE, STAGE_RESIZE, STAGE_PROCESS, STAGE_KEY_COLORS, STAGE_SAMPLE };
+
+	fprintf(out, "{\n  \"iterations\": %d,\n  \"stdio\": %s,\n  \"threads\": %d,\n  \"cores\": %u,\n  \"pixelKernel\": %d,\n  \"trackAllocations\": %s,\n",
+		iterations, useStdio ? "true" : "false", threads, std::thread::hardware_concurrency(), (int)bestPixelKernel(), TRACK_ALLOCATIONS ? "true" : "false");
+	fprintf(out, "  \"hashGigabytesPerSecond\": %.2f,\n  \"cases\": [\n", measureHashSpeed(HASH_BENCH_SIZE, 4));
+
+	for (size_t c = 0; c < cases.size(); ++c)
+	{
+		const BenchCase &bench = cases[c];
+
+		// One untimed run so the file is in the page cache
+		CaseResult result = runPipeline(bench);
+
+		resetStats();
+		uint64_t startCount = allocCount.load();
+		uint64_t startBytes = allocBytes.load();
+		peakLiveBytes.store(liveBytes.load());
+		int64_t startLive = liveBytes.load();
+		uint64_t startPoolHits = readCounter(COUNTER_POOL_HITS);
+		uint64_t startPoolMisses = readCounter(COUNTER_POOL_MISSES);
+
+		for (int i = 0; i < iterations; ++i)
+		{
+			result = runPipeline(bench);
+		}
+
+		uint64_t allocs = allocCount.load() - startCount;
+		uint64_t bytes = allocBytes.load() - startBytes;
+		int64_t peakHeap = peakLiveBytes.load() - startLive;
+
+		fprintf(out, "    {\n      \"name\": \"%s\",\n      \"path\": \"%s\",\n      \"loaded\": %s,\n",
+			escape(bench.name).c_str(), escape(bench.path).c_str(), result.loaded ? "true" : "false");
+		fprintf(out, "      \"fileBytes\": %ld,\n", result.fileBytes);
+		fprintf(out, "      \"width\": %d,\n      \"height\": %d,\n      \"decodeScale\": %d,\n      \"sampledWidth\": %d,\n      \"sampledHeight\": %d,\n",
+			result.fullW, result.fullH, result.decodeScale, result.viewW, result.viewH);
+		fprintf(out, "      \"average\": \"%08X\",\n      \"background1\": \"%08X\",\n      \"foreground1\": \"%08X\",\n",
+			result.colors.avg, result.colors.bg1, result.colors.fg1);
+
+		if (TRACK_ALLOCATIONS)
+		{
+			fprintf(out, "      \"allocationsPerRun\": %.1f,\n      \"allocatedBytesPerRun\": %.0f,\n      \"peakHeapBytes\": %lld,\n",
+				(double)allocs / iterations, (double)bytes / iterations, (long long)peakHeap);
+		}
+		else
+		{
+			fprintf(out, "      \"allocationsPerRun\": null,\n      \"allocatedBytesPerRun\": null,\n      \"peakHeapBytes\": null,\n");
+		}
+
+		fprintf(out, "      \"poolHits\": %llu,\n      \"poolMisses\": %llu,\n",
+			(unsigned long long)(readCounter(COUNTER_POOL_HITS) - startPoolHits), (unsigned long long)(readCounter(COUNTER_POOL_MISSES) - startPoolMisses));
+		fprintf(out, "      \"peakRssKb\": %ld,\n      \"stages\": {\n", peakRssKb());
+
+		// Megapixels each stage got through per second: decoding and the
+		// whole sample go through the full image, resizing through the
+		// (cropped) view, and Chameleon through what's left after that
+		double fullPixels = (double)result.fullW * result.fullH;
+		double viewPixels = (double)result.viewW * result.viewH;
+		double samplePixels = (double)std::min(result.viewW, SAMPLE_MAX_DIMENSION) * std::min(result.viewH, SAMPLE_MAX_DIMENSION);
+
+		for (size_t s = 0; s < sizeof(reported) / sizeof(reported[0]); ++s)
+		{
+			Stage stage = reported[s];
+			StageStats stats = readStage(stage);
+
+			// Hashing doesn't care about pixels, just how big the file is
+			double pixels = stage == STAGE_DECODE || stage == STAGE_SAMPLE ? fullPixels : stage == STAGE_RESIZE ? viewPixels : samplePixels;
+			if (stage == STAGE_HASH)
+			{
+				pixels = (double)result.fileBytes;
+			}
+			double throughput = stats.average > 0 ? pixels / 1e6 / (stats.average / 1000) : 0;
+
+			fprintf(out, "        \"%s\": { \"runs\": %llu, \"minMs\": %.3f, \"avgMs\": %.3f, \"p95Ms\": %.3f, \"maxMs\": %.3f, \"%s\": %.1f }%s\n",
+				narrow(stageName(stage)).c_str(), (unsigned long long)stats.count, stats.minimum, stats.average, stats.p95, stats.maximum,
+				stage == STAGE_HASH ? "megabytesPerSecond" : "megapixelsPerSecond", throughput,
+				s + 1 < sizeof(reported) / sizeof(reported[0]) ? "," : "");
+		}
+
+		fprintf(out, "      }\n    }%s\n", c + 1 < cases.size() ? "," : "");
+		fflush(out);
+	}
+
+	fprintf(out, "  ],\n  \"resize\": [\n");
+
+	if (timeResizing)
+	{
+		// The big ones take a while through stb_image_resize, and the best of
+		// a few runs is plenty to compare by
+		int resizeIterations = std::min(iterations, 5);
+		size_t resizeCount = sizeof(resizeCases) / sizeof(resizeCases[0]);
+
+		for (size_t r = 0; r < resizeCount; ++r)
+		{
+			const ResizeCase &resize = resizeCases[r];
+			ResizeResult result = measureResize(resize, resizeIterations);
+
+			fprintf(out, "    { \"name\": \"%s\", \"width\": %d, \"height\": %d, \"stbirMs\": %.3f, \"fusedMs\": %.3f, \"scalarMs\": %.3f, \"speedup\": %.2f, \"maxDifference\": %d }%s\n",
+				resize.name, resize.w, resize.h, result.stbirMs, result.fusedMs, result.scalarMs, result.fusedMs > 0 ? result.stbirMs / result.fusedMs : 0, result.maxDifference,
+				r + 1 < resizeCount ? "," : "");
+			fflush(out);
+		}
+	}
+
+	fprintf(out, "  ],\n  \"pyramid\": {\n");
+
+	if (timePyramid)
+	{
+		printPyramid(out, std::min(iterations, 5));
+		fflush(out);
+	}
+
+	fprintf(out, "  },\n  \"formats\": {\n");
+
+	if (timeFormats)
+	{
+		// Cheap enough to take the best of plenty of runs
+		printFormats(out, cases, corpusDir, synthetic, std::max(iterations, 50));
+		fflush(out);
+	}
+
+	fprintf(out, "  },\n  \"icons\": [\n");
+
+	if (timeIcons)
+	{
+		printIcons(out, cases, corpusDir, synthetic, std::max(iterations, 50));
+		fflush(out);
+	}
+
+	fprintf(out, "  ],\n  \"sampling\": [\n");
+
+	if (compareSampling)
+	{
+		// Stratified with a few budgets, each against Box on the same image.
+		// Only a few runs each, this is about the colors more than the time.
+		static const int budgets[] = { SAMPLE_DEFAULT_BUDGET, SAMPLE_DEFAULT_BUDGET * 4, SAMPLE_DEFAULT_BUDGET * 16 };
+		int samplingIterations = std::min(iterations, 5);
+
+		for (size_t c = 0; c < cases.size(); ++c)
+		{
+			const BenchCase &bench = cases[c];
+			CaseResult reference = runPipeline(bench);
+
+			fprintf(out, "    {\n      \"name\": \"%s\",\n      \"runs\": [\n", escape(bench.name).c_str());
+
+			printSampling(out, bench, samplingIterations, reference.colors, SAMPLE_MODE_BOX, 0, false);
+			for (size_t b = 0; b < sizeof(budgets) / sizeof(budgets[0]); ++b)
+			{
+				printSampling(out, bench, samplingIterations, reference.colors, SAMPLE_MODE_STRATIFIED, budgets[b], b + 1 == sizeof(budgets) / sizeof(budgets[0]));
+			}
+
+			fprintf(out, "      ]\n    }%s\n", c + 1 < cases.size() ? "," : "");
+			fflush(out);
+		}
+	}
+
+	fprintf(out, "  ],\n  \"scaling\": [\n");
+
+	if (timeScaling)
+	{
+		// Doubling up to --threads, plus --threads itself if it isn't a power of two
+		std::vector<int> counts;
+		for (int count = 1; count < threads; count *= 2)
+		{
+			counts.push_back(count);
+		}
+		counts.push_back(threads);
+
+		ScalingResult single = { 0 };
+		for (size_t t = 0; t < counts.size(); ++t)
+		{
+			ScalingResult result = measureScaling((size_t)counts[t], std::min(iterations, 5));
+			if (t == 0)
+			{
+				single = result;
+			}
+
+			fprintf(out, "    { \"threads\": %d, \"downsampleMs\": %.3f, \"convertMs\": %.3f, \"tableMs\": %.3f, \"downsampleSpeedup\": %.2f, \"convertSpeedup\": %.2f, \"tableSpeedup\": %.2f }%s\n",
+				counts[t], result.downsampleMs, result.convertMs, result.tableMs,
+				single.downsampleMs / result.downsampleMs, single.convertMs / result.convertMs, single.tableMs / result.tableMs,
+				t + 1 < counts.size() ? "," : "");
+			fflush(out);
+		}
+
+		setParallelThreads((size_t)threads);
+	}
+
+	fprintf(out, "  ],\n  \"checks\": {\n");
+
+	if (runChecks)
+	{
+		printCheck(out, "pixelConvert", checkPixelConvert(), false);
+		printCheck(out, "summedArea", checkSummedArea(threads), false);
+		printCheck(out, "grid", checkGrid(), false);
+		printCheck(out, "stats", checkStats(), false);
+		printCheck(out, "paletteCache", checkPaletteCache(), false);
+		printCheck(out, "sampleRegistry", checkSampleRegistry(), false);
+		printCheck(out, "wallpapers", checkWallpapers(), false);
+		printCheck(out, "sourceFailures", checkSourceFailures(), false);
+		printCheck(out, "worker", checkWorker(), false);
+		printCheck(out, "fileWatcher", checkFileWatcher(corpusDir), true);
+	}
+
+	fprintf(out, "  },\n  \"peakRssKb\": %ld\n}\n", peakRssKb());
+
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+
+	return failedChecks > 0 ? 2 : 0;
+}
@@ -0,0 +1,188 @@
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "BufferPool.h"
+#include "Counters.h"
+
+// Sits in front of every buffer so we know how big it really is. Two words
+// keeps what comes after it as aligned as malloc made it.
+struct BlockHeader
+{
+	size_t capacity;
+	size_t pooled;
+};
+
+// Pooled buffers get rounded up to this, so images a few rows different
+// in size can still share
+#define POOL_GRANULE (64 * 1024)
+
+static std::mutex poolLock;
+
+// Oldest first, so that's what gets dropped when we're holding too much
+static std::vector<BlockHeader*> freeBlocks;
+static size_t retainedBytes = 0;
+
+static void *blockData(BlockHeader *block)
+{
+	return block + 1;
+}
+
+static BlockHeader *blockOf(void *ptr)
+{
+	return static_cast<BlockHeader*>(ptr) - 1;
+}
+
+void* poolAlloc(size_t size)
+{
+	if (size < POOL_MIN_SIZE)
+	{
+		BlockHeader *block = (BlockHeader*)malloc(sizeof(BlockHeader) + size);
+		if (block == nullptr)
+		{
+			return nullptr;
+		}
+
+		block->capacity = size;
+		block->pooled = 0;
+
+		return blockData(block);
+	}
+
+	size_t capacity = (size + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE;
+
+	{
+		std::lock_guard<std::mutex> guard(poolLock);
+
+		// Smallest block that fits without wasting more than a quarter of it
+		size_t best = freeBlocks.size();
+		for (size_t i = 0; i < freeBlocks.size(); ++i)
+		{
+			size_t found = freeBlocks[i]->capacity;
+			if (found >= capacity && found - capacity <= capacity / 4 && (best == freeBlocks.size() || found < freeBlocks[best]->capacity))
+			{
+				best = i;
+			}
+		}
+
+		if (best != freeBlocks.size())
+		{
+			BlockHeader *block = freeBlocks[best];
+			freeBlocks.erase(freeBlocks.begin() + best);
+			retainedBytes -= block->capacity;
+
+			countEvent(COUNTER_POOL_HITS);
+
+			return blockData(block);
+		}
+	}
+
+	countEvent(COUNTER_POOL_MISSES);
+
+	BlockHeader *block = (BlockHeader*)malloc(sizeof(BlockHeader) + capacity);
+	if (block == nullptr)
+	{
+		return nullptr;
+	}
+
+	block->capacity = capacity;
+	block->pooled = 1;
+
+	return blockData(block);
+}
+
+void* poolRealloc(void *ptr, size_t size)
+{
+	if (ptr == nullptr)
+	{
+		return poolAlloc(size);
+	}
+
+	if (size == 0)
+	{
+		poolFree(ptr);
+		return nullptr;
+	}
+
+	// Still fits (stb grows things a bit at a time)
+	BlockHeader *block = blockOf(ptr);
+	if (size <= block->capacity)
+	{
+		return ptr;
+	}
+
+	void *moved = poolAlloc(size);
+	if (moved == nullptr)
+	{
+		return nullptr;
+	}
+
+	memcpy(moved, ptr, block->capacity);
+	poolFree(ptr);
+
+	return moved;
+}
+
+void poolFree(void *ptr)
+{
+	if (ptr == nullptr)
+	{
+		return;
+	}
+
+	BlockHeader *block = blockOf(ptr);
+
+	if (!block->pooled || block->capacity > POOL_MAX_RETAINED)
+	{
+		free(block);
+		return;
+	}
+
+	// Make room by dropping the oldest ones, but do the actual freeing
+	// outside the lock
+	std::vector<BlockHeader*> dropped;
+
+	{
+		std::lock_guard<std::mutex> guard(poolLock);
+
+		size_t oldest = 0;
+		while (retainedBytes + block->capacity > POOL_MAX_RETAINED && oldest < freeBlocks.size())
+		{
+			retainedBytes -= freeBlocks[oldest]->capacity;
+			dropped.push_back(freeBlocks[oldest]);
+			++oldest;
+		}
+
+		freeBlocks.erase(freeBlocks.begin(), freeBlocks.begin() + oldest);
+		freeBlocks.push_back(block);
+		retainedBytes += block->capacity;
+	}
+
+	for (BlockHeader *old : dropped)
+	{
+		free(old);
+	}
+}
+
+void poolTrim()
+{
+	std::vector<BlockHeader*> dropped;
+
+	{
+		std::lock_guard<std::mutex> guard(poolLock);
+		dropped.swap(freeBlocks);
+		retainedBytes = 0;
+	}
+
+	for (BlockHeader *old : dropped)
+	{
+		free(old);
+	}
+}
+
+size_t poolRetained()
+{
+	std::lock_guard<std::mutex> guard(poolLock);
+	return retainedBytes;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+
+// Where the big image buffers (decoded images, desktop captures, resize
+// scratch space) come from. Freeing one hands it back here instead of to
+// the heap, and the next sample needing about the same amount picks it
+// back up. Wallpapers tend to be the same size every time, so a long
+// running Rainmeter doesn't have to keep churning through (and
+// fragmenting) hundreds of megabytes of heap every time one changes.
+//
+// Anything smaller than POOL_MIN_SIZE goes straight to malloc, and at most
+// POOL_MAX_RETAINED bytes are kept waiting to be reused. Safe to call from
+// any thread. Everything from here has to go back through poolFree.
+#define POOL_MIN_SIZE (64 * 1024)
+#define POOL_MAX_RETAINED (160 * 1024 * 1024)
+
+void* poolAlloc(size_t size);
+void* poolRealloc(void *ptr, size_t size);
+void poolFree(void *ptr);
+
+// Let go of everything waiting to be reused
+void poolTrim();
+
+// How many bytes are waiting to be reused
+size_t poolRetained();
@@ -1,1130 +1,1922 @@
-#include <vector>
-#include <memory>
-#include <string>
-
-#include <intrin.h>
-
-#include <Windows.h>
-#include <VersionHelpers.h>
-#include <Shobjidl.h>
-
-#include <shlwapi.h>
-#include <commoncontrols.h>
-#include <comip.h>
-#include <comdef.h>
-
-#include <RainmeterAPI.h>
-#include <chameleon.h>
-#include <chameleon_internal.h>
-
-#include "stb_image.h"
-#include "stb_image_resize.h"
-#include "stb_image_write.h"
-
-// Some helpful functions
-#include "utilities.h"
-
-// Definitions for the actual measure state
-#include "Measure.h"
-
-// An excessively large value I picked due to being a few orders of magnatude larger than the largest image I've seen (NASA Hubble image)
-#define CROP_MAX_DIMENSION 16777215
-
-/*
-[ChameleonDesktop]
-Measure=Plugin
-Plugin=Chameleon
-Type=Desktop
-
-[DesktopBG1]
-Measure=Plugin
-Plugin=Chameleon
-Parent=ChameleonDesktop
-Color=Background1
-
-[ChameleonFile]
-Measure=Plugin
-Plugin=Chameleon
-Type=File
-Path=C:\Path\To\Image
-
-[FileBG1]
-Measure=Plugin
-Plugin=Chameleon
-Parent=ChameleonFile
-Color=Background1
-
-*/
-
-std::vector< std::weak_ptr<Image> > images;
-static const WCHAR whex[] = L"0123456789ABCDEF";
-static const WCHAR invalidErr[] = L"Invalid measure";
-
-void SampleImage(std::shared_ptr<Image> img);
-PLUGIN_EXPORT void Initialize(void* *data, void *rm);
-PLUGIN_EXPORT void Reload(void *data, void *rm, double *maxVal);
-PLUGIN_EXPORT double Update(void *data);
-PLUGIN_EXPORT LPCWSTR GetString(void *data);
-PLUGIN_EXPORT void Finalize(void *data);
-
-bool IsWindows11_24H2OrGreater();
-
-void SampleImage(std::shared_ptr<Image> img)
-{
-	bool isIcon = false;
-	RECT monitorRect;
-	RECT skinRect = { 0 };
-	RECT actualCropRect = img->cropRect;
-	MONITORINFO monInf;
-	monInf.cbSize = sizeof(MONITORINFO);
-	bool customContext = img->contextRect.left || img->contextRect.right || img->contextRect.top || img->contextRect.bottom;
-
-	// If we're sampling the desktop, grab that
-	if (img->type == IMG_DESKTOP)
-	{
-		std::wstring path = L"";
-
-		// First, get the info we need from the old API
-
-		HMONITOR mon = MonitorFromWindow(img->hWnd, MONITOR_DEFAULTTONEAREST);
-		GetMonitorInfo(mon, &monInf);
-
-		if (IsWindows8OrGreater())
-		{
-			// Use the multi-desktop fun version!
-
-			// Set up the new API
-
-			LPWSTR monPath;
-			LPWSTR wallPath;
-
-			// Because making these just a few loose functions would have been too easy
-			IDesktopWallpaper *wp = nullptr;
-
-			CoCreateInstance(__uuidof(DesktopWallpaper), NULL, CLSCTX_ALL, IID_PPV_ARGS(&wp));
-			if (wp == nullptr)
-			{
-				// We couldn't get the wallpaper info. Just use the fallback colors
-				useDefaultColors(img);
-
-				img->dirty = false;
-
-				return;
-			}
-
-			// Count the monitors
-			UINT monCount = 0;
-			wp->GetMonitorDevicePathCount(&monCount);
-
-			// Compare the rectangles
-
-			for (UINT i = 0; i < monCount; ++i)
-			{
-				if (wp->GetMonitorDevicePathAt(i, &monPath) == S_OK)
-				{
-					RECT testRect;
-					wp->GetMonitorRECT(monPath, &testRect);
-
-					if (testRect.left == monInf.rcMonitor.left && testRect.top == monInf.rcMonitor.top)
-					{
-						// It's the monitor we're looking for!
-						wp->GetWallpaper(monPath, &wallPath);
-						path = wallPath;
-						CoTaskMemFree(wallPath);
-						CoTaskMemFree(monPath);
-						break;
-					}
-
-					CoTaskMemFree(monPath);
-				}
-			}
-
-			// Clean up
-			wp->Release();
-		}
-		else
-		{
-			// Use the "boring" WinXP - Win7 version
-			WCHAR wallPath[MAX_PATH + 1];
-			ZeroMemory((void*)wallPath, sizeof(WCHAR) * (MAX_PATH + 1));
-
-			if (SystemParametersInfoW(SPI_GETDESKWALLPAPER, MAX_PATH, (void*)wallPath, 0))
-			{
-				path = wallPath;
-			}
-			else
-			{
-				path = L"";
-			}
-		}
-
-		// First, is the current path the same as the new path
-		if (img->path.compare(path) != 0)
-		{
-			// It's different, mark it dirty!
-			img->path = path;
-			img->dirty = true;
-		}
-
-		// Prepare cropping info
-		monitorRect.left = monInf.rcMonitor.left;
-		monitorRect.top = monInf.rcMonitor.top;
-		monitorRect.right = monInf.rcMonitor.right - monInf.rcMonitor.left;
-		monitorRect.bottom = monInf.rcMonitor.bottom - monInf.rcMonitor.top;
-
-		// Get the actual area the skin is in, relative to the monitor
-		GetWindowRect(img->hWnd, &skinRect);
-
-		// Mark the skin as dragging until there is no movement
-		if (img->skinX != skinRect.left || img->skinY != skinRect.top)
-		{
-			img->skinX = skinRect.left;
-			img->skinY = skinRect.top;
-			img->draggingSkin = true;
-		}
-		// Don't update by dragging if we're using a custom context area
-		// or if we're just not using context-aware colors
-		else if (img->contextAware && img->draggingSkin && !customContext)
-		{
-			img->draggingSkin = false;
-			img->dirty = true;
-		}
-	}
-
-	// Determine if the skin's cropping area has changed
-	if (img->customCrop && !EqualRect(&img->cropRect, &img->cachedCrop))
-	{
-		img->cachedCrop = img->cropRect;
-		img->dirty = true;
-	}
-
-	// Let's check the path
-	if (img->path.empty())
-	{
-		// Empty path! Let's dump some default values and be done with it...
-		useDefaultColors(img);
-
-		img->dirty = false;
-
-		return;
-	}
-
-	// Now the "file modified" time
-	HANDLE file = CreateFileW(img->path.c_str(), 0, FILE_SHARE_DELETE | FILE_SHARE_WRITE | FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (file == INVALID_HANDLE_VALUE)
-	{
-		// Couldn't get the last accessed time for the file.
-		std::wstring debug = L"Chameleon: Could not get handle on ";
-		debug += img->path;
-		RmLog(LOG_ERROR, debug.c_str());
-
-		useDefaultColors(img);
-
-		img->dirty = false;
-
-		return;
-	}
-
-	FILETIME ft;
-	GetFileTime(file, NULL, NULL, &ft);
-	CloseHandle(file);
-
-	if (ft.dwHighDateTime != img->lastMod.dwHighDateTime || ft.dwLowDateTime != img->lastMod.dwLowDateTime)
-	{
-		// Different modification times...
-		img->lastMod.dwHighDateTime = ft.dwHighDateTime;
-		img->lastMod.dwLowDateTime = ft.dwLowDateTime;
-		img->dirty = true;
-	}
-
-	if (img->dirty)
-	{
-		std::wstring debug = L"Chameleon: Updating colors based on ";
-		debug += img->path;
-		RmLog(LOG_DEBUG, debug.c_str());
-
-		int w, h, n;
-		uint32_t *imgData = nullptr;
-		ColorStat spotAverage = { 0 };
-
-		// If we're reading from the desktop, read from Windows, not the file
-		// Unless we're in Win11 24H2 because MS did something stupid and broke it
-		if (img->type == IMG_DESKTOP && !IsWindows11_24H2OrGreater())
-		{
-			// Get the Real Device Context, then get a non-live copy to read from
-			HWND hwDesktop = GetShellWindow();
-
-			HDC hdcDesktop = GetDC(hwDesktop);
-			HDC hdc = CreateCompatibleDC(hdcDesktop);
-
-			// Get the upper left reference point for the virtual screen
-			// which might not be (0,0) due to monitor arrangement
-			int xRef = GetSystemMetrics(SM_XVIRTUALSCREEN);
-			int yRef = GetSystemMetrics(SM_YVIRTUALSCREEN);
-
-			// Set up the default monitor-based cropping
-			int imgW = monitorRect.right;
-			int imgH = monitorRect.bottom;
-
-			// This is meant to shift the virtual screen coords to image space coords.
-			int imgX = monInf.rcMonitor.left - xRef;
-			int imgY = monInf.rcMonitor.top - yRef;
-
-			if (img->customCrop)
-			{
-				// There's a custom cropping rectangle, so we can just grab the whole screen
-				// (the cropping code will handle it automatically later)
-				imgX = 0;
-				imgY = 0;
-				imgW = GetSystemMetrics(SM_CXVIRTUALSCREEN);
-				imgH = GetSystemMetrics(SM_CYVIRTUALSCREEN);
-				
-				// Adjust the cropping rectangle
-				actualCropRect.left -= xRef;
-				actualCropRect.right -= xRef;
-				actualCropRect.top -= yRef;
-				actualCropRect.bottom -= yRef;
-			}
-
-			// Create the bitmap we're going to bounce the image data into, and the immediately out of
-			// because it's in a device-specific format
-			// (maybe 6-bit, maybe 8-bit, maybe 10-bit, rgb, bgrx, rgbx, who knows!)
-			HBITMAP hBmp = CreateCompatibleBitmap(hdcDesktop, imgW, imgH);
-
-			// do the actual copy, but save the default hbmp windows set up that we can't exactly use for this
-			// so we can let windows clean that up later
-			HBITMAP hOldBmp = (HBITMAP)SelectObject(hdc, hBmp);
-
-			BitBlt(hdc, 0, 0, imgW, imgH, hdcDesktop, imgX, imgY, SRCCOPY);
-
-			// Windows doesn't like having the handle selected when we want to read from it,
-			// so now we put the old handle back 
-			SelectObject(hdc, hOldBmp);
-
-			// Now we have the data in a device specific buffer that Windows won't touch while we're using it
-			// so let's convert that to a format we can actually use
-
-			LPBITMAPINFO bmpInfo = (LPBITMAPINFO)malloc(sizeof(BITMAPINFOHEADER) + 256 * sizeof(RGBQUAD));
-			ZeroMemory(&bmpInfo->bmiHeader, sizeof(BITMAPINFOHEADER));
-			bmpInfo->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-
-			// Get what Windows wants us to allocate, and do so
-			GetDIBits(hdc, hBmp, 0, imgH, NULL, bmpInfo, DIB_RGB_COLORS);
-			uint8_t *byteData = (uint8_t*)malloc(bmpInfo->bmiHeader.biSizeImage);
-
-			// Now do the actual copy
-			GetDIBits(hdc, hBmp, 0, imgH, byteData, bmpInfo, DIB_RGB_COLORS);
-
-			w = bmpInfo->bmiHeader.biWidth;
-			h = bmpInfo->bmiHeader.biHeight;
-
-			// Windows uses a negative value to specify the bitmap is right side up
-			// if it's not, we need to adjust the cropping, if any
-			if (h < 0)
-				h = -h;
-			else if(img->customCrop)
-			{
-				LONG bottom = actualCropRect.bottom;
-				actualCropRect.bottom = imgH - actualCropRect.top;
-				actualCropRect.top = imgH - bottom;
-			}
-
-			// We're going to be doing this by bytes so it'll be easier
-			imgData = (uint32_t*) createImage(w, h);
-			
-			// At this point, we have the color data but probably not in the layout we are expecting...
-			// (i.e. BGRX instead of RGBX)
-			// We need to figure out what it *is* so we can convert it to what we *want*
-			// It should be one of 3 possibilities: 16, 24, or 32-bit
-			// Of those, 16 and 32-bit can be either BI_RGB or BI_BITFIELDS
-			// If they are BI_BITFIELDS we need to use the info in bmpInfo->bmiColors[0,1,2]
-			// to decode where the R, G. and B bits actually are.
-			
-			// For 32-bit this is easy and we can actually basically use the same code path for BI_RGB and BI_BITFIELDS.
-
-			// These are AFTER shifting the data down to LSB
-			uint32_t rMask = 0x000000FF;
-			uint32_t gMask = 0x000000FF;
-			uint32_t bMask = 0x000000FF;
-
-			// These are how much to shift to get to LSB
-			unsigned long rShift = 16;
-			unsigned long gShift =  8;
-			unsigned long bShift =  0;
-			size_t pixelBytes = bmpInfo->bmiHeader.biBitCount / 8;
-
-			// Anything that is BI_RGB follows a standard format, with only 16-bit (2-byte)
-			// images requiring special treatment. HOWEVER anything BI_BITFIELDS has to be
-			// masked and shifted according to what the OS says. It can all be treated the same
-			// by the following code due to how it ends up not caring about details.
-
-			if (bmpInfo->bmiHeader.biCompression == BI_BITFIELDS)
-			{
-				// Could be R5G5B5, X8R8G8B8, R5G6B5, or anything really.
-				// Let's figure it out
-
-				// Get the actual masks. These are shifted, so we'll need to unshift them
-				// (and count by how much for later)
-				rMask = ((uint32_t*)bmpInfo->bmiColors)[0];
-				gMask = ((uint32_t*)bmpInfo->bmiColors)[1];
-				bMask = ((uint32_t*)bmpInfo->bmiColors)[2];
-
-				// Count the least significant zeros (how much to shift the masks)
-				_BitScanForward(&rShift, rMask);
-				_BitScanForward(&gShift, gMask);
-				_BitScanForward(&bShift, bMask);
-
-				rMask >>= rShift;
-				gMask >>= gShift;
-				bMask >>= bShift;
-			}
-			else if (pixelBytes == 2)
-			{
-				// Standard R5G5B5
-
-				rMask = 0x0000001F;
-				gMask = 0x0000001F;
-				bMask = 0x0000001F;
-
-				rShift = 10;
-				gShift =  5;
-				bShift =  0;
-			}
-			
-			uint8_t r, g, b;
-			uint32_t pixel;
-			for (size_t i = 0; i < w * h; ++i)
-			{
-				// Augh...
-				// We want the data of the whole pixel we're at, as a uint32_t
-				// If the data is smaller than 32-bit the extra will automatically
-				// be ignored by the shift and masking we're about to do
-				pixel = *((uint32_t*)&byteData[i * pixelBytes]);
-
-				r = (pixel >> rShift) & rMask;
-				g = (pixel >> gShift) & gMask;
-				b = (pixel >> bShift) & bMask;
-
-				imgData[i] = 0xFF000000 | (b << 16) | (g << 8) | r;
-			}
-			
-			n = 4;
-
-
-			
-			if (img->contextAware)
-			{
-				// Now we need to create an average for the region of the skin
-				int cW = w, cH = h;
-
-				// If we have a custom context rectangle, use that
-				
-				if (customContext)
-					skinRect = img->contextRect;
-
-				// Image should be by the overall desktop for custom cropping
-				// and by monitor for default cropping
-				if (img->customCrop || customContext)
-				{
-					skinRect.left -= xRef;
-					skinRect.right -= xRef;
-					skinRect.top -= yRef;
-					skinRect.bottom -= yRef;
-				}
-				else
-				{
-					skinRect.left -= monInf.rcMonitor.left;
-					skinRect.right -= monInf.rcMonitor.left;
-					skinRect.top -= monInf.rcMonitor.top;
-					skinRect.bottom -= monInf.rcMonitor.top;
-				}
-
-				if (bmpInfo->bmiHeader.biHeight > 0)
-				{
-					// Oh, we're vertically flipped.
-					// Gotta "flip" the rect to match (actually just shifting it)
-					LONG bottom = skinRect.bottom;
-					skinRect.bottom = h - skinRect.top;
-					skinRect.top = h - bottom;
-				}
-
-				// Make sure I'm not doing a dumb by sampling negative values
-				if (skinRect.left < 0)
-					skinRect.left = 0;
-				if (skinRect.top < 0)
-					skinRect.top = 0;
-
-				uint32_t *skinRegion = cropImage(imgData, &cW, &cH, &skinRect);
-
-				//stbi_write_png("chamtest.png", cW, cH, 4, skinRegion, cW * sizeof(uint32_t));
-
-				for (size_t i = 0; i < cW * cH; ++i)
-				{
-					processRGB(skinRegion[i], &spotAverage);
-				}
-
-				fixRGB(&spotAverage, (float)cW * cH);
-				calcYUV(&spotAverage, 1);
-
-				if (skinRegion != imgData)
-					stbi_image_free(skinRegion);
-			}
-
-			DeleteObject(hBmp);
-			DeleteDC(hdc);
-			ReleaseDC(hwDesktop, hdcDesktop);
-			free(bmpInfo);
-			free(byteData);
-		}
-		else
-		{
-			// Convert the path
-
-			FILE *fp;
-
-			if (_wfopen_s(&fp, img->path.c_str(), L"rb") != 0)
-			{
-				// Something goofed, but we can try again
-				return;
-			}
-
-			// Load image data
-			imgData = (uint32_t*)stbi_load_from_file(fp, &w, &h, &n, 4);
-
-			fclose(fp);
-		}
-
-		if (imgData == nullptr)
-		{
-			RmLog(LOG_ERROR, L"Chameleon: Could not load file!");
-
-			imgData = loadIcon(img->path.c_str(), &w, &h);
-
-			if (imgData == nullptr)
-			{
-				// It's something we don't actually know how to handle, so let's not.
-				useDefaultColors(img);
-
-				img->dirty = false;
-
-				return;
-			}
-
-			// RGB swap image data?
-			uint32_t temp = 0;
-			size_t area = w * h;
-			for (size_t i = 0; i < area; ++i)
-			{
-				temp = imgData[i];
-				imgData[i] = (temp & 0xFF000000) | ((temp & 0x00FF0000) >> 16) | (temp & 0x0000FF00) | ((temp & 0x000000FF) << 16);
-			}
-
-			isIcon = true;
-		}
-
-		isIcon |= img->forceIcon;
-
-		//  Crop image as requested
-		if (img->customCrop)
-		{
-			// Adjust cropping for monitor malarkey thanks to 24H2!
-			if (img->type == IMG_DESKTOP && IsWindows11_24H2OrGreater()) {
-
-				// adjust the cropping rectangle origin from global desktop space to monitor space
-				int xRef = GetSystemMetrics(SM_XVIRTUALSCREEN);
-				int yRef = GetSystemMetrics(SM_YVIRTUALSCREEN);
-
-				actualCropRect.left -= monitorRect.left;
-				actualCropRect.right -= monitorRect.left;
-				actualCropRect.top -= monitorRect.top;
-				actualCropRect.bottom -= monitorRect.top;
-
-				// we assume the image is set to "fill" to keep the code simple
-				// this is just a basic ratio transform of the coordinates from
-				// monitor space to image space
-				float scale = 1.0f;
-				float widthRatio = ((float)w) / ((float)monitorRect.right);
-				float heightRatio = ((float)h) / ((float)monitorRect.bottom);
-				if (widthRatio < heightRatio)
-					scale = widthRatio;
-				else
-					scale = heightRatio;
-
-				actualCropRect.left *= scale;
-				actualCropRect.right *= scale;
-				actualCropRect.top *= scale;
-				actualCropRect.bottom *= scale;
-			}
-
-			uint32_t *croppedData = cropImage(imgData, &w, &h, &actualCropRect);
-			if (croppedData != imgData)
-			{
-				stbi_image_free(imgData);
-				imgData = croppedData;
-			}
-		}
-
-		// Quick Sanity Check
-		if (w <= 0 || h <= 0)
-		{
-			// I debated having a crop size of 0 being an error, but some skins might
-			// need to set it to that as a kind of "don't do anything" or maybe through a
-			// procedural generation of the crop bounds so we'll just skip doing anything.
-			
-//			RmLog(LOG_ERROR, L"Chameleon: Width or height is less than or equal to zero!");
-//			useDefaultColors(img);
-
-			img->dirty = false;
-
-			return;
-		}
-
-		// Resize image for Chameleon
-		if (w > 256 || h > 256)
-		{
-			int newWidth = (w < 256 ? w : 256);
-			int newHeight = (h < 256 ? h : 256);
-			uint32_t *resizedData = createImage(newWidth, newHeight);
-
-			stbir_resize_uint8_generic(reinterpret_cast<unsigned char*>(imgData), w, h, 0, reinterpret_cast<unsigned char*>(resizedData), newWidth, newHeight, 0, 4, -1, 0, STBIR_EDGE_CLAMP, STBIR_FILTER_BOX, STBIR_COLORSPACE_LINEAR, NULL);
-
-			stbi_image_free(imgData);
-
-			imgData = resizedData;
-			w = newWidth;
-			h = newHeight;
-		}
-
-		// Run through Chameleon
-		Chameleon *chameleon = createChameleon();
-
-		chameleonProcessImage(chameleon, imgData, w, h, isIcon);
-
-		if (isIcon)
-		{
-			chameleonFindKeyColors(chameleon, chameleonDefaultIconParams(), false);
-		}
-		else
-		{
-			chameleonFindKeyColors(chameleon, chameleonDefaultImageParams(), true);
-		}
-
-		// Swap the colors because the byte ordering is opposite that of what we want to give Rainmeter...
-		img->bg1 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_BACKGROUND1)) | 0xFF;
-		img->bg2 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_BACKGROUND2)) | 0xFF;
-		img->fg1 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_FOREGROUND1)) | 0xFF;
-		img->fg2 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_FOREGROUND2)) | 0xFF;
-
-		img->l1 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_LIGHT1)) | 0xFF;
-		img->l2 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_LIGHT2)) | 0xFF;
-		img->l3 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_LIGHT3)) | 0xFF;
-		img->l4 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_LIGHT4)) | 0xFF;
-
-		img->d1 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_DARK1)) | 0xFF;
-		img->d2 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_DARK2)) | 0xFF;
-		img->d3 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_DARK3)) | 0xFF;
-		img->d4 = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_DARK4)) | 0xFF;
-
-		img->avg = _byteswap_ulong(chameleonGetColor(chameleon, CHAMELEON_AVERAGE)) | 0xFF;
-
-		img->lum = chameleonGetLuminance(chameleon, CHAMELEON_AVERAGE);
-
-		if (img->type == IMG_DESKTOP && img->contextAware)
-		{
-			// Find which value is closest to the average value for the skin
-			ColorStat bg1 = { 0 };
-			ColorStat bg2 = { 0 };
-			ColorStat fg1 = { 0 };
-			ColorStat fg2 = { 0 };
-
-			processRGB(chameleonGetColor(chameleon, CHAMELEON_BACKGROUND1), &bg1);
-			calcYUV(&bg1, 1);
-			processRGB(chameleonGetColor(chameleon, CHAMELEON_BACKGROUND2), &bg2);
-			calcYUV(&bg2, 1);
-			processRGB(chameleonGetColor(chameleon, CHAMELEON_FOREGROUND1), &fg1);
-			calcYUV(&fg1, 1);
-			processRGB(chameleonGetColor(chameleon, CHAMELEON_FOREGROUND2), &fg2);
-			calcYUV(&fg2, 1);
-
-			float bg1Dist = distance(&spotAverage, &bg1);
-			float bg2Dist = distance(&spotAverage, &bg2);
-			float fg1Dist = distance(&spotAverage, &fg1);
-			float fg2Dist = distance(&spotAverage, &fg2);
-
-			uint32_t sbg1 = img->bg1;
-			uint32_t sbg2 = img->bg2;
-			uint32_t sfg1 = img->fg1;
-			uint32_t sfg2 = img->fg2;
-			// Set the background/foreground based on that
-			if ((bg2Dist < bg1Dist) && (bg2Dist < fg1Dist) && (bg2Dist < fg2Dist))
-			{
-				// BG2 is the closest match for the background under the skin, use that instead
-				
-				img->bg1 = sbg2;
-				img->bg2 = sbg1;
-			}
-			else if ((fg1Dist < bg1Dist) && (fg1Dist < fg2Dist))
-			{
-				// FG1 is the closest match, swap the FG and BG
-				img->bg1 = sfg1;
-				img->bg2 = sfg2;
-				img->fg1 = sbg1;
-				img->fg2 = sbg2;
-			}
-			else if (fg2Dist < bg1Dist)
-			{
-				// FG2 is the closest match
-				img->bg1 = sfg2;
-				img->bg2 = sfg1;
-				img->fg1 = sbg1;
-				img->fg2 = sbg2;
-			}
-		}
-
-		destroyChameleon(chameleon);
-		chameleon = nullptr;
-
-		stbi_image_free(imgData);
-
-		img->dirty = false;
-	}
-}
-
-// Prepares the measure for Rainmeter to use
-PLUGIN_EXPORT void Initialize(void* *data, void *rm)
-{
-	Measure* measure = new Measure;
-	measure->type = MEASURE_CONTAINER;
-	measure->parent = nullptr;
-	*data = measure;
-}
-
-// Sets the initial state for the measure
-PLUGIN_EXPORT void Reload(void *data, void *rm, double *maxVal)
-{
-	Measure *measure = static_cast<Measure*>(data);
-
-	void *skin = RmGetSkin(rm);
-
-	std::wstring parent = RmReadString(rm, L"Parent", L"");
-
-	if (parent.empty())
-	{
-		std::wstring type = RmReadString(rm, L"Type", L"Desktop");
-		std::wstring path = RmReadPath(rm, L"Path", L"");
-		bool desktopCrop = RmReadBool(rm, L"CropDesktop", true);
-		bool forceIcon = RmReadBool(rm, L"ForceIcon", false);
-		bool contextAware = RmReadBool(rm, L"ContextAwareColors", true);
-
-		uint32_t fallback_bg1 = RmReadColor(rm, L"FallbackBG1", 0xFFFFFFFF);
-		uint32_t fallback_bg2 = RmReadColor(rm, L"FallbackBG2", fallback_bg1);
-		uint32_t fallback_fg1 = RmReadColor(rm, L"FallbackFG1", 0x000000FF);
-		uint32_t fallback_fg2 = RmReadColor(rm, L"FallbackFG2", fallback_fg1);
-
-		int cropX = RmReadInt(rm, L"CropX", 0);
-		int cropY = RmReadInt(rm, L"CropY", 0);
-		int cropW = RmReadInt(rm, L"CropW", CROP_MAX_DIMENSION);
-		int cropH = RmReadInt(rm, L"CropH", CROP_MAX_DIMENSION);
-
-		bool customCrop = !(cropX == 0 && cropY == 0 && cropW == CROP_MAX_DIMENSION && cropH == CROP_MAX_DIMENSION);
-
-		// Does the measure already have a parent?
-		std::shared_ptr<Image> img;
-
-		if (measure->parent != nullptr)
-		{
-			// Refresh it!
-			img = measure->parent;
-		}
-		else
-		{
-			img = std::make_shared<Image>();
-			img->rm = rm;
-			img->name = RmGetMeasureName(rm);
-			img->skin = skin;
-			img->hWnd = RmGetSkinWindow(rm);
-
-			img->lastMod.dwHighDateTime = img->lastMod.dwLowDateTime = 0;
-
-			measure->type = MEASURE_CONTAINER;
-			measure->parent = img;
-
-			images.push_back(img);
-
-			img->bg1 = img->bg2 = img->fg1 = img->fg2 = 0x000000FF;
-
-			img->customCrop = false;
-
-			img->skinX = 0;
-			img->skinY = 0;
-			img->draggingSkin = false;
-
-			// We'll need to reload the color data...
-			img->dirty = true;
-
-			std::wstring debug = L"Chameleon: Created container ";
-			debug += RmGetMeasureName(rm);
-			RmLog(LOG_DEBUG, debug.c_str());
-		}
-
-		if (type.compare(L"Desktop") == 0)
-		{
-			img->type = IMG_DESKTOP;
-			img->forceIcon = false;
-
-			// Define a "custom" crop of max-size to prevent the default
-			// "crop to monitor size" behavior but only use it if
-			// CropDesktop is anything other than 0
-			img->cropRect.left = img->cropRect.top = 0;
-			img->cropRect.right = img->cropRect.bottom = LONG_MAX;
-			img->customCrop = !desktopCrop;
-		}
-		else if (type.compare(L"File") == 0)
-		{
-			img->type = IMG_FILE;
-			
-			if (path.compare(img->path) != 0)
-			{
-				img->path = path;
-				img->dirty = true;
-			}
-
-			img->forceIcon = forceIcon;
-		}
-		else
-		{
-			RmLog(LOG_ERROR, L"Chameleon: Invalid Type=");
-			return;
-		}
-
-		// Shuffle the colors based on the average color
-		// of the area under the skin
-		img->contextAware = contextAware;
-
-		img->fallback_bg1 = fallback_bg1;
-		img->fallback_bg2 = fallback_bg2;
-		img->fallback_fg1 = fallback_fg1;
-		img->fallback_fg2 = fallback_fg2;
-
-		// Make sure the initial colors are the fallback
-		img->bg1 = fallback_bg1;
-		img->bg2 = fallback_bg2;
-		img->fg1 = fallback_fg1;
-		img->fg2 = fallback_fg2;
-
-		// Grab cropping info
-		img->cropRect.left = cropX;
-		img->cropRect.top = cropY;
-		img->cropRect.right = cropW + cropX;
-		img->cropRect.bottom = cropH + cropY;
-
-		// Use the cropping info if it's not the defaults
-		img->customCrop = customCrop;
-
-		Update(data);
-	}
-	else
-	{
-		for (std::weak_ptr<Image> imgPtr : images)
-		{
-			if (!imgPtr.expired())
-			{
-				std::shared_ptr<Image> img = imgPtr.lock();
-				if (img->skin == skin && img->name.compare(parent) == 0)
-				{
-					measure->parent = img;
-
-					std::wstring debug = L"Measure ";
-					debug += RmGetMeasureName(rm);
-					debug += L" has a parent of ";
-					debug += measure->parent->name;
-					debug += L" and is exposing the color ";
-
-					std::wstring color = RmReadString(rm, L"Color", L"");
-					debug += color;
-					RmLog(LOG_DEBUG, debug.c_str());
-
-					if (color.compare(L"Background1") == 0)
-					{
-						measure->type = MEASURE_BG1;
-					}
-					else if (color.compare(L"Background2") == 0)
-					{
-						measure->type = MEASURE_BG2;
-					}
-					else if (color.compare(L"Foreground1") == 0)
-					{
-						measure->type = MEASURE_FG1;
-					}
-					else if (color.compare(L"Foreground2") == 0)
-					{
-						measure->type = MEASURE_FG2;
-					}
-					else if (color.compare(L"Luminance") == 0)
-					{
-						measure->type = MEASURE_AVG_LUM;
-					}
-					else if (color.compare(L"Average") == 0)
-					{
-						measure->type = MEASURE_AVG_COLOR;
-					}
-					else if (color.compare(L"Light1") == 0)
-					{
-						measure->type = MEASURE_L1;
-					}
-					else if (color.compare(L"Light2") == 0)
-					{
-						measure->type = MEASURE_L2;
-					}
-					else if (color.compare(L"Light3") == 0)
-					{
-						measure->type = MEASURE_L3;
-					}
-					else if (color.compare(L"Light4") == 0)
-					{
-						measure->type = MEASURE_L4;
-					}
-					else if (color.compare(L"Dark1") == 0)
-					{
-						measure->type = MEASURE_D1;
-					}
-					else if (color.compare(L"Dark2") == 0)
-					{
-						measure->type = MEASURE_D2;
-					}
-					else if (color.compare(L"Dark3") == 0)
-					{
-						measure->type = MEASURE_D3;
-					}
-					else if (color.compare(L"Dark4") == 0)
-					{
-						measure->type = MEASURE_D4;
-					}
-					else
-					{
-						RmLog(LOG_ERROR, L"Chameleon: Invalid Color=");
-						return;
-					}
-
-					std::wstring useHex = RmReadString(rm, L"Format", L"Hex");
-
-					if (useHex.compare(L"Hex") == 0)
-					{
-						measure->useHex = true;
-					}
-					else if (useHex.compare(L"Dec") == 0)
-					{
-						measure->useHex = false;
-					}
-					else
-					{
-						measure->useHex = true;
-						RmLog(LOG_ERROR, L"Chameleon: Invalid Format=");
-						return;
-					}
-
-					return;
-				}
-			}
-		}
-
-		// If we got here, we didn't find the parent
-		std::wstring err = L"Chameleon: Invalid Parent=";
-		err += parent;
-		err += L" in ";
-		err += RmGetMeasureName(rm);
-		RmLog(LOG_ERROR, err.c_str());
-	}
-}
-
-// Called periodically to refresh the values passed to and returned from the measure
-// Dynamic variables should be re-read here.
-PLUGIN_EXPORT double Update(void *data)
-{
-	Measure *measure = static_cast<Measure*>(data);
-
-	// Containers are the "parent" type, so they get to be the ones that actually update
-	if (measure->type == MEASURE_CONTAINER)
-	{
-		// Update the path
-		if (measure->parent->type == IMG_FILE)
-		{
-			std::wstring newPath = RmReadPath(measure->parent->rm, L"Path", L"");
-			if (measure->parent->path.compare(newPath) != 0)
-			{
-				// Different path, need to update image
-				measure->parent->path = newPath;
-				measure->parent->dirty = true;
-			}
-		}
-
-		int cropX = RmReadInt(measure->parent->rm, L"CropX", 0);
-		int cropY = RmReadInt(measure->parent->rm, L"CropY", 0);
-		int cropW = RmReadInt(measure->parent->rm, L"CropW", CROP_MAX_DIMENSION);
-		int cropH = RmReadInt(measure->parent->rm, L"CropH", CROP_MAX_DIMENSION);
-
-		bool customCrop = !(cropX == 0 && cropY == 0 && cropW == CROP_MAX_DIMENSION && cropH == CROP_MAX_DIMENSION);
-
-		// Grab cropping info
-		measure->parent->cropRect.left = cropX;
-		measure->parent->cropRect.top = cropY;
-		measure->parent->cropRect.right = cropW + cropX;
-		measure->parent->cropRect.bottom = cropH + cropY;
-
-		int contextX = RmReadInt(measure->parent->rm, L"ContextX", 0);
-		int contextY = RmReadInt(measure->parent->rm, L"ContextY", 0);
-		int contextW = RmReadInt(measure->parent->rm, L"ContextW", 0);
-		int contextH = RmReadInt(measure->parent->rm, L"ContextH", 0);
-		measure->parent->contextRect.left = contextX;
-		measure->parent->contextRect.top = contextY;
-		measure->parent->contextRect.right = contextX + contextW;
-		measure->parent->contextRect.bottom = contextY + contextH;
-
-		// Use the cropping info if it's not the defaults
-		measure->parent->customCrop = customCrop;
-
-		SampleImage(measure->parent);
-	}
-	else
-	{
-		// We're updating a child measure, it just needs to format the value from the parent
-		uint32_t value = 0;
-
-		if (measure->type == MEASURE_AVG_LUM)
-		{
-			return measure->parent->lum;
-		}
-
-		// Choose the right value
-		switch (measure->type)
-		{
-		case MEASURE_BG1:
-			value = measure->parent->bg1;
-			break;
-		case MEASURE_BG2:
-			value = measure->parent->bg2;
-			break;
-		case MEASURE_FG1:
-			value = measure->parent->fg1;
-			break;
-		case MEASURE_FG2:
-			value = measure->parent->fg2;
-			break;
-
-		case MEASURE_AVG_COLOR:
-			value = measure->parent->avg;
-			break;
-
-		case MEASURE_L1:
-			value = measure->parent->l1;
-			break;
-		case MEASURE_L2:
-			value = measure->parent->l2;
-			break;
-		case MEASURE_L3:
-			value = measure->parent->l3;
-			break;
-		case MEASURE_L4:
-			value = measure->parent->l4;
-			break;
-
-		case MEASURE_D1:
-			value = measure->parent->d1;
-			break;
-		case MEASURE_D2:
-			value = measure->parent->d2;
-			break;
-		case MEASURE_D3:
-			value = measure->parent->d3;
-			break;
-		case MEASURE_D4:
-			value = measure->parent->d4;
-			break;
-		}
-
-		// Lop off the alpha
-		value >>= 8;
-
-		measure->value.clear();
-
-		// Which format?
-		if (measure->useHex)
-		{
-			for (size_t i = 0; i < 6; ++i) { measure->value += whex[(value >> (20 - 4 * i)) & 0x0F]; }
-		}
-		else
-		{
-			measure->value = std::to_wstring((value >> 16) & 0xFF) + L"," + std::to_wstring((value >> 8) & 0xFF) + L"," + std::to_wstring(value & 0xFF);
-		}
-	}
-
-	// This plugin only returns strings so...
-	return 0;
-}
-
-// Reading the value of a measure as a c-string
-PLUGIN_EXPORT LPCWSTR GetString(void *data)
-{
-	Measure *measure = static_cast<Measure*>(data);
-	std::shared_ptr<Image> img = measure->parent;
-
-	if (img == nullptr)
-	{
-		return invalidErr;
-	}
-
-	if (measure->type == MEASURE_CONTAINER)
-	{
-		return img->path.c_str();
-	}
-	else if (measure->type == MEASURE_AVG_LUM)
-	{
-		return NULL;
-	}
-	else
-	{
-		return measure->value.c_str();
-	}
-}
-
-// When we're removing a measure we don't need anymore
-PLUGIN_EXPORT void Finalize(void *data)
-{
-	Measure *measure = static_cast<Measure*>(data);
-	delete measure;
-}
-
-// Dumb function for dumb broken desktop sampling
-bool isWin1124h2 = false;
-bool isWin1124h2Detected = false;
-#define WIN11_24H2_BUILD 26100
-bool IsWindows11_24H2OrGreater() {
-	// I highly doubt we'll need to detect this literally every time we call this function,
-	// so we cache the value and return that
-	if (isWin1124h2Detected)
-		return isWin1124h2;
-
-	// Get the version info
-	NTSTATUS(WINAPI * RtlGetVersion)(LPOSVERSIONINFOEXW);
-	OSVERSIONINFOEXW versionInfo;
-
-	*(FARPROC*)&RtlGetVersion = GetProcAddress(GetModuleHandleA("ntdll"), "RtlGetVersion");
-
-	if(RtlGetVersion != NULL)
-	{
-		versionInfo = { sizeof(versionInfo) };
-		RtlGetVersion(&versionInfo);
-
-		isWin1124h2 = versionInfo.dwMajorVersion == 10 && versionInfo.dwBuildNumber >= WIN11_24H2_BUILD;
-	}
-	else
-	{
-		// if we couldn't tell, just assume it is because we want to take a
-		// fallback route for 24h2. Don't use this for enabling features!
-		isWin1124h2 = true;
-	}
-
-	isWin1124h2Detected = true;
-
-	return isWin1124h2;
+#include <vector>
+#include <memory>
+#include <string>
+#include <atomic>
+
+#include <intrin.h>
+
+#include <Windows.h>
+#include <VersionHelpers.h>
+#include <Shobjidl.h>
+
+#include <shlwapi.h>
+#include <commoncontrols.h>
+#include <comip.h>
+#include <comdef.h>
+
+#include <RainmeterAPI.h>
+#include <chameleon.h>
+#include <chameleon_internal.h>
+
+#include "stb_image.h"
+#include "stb_image_resize.h"
+#include "stb_image_write.h"
+
+// Some helpful functions
+#include "utilities.h"
+
+// Definitions for the actual measure state
+#include "Measure.h"
+
+// Background thread the sampling runs on
+#include "Worker.h"
+
+// Palettes remembered between sessions
+#include "PaletteCache.h"
+
+// Containers sampling the same thing share the work
+#include "SampleRegistry.h"
+
+// Turning whatever Windows gives us into RGBA
+#include "PixelConvert.h"
+
+// Looking at (parts of) images without copying them
+#include "ImageView.h"
+
+// Resizing and picking the colors
+#include "Sampler.h"
+
+// Reusing the big image buffers between samples
+#include "BufferPool.h"
+
+// Finding out when files change without opening them all the time
+#include "FileWatcher.h"
+
+// Recognizing files we've seen before by what's in them
+#include "ContentHash.h"
+
+// Reading files straight out of memory
+#include "MappedFile.h"
+
+// Keeping decoded images around for when only the crop changes
+#include "FrameCache.h"
+
+// Which wallpaper is on which monitor, without asking every update
+#include "WallpaperSource.h"
+
+// Backing off files that keep failing
+#include "SourceFailures.h"
+
+// Telling what a file is from its first few bytes
+#include "ImageFormat.h"
+
+// Icons straight out of .ico files and programs
+#include "IconDecoder.h"
+
+// Splitting big images up between threads
+#include "ThreadPool.h"
+
+// Hit/miss counts and such
+#include "Counters.h"
+
+// How long everything takes
+#include "Stats.h"
+
+// An excessively large value I picked due to being a few orders of magnatude larger than the largest image I've seen (NASA Hubble image)
+#define CROP_MAX_DIMENSION 16777215
+
+/*
+[ChameleonDesktop]
+Measure=Plugin
+Plugin=Chameleon
+Type=Desktop
+
+[DesktopBG1]
+Measure=Plugin
+Plugin=Chameleon
+Parent=ChameleonDesktop
+Color=Background1
+
+[ChameleonFile]
+Measure=Plugin
+Plugin=Chameleon
+Type=File
+Path=C:\Path\To\Image
+
+[FileBG1]
+Measure=Plugin
+Plugin=Chameleon
+Parent=ChameleonFile
+Color=Background1
+
+*/
+
+std::vector< std::weak_ptr<Image> > images;
+static const WCHAR whex[] = L"0123456789ABCDEF";
+static const WCHAR invalidErr[] = L"Invalid measure";
+
+enum SampleResult
+{
+	SAMPLE_DONE,
+	SAMPLE_FALLBACK,
+	SAMPLE_SKIPPED,
+	SAMPLE_RETRY
+};
+
+void SampleImage(std::shared_ptr<Image> img);
+SampleResult ProcessSample(const SampleJob &job, ColorSet *colors, std::shared_ptr<const ContextFrame> *context, std::shared_ptr<const GridColors> *grid);
+void queueSharedSample(std::shared_ptr<SharedSample> shared, const SampleJob &job);
+void sampleFinished();
+SampleCrop makeSampleCrop(const SampleJob &job);
+void applyContext(ColorSet *colors, ColorStat spotAverage);
+ColorStat contextAverage(const ContextFrame &frame, RECT rect);
+void makePaletteKey(const SampleJob &job, PaletteKey *key);
+void makeContentKey(const PaletteKey &key, uint64_t hash, PaletteKey *contentKey);
+void makeIconKey(const PaletteKey &key, bool shell, uint64_t identity, PaletteKey *iconKey);
+void loadPaletteCache();
+void savePaletteCache();
+PLUGIN_EXPORT void Initialize(void* *data, void *rm);
+PLUGIN_EXPORT void Reload(void *data, void *rm, double *maxVal);
+PLUGIN_EXPORT double Update(void *data);
+PLUGIN_EXPORT LPCWSTR GetString(void *data);
+PLUGIN_EXPORT void Finalize(void *data);
+
+bool IsWindows11_24H2OrGreater();
+
+// Does all the heavy lifting off of Rainmeter's thread.
+// Only exists while there are containers around to use it.
+Worker *worker = nullptr;
+size_t containerCount = 0;
+
+// Palettes for files we've already sampled, and where they get saved
+PaletteCache paletteCache;
+std::wstring paletteCachePath;
+
+// The same, but by what was in the file rather than where it was and
+// when it was written. Only for this session.
+PaletteCache contentCache(64);
+
+// And again by which icon a file has, for files that only have their icon
+// to go on. A folder full of .txt files all share the one. Only for this
+// session too, the shell's icon indexes don't mean anything to the next.
+PaletteCache iconCache(256);
+
+// Images we've decoded for skins that crop them, in case the crop changes
+// before the file does
+FrameCache frameCache;
+
+// Files the worker couldn't open, and when to try them again
+RetryBackoff retryBackoff;
+
+// Files stb couldn't read, so they go straight to their icons
+DecodeRoutes decodeRoutes;
+
+// What every container with a file to sample is subscribed to
+SampleRegistry sampleRegistry;
+
+// Watches the directories of every file being sampled.
+// Lives as long as the worker does.
+ChangeNotifier *changeNotifier = nullptr;
+
+// The wallpaper on every monitor, shared by all the desktop containers.
+// Lives as long as the worker does.
+WallpaperCache *wallpapers = nullptr;
+
+// Figures out whether the image needs sampling again, and if so hands it
+// off to the worker. The children keep getting the old colors until the
+// worker publishes the new ones.
+void SampleImage(std::shared_ptr<Image> img)
+{
+	RECT skinRect = { 0 };
+	RECT monitorRect = { 0 };
+	bool customContext = img->contextRect.left || img->contextRect.right || img->contextRect.top || img->contextRect.bottom;
+
+	// If we're sampling the desktop, grab that
+	if (img->type == IMG_DESKTOP)
+	{
+		// Get the actual area the skin is in, so we know which monitor it's on
+		GetWindowRect(img->hWnd, &skinRect);
+
+		StageTimer wallpaperTimer(STAGE_WALLPAPER);
+
+		// Only actually asks Windows if the wallpapers or monitors changed
+		// since last time
+		wallpapers->update();
+
+		const MonitorWallpaper *monitor = wallpapers->monitorFor(skinRect.left, skinRect.top, skinRect.right, skinRect.bottom);
+		if (monitor == nullptr)
+		{
+			// We couldn't get the wallpaper info. Just use the fallback colors
+			useDefaultColors(img);
+
+			img->dirty = false;
+
+			return;
+		}
+
+		monitorRect.left = monitor->left;
+		monitorRect.top = monitor->top;
+		monitorRect.right = monitor->right;
+		monitorRect.bottom = monitor->bottom;
+
+		const std::wstring &path = monitor->path;
+
+		wallpaperTimer.stop();
+
+		// First, is the current path the same as the new path
+		if (img->path.compare(path) != 0)
+		{
+			// It's different, mark it dirty!
+			img->path = path;
+			img->dirty = true;
+		}
+
+		// Mark the skin as dragging until there is no movement
+		if (img->skinX != skinRect.left || img->skinY != skinRect.top)
+		{
+			img->skinX = skinRect.left;
+			img->skinY = skinRect.top;
+			img->draggingSkin = true;
+		}
+		// Don't update by dragging if we're using a custom context area
+		// or if we're just not using context-aware colors
+		else if (img->contextAware && img->draggingSkin && !customContext)
+		{
+			// Only the area under the skin changed, not the image
+			img->draggingSkin = false;
+			img->contextDirty = true;
+		}
+
+		if (!EqualRect(&img->contextRect, &img->cachedContext))
+		{
+			img->cachedContext = img->contextRect;
+			img->contextDirty = true;
+		}
+	}
+
+	// Determine if the skin's cropping area has changed
+	if (img->customCrop && !EqualRect(&img->cropRect, &img->cachedCrop))
+	{
+		img->cachedCrop = img->cropRect;
+		img->dirty = true;
+	}
+
+	// Let's check the path
+	if (img->path.empty())
+	{
+		// Empty path! Let's dump some default values and be done with it...
+		useDefaultColors(img);
+
+		img->dirty = false;
+
+		return;
+	}
+
+	// Keep an eye on the file so we only go looking at it when something
+	// next to it changed, rather than opening it on every update
+	if (img->watchedPath.compare(img->path) != 0)
+	{
+		if (!img->watchedPath.empty())
+		{
+			changeNotifier->unsubscribe(img->watchedPath);
+		}
+
+		changeNotifier->subscribe(img->path);
+		img->watchedPath = img->path;
+		img->watchSeen = 0;
+	}
+
+	changeNotifier->update();
+
+	// Now the "file modified" time
+	if (changeNotifier->changed(img->path, &img->watchSeen) || img->dirty)
+	{
+		StageTimer fileInfoTimer(STAGE_FILE_INFO);
+		HANDLE file = CreateFileW(img->path.c_str(), 0, FILE_SHARE_DELETE | FILE_SHARE_WRITE | FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			// Couldn't get the last accessed time for the file.
+			std::wstring debug = L"Chameleon: Could not get handle on ";
+			debug += img->path;
+			RmLog(LOG_ERROR, debug.c_str());
+
+			useDefaultColors(img);
+
+			// Make sure it gets sampled when it turns up again, even if
+			// it comes back with the same time
+			img->lastMod.dwHighDateTime = img->lastMod.dwLowDateTime = 0;
+			img->dirty = false;
+
+			return;
+		}
+
+		FILETIME ft;
+		LARGE_INTEGER fileSize = { 0 };
+		GetFileTime(file, NULL, NULL, &ft);
+		GetFileSizeEx(file, &fileSize);
+		CloseHandle(file);
+		fileInfoTimer.stop();
+
+		if (ft.dwHighDateTime != img->lastMod.dwHighDateTime || ft.dwLowDateTime != img->lastMod.dwLowDateTime)
+		{
+			// Different modification times...
+			img->lastMod.dwHighDateTime = ft.dwHighDateTime;
+			img->lastMod.dwLowDateTime = ft.dwLowDateTime;
+			img->dirty = true;
+		}
+
+		img->fileSize = fileSize.QuadPart;
+	}
+
+	// The worker couldn't get at the file last time, so give it another go
+	// once it's waited long enough (only one of the containers sharing a
+	// sample needs to notice). Whatever has it locked could have it for a
+	// while, and there's no point trying again on every single update.
+	bool retryShared = false;
+	if (img->shared != nullptr && img->shared->retry)
+	{
+		if (retryBackoff.ready(img->path))
+		{
+			retryShared = img->shared->retry.exchange(false);
+		}
+		else
+		{
+			countEvent(COUNTER_RETRY_BACKOFFS);
+		}
+	}
+
+	if (retryShared)
+	{
+		countEvent(COUNTER_RETRIES);
+		img->dirty = true;
+	}
+
+	if (img->dirty)
+	{
+		std::wstring debug = L"Chameleon: Updating colors based on ";
+		debug += img->path;
+		RmLog(LOG_DEBUG, debug.c_str());
+
+		// Snapshot everything the worker needs
+		SampleJob job;
+		job.type = img->type;
+		job.path = img->path;
+		job.is24H2 = IsWindows11_24H2OrGreater();
+		job.captureDesktop = img->type == IMG_DESKTOP && !job.is24H2;
+		job.forceIcon = img->forceIcon;
+		job.sampleMode = img->sampleMode;
+		job.sampleBudget = img->sampleBudget;
+		job.frameBudget = img->frameBudget;
+		job.gridColumns = img->gridColumns;
+		job.gridRows = img->gridRows;
+		job.customCrop = img->customCrop;
+		job.cropRect = img->cropRect;
+		job.contextAware = img->contextAware;
+		job.monitor = monitorRect;
+		job.modified = ((uint64_t)img->lastMod.dwHighDateTime << 32) | img->lastMod.dwLowDateTime;
+		job.size = img->fileSize;
+
+		PaletteKey key;
+		makePaletteKey(job, &key);
+
+		// Anyone else already sampling the same thing?
+		bool created;
+		std::shared_ptr<SharedSample> shared = sampleRegistry.subscribe(key, &created);
+
+		if (created || retryShared)
+		{
+			queueSharedSample(shared, job);
+		}
+
+		if (!created && shared != img->shared)
+		{
+			countEvent(COUNTER_SHARED_HITS);
+		}
+
+		img->shared = shared;
+
+		// Make sure we pick up whatever it has, even if it's the
+		// same sample as before
+		img->sharedGeneration = 0;
+
+		img->dirty = false;
+	}
+
+	if (img->shared != nullptr)
+	{
+		// Pick up new results from the shared sample
+		uint64_t generation = img->shared->generation;
+		if (generation != img->sharedGeneration || img->contextDirty)
+		{
+			img->sharedGeneration = generation;
+			img->contextDirty = false;
+
+			std::shared_ptr<const ColorSet> palette = std::atomic_load(&img->shared->palette);
+
+			// The cells don't depend on where the skin is, so they go
+			// straight through
+			std::atomic_store(&img->grid, std::atomic_load(&img->shared->grid));
+
+			if (palette == nullptr)
+			{
+				std::atomic_store(&img->colors, std::shared_ptr<const ColorSet>(std::make_shared<ColorSet>(fallbackColors(img))));
+			}
+			else
+			{
+				ColorSet colors = *palette;
+
+				if (img->type == IMG_DESKTOP && img->contextAware)
+				{
+					// Files (24H2) never have anything to go on for the area under
+					// the skin, but the colors still get shuffled the same way they
+					// always have
+					StageTimer contextTimer(STAGE_CONTEXT);
+					ColorStat spotAverage = { 0 };
+
+					std::shared_ptr<const ContextFrame> context = std::atomic_load(&img->shared->context);
+					if (context != nullptr)
+					{
+						spotAverage = contextAverage(*context, customContext ? img->contextRect : skinRect);
+					}
+
+					applyContext(&colors, spotAverage);
+				}
+
+				std::atomic_store(&img->colors, std::shared_ptr<const ColorSet>(std::make_shared<ColorSet>(colors)));
+			}
+		}
+	}
+}
+
+// Samples something for everyone subscribed to it. They each pick up the
+// results on their next update.
+void queueSharedSample(std::shared_ptr<SharedSample> shared, const SampleJob &job)
+{
+	// Only hang on to it weakly, if everyone unsubscribes before we get
+	// to it there's no point doing the work
+	std::weak_ptr<SharedSample> weakShared = shared;
+
+	worker->enqueue(shared.get(), [weakShared, job]()
+	{
+		std::shared_ptr<SharedSample> shared = weakShared.lock();
+		if (shared == nullptr)
+		{
+			return;
+		}
+
+		StageTimer sampleTimer(STAGE_SAMPLE);
+
+		ColorSet palette;
+		std::shared_ptr<const ContextFrame> context;
+		std::shared_ptr<const GridColors> grid;
+
+		switch (ProcessSample(job, &palette, &context, &grid))
+		{
+		case SAMPLE_DONE:
+			retryBackoff.succeeded(job.path);
+			shared->publish(std::make_shared<ColorSet>(palette), context, grid);
+			break;
+		case SAMPLE_FALLBACK:
+			retryBackoff.succeeded(job.path);
+			shared->publish(nullptr, nullptr);
+			break;
+		case SAMPLE_RETRY:
+			retryBackoff.failed(job.path);
+			shared->retry = true;
+			break;
+		case SAMPLE_SKIPPED:
+			break;
+		}
+
+		sampleTimer.stop();
+
+		sampleFinished();
+	});
+}
+
+// Runs on the worker after every sample
+void sampleFinished()
+{
+	// Save any new palettes once we've caught up
+	if (worker->pending() == 1)
+	{
+		savePaletteCache();
+
+		// Only shows up when Rainmeter's debug logging is on
+		for (int i = 0; i < STAGE_MAX; ++i)
+		{
+			std::wstring line = describeStage((Stage)i);
+			if (!line.empty())
+			{
+				line.insert(0, L"Chameleon: ");
+				RmLog(LOG_DEBUG, line.c_str());
+			}
+		}
+	}
+}
+
+// Decodes, crops, resizes and runs the image through Chameleon.
+// This runs on the worker thread so it can't touch the Image at all,
+// only the snapshot in the job.
+//
+// colors gets the palette as Chameleon picked it. When capturing the
+// desktop for context aware colors, context gets the whole capture for
+// the containers to find the area under their skins in. With a Grid, grid
+// gets the colors of each cell.
+SampleResult ProcessSample(const SampleJob &job, ColorSet *colors, std::shared_ptr<const ContextFrame> *context, std::shared_ptr<const GridColors> *grid)
+{
+	bool isIcon = false;
+	SampleCrop crop = makeSampleCrop(job);
+
+	int w, h;
+	int fullW = 0, fullH = 0;
+	int decodeScale = 0;
+	uint32_t *imgData = nullptr;
+
+	// Screen captures don't go in the palette cache, the file on disk isn't
+	// necessarily what's on screen. Neither do grids, the cache only has
+	// room for the one palette.
+	PaletteKey cacheKey;
+	bool cacheable = !job.captureDesktop && job.gridColumns == 0;
+	makePaletteKey(job, &cacheKey);
+
+	// Set once we know what's in the file
+	PaletteKey contentKey;
+	bool hashed = false;
+
+	// Set once we know which icon the file has, when that's all we've got
+	PaletteKey iconKey;
+	bool iconKeyed = false;
+
+	// The decoded image, when it's being kept around for the next crop
+	// (or came from the last one). Owns the pixels, imgData doesn't.
+	std::shared_ptr<const DecodedFrame> frame;
+	bool keepFrame = !job.captureDesktop && job.customCrop && job.frameBudget > 0;
+
+	// Whether stb has already had a go at this exact file and failed
+	DecodeRoute route = DECODE_IMAGE;
+
+	// If we're reading from the desktop, read from Windows, not the file
+	// Unless we're in Win11 24H2 because MS did something stupid and broke it
+	if (job.captureDesktop)
+	{
+		// Get the Real Device Context, then get a non-live copy to read from
+		HWND hwDesktop = GetShellWindow();
+
+		HDC hdcDesktop = GetDC(hwDesktop);
+		HDC hdc = CreateCompatibleDC(hdcDesktop);
+
+		// Get the upper left reference point for the virtual screen
+		// which might not be (0,0) due to monitor arrangement
+		int xRef = GetSystemMetrics(SM_XVIRTUALSCREEN);
+		int yRef = GetSystemMetrics(SM_YVIRTUALSCREEN);
+
+		// Set up the default monitor-based cropping
+		int imgW = crop.monitorW;
+		int imgH = crop.monitorH;
+
+		// This is meant to shift the virtual screen coords to image space coords.
+		int imgX = job.monitor.left - xRef;
+		int imgY = job.monitor.top - yRef;
+
+		if (job.customCrop)
+		{
+			// There's a custom cropping rectangle, so we can just grab the whole screen
+			// (the cropping code will handle it automatically later)
+			imgX = 0;
+			imgY = 0;
+			imgW = GetSystemMetrics(SM_CXVIRTUALSCREEN);
+			imgH = GetSystemMetrics(SM_CYVIRTUALSCREEN);
+			
+			// Adjust the cropping rectangle
+			crop.left -= xRef;
+			crop.right -= xRef;
+			crop.top -= yRef;
+			crop.bottom -= yRef;
+		}
+
+		StageTimer captureTimer(STAGE_CAPTURE);
+
+		// Create the bitmap we're going to bounce the image data into, and the immediately out of
+		// because it's in a device-specific format
+		// (maybe 6-bit, maybe 8-bit, maybe 10-bit, rgb, bgrx, rgbx, who knows!)
+		HBITMAP hBmp = CreateCompatibleBitmap(hdcDesktop, imgW, imgH);
+
+		// do the actual copy, but save the default hbmp windows set up that we can't exactly use for this
+		// so we can let windows clean that up later
+		HBITMAP hOldBmp = (HBITMAP)SelectObject(hdc, hBmp);
+
+		BitBlt(hdc, 0, 0, imgW, imgH, hdcDesktop, imgX, imgY, SRCCOPY);
+
+		// Windows doesn't like having the handle selected when we want to read from it,
+		// so now we put the old handle back 
+		SelectObject(hdc, hOldBmp);
+
+		// Now we have the data in a device specific buffer that Windows won't touch while we're using it
+		// so let's convert that to a format we can actually use
+
+		LPBITMAPINFO bmpInfo = (LPBITMAPINFO)malloc(sizeof(BITMAPINFOHEADER) + 256 * sizeof(RGBQUAD));
+		ZeroMemory(&bmpInfo->bmiHeader, sizeof(BITMAPINFOHEADER));
+		bmpInfo->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+
+		// Get what Windows wants us to allocate, and do so
+		GetDIBits(hdc, hBmp, 0, imgH, NULL, bmpInfo, DIB_RGB_COLORS);
+		uint8_t *byteData = (uint8_t*)poolAlloc(bmpInfo->bmiHeader.biSizeImage);
+
+		// Now do the actual copy
+		GetDIBits(hdc, hBmp, 0, imgH, byteData, bmpInfo, DIB_RGB_COLORS);
+
+		w = bmpInfo->bmiHeader.biWidth;
+		h = bmpInfo->bmiHeader.biHeight;
+
+		// Windows uses a negative value to specify the bitmap is right side up
+		// if it's not, we need to adjust the cropping, if any
+		if (h < 0)
+			h = -h;
+		else if(job.customCrop)
+		{
+			int bottom = crop.bottom;
+			crop.bottom = imgH - crop.top;
+			crop.top = imgH - bottom;
+		}
+
+		// We're going to be doing this by bytes so it'll be easier
+		imgData = (uint32_t*) createImage(w, h);
+		bool converted = true;
+		
+		// At this point, we have the color data but probably not in the layout we are expecting...
+		// (i.e. BGRX instead of RGBX)
+		// We need to figure out what it *is* so we can convert it to what we *want*
+		// It should be one of 3 possibilities: 16, 24, or 32-bit
+		// Of those, 16 and 32-bit can be either BI_RGB or BI_BITFIELDS
+		// If they are BI_BITFIELDS we need to use the info in bmpInfo->bmiColors[0,1,2]
+		// to decode where the R, G. and B bits actually are.
+		
+		// BI_RGB is always the standard layout for its size, BI_BITFIELDS tells us where
+		// everything is. Either way it's just a set of masks, and copyView takes
+		// it from there.
+		PixelFormat format;
+		format.bytesPerPixel = bmpInfo->bmiHeader.biBitCount / 8;
+
+		if (bmpInfo->bmiHeader.biCompression == BI_BITFIELDS)
+		{
+			// Could be R5G5B5, X8R8G8B8, R5G6B5, or anything really.
+			format.rMask = ((uint32_t*)bmpInfo->bmiColors)[0];
+			format.gMask = ((uint32_t*)bmpInfo->bmiColors)[1];
+			format.bMask = ((uint32_t*)bmpInfo->bmiColors)[2];
+		}
+		else if (format.bytesPerPixel == 2)
+		{
+			// Standard R5G5B5
+			format.rMask = 0x00007C00;
+			format.gMask = 0x000003E0;
+			format.bMask = 0x0000001F;
+		}
+		else
+		{
+			// Plain old BGR(X)
+			format.rMask = 0x00FF0000;
+			format.gMask = 0x0000FF00;
+			format.bMask = 0x000000FF;
+		}
+
+		// Each row is padded out to a multiple of 4 bytes
+		ptrdiff_t stride = ((w * bmpInfo->bmiHeader.biBitCount + 31) / 32) * 4;
+
+		if (!copyView(makeView(byteData, w, h, stride, format), imgData))
+		{
+			// Palettized or something equally unlikely for a desktop
+			RmLog(LOG_ERROR, L"Chameleon: Unsupported desktop pixel format!");
+			converted = false;
+		}
+
+		if (job.contextAware && converted)
+		{
+			// Rather than averaging the area under the skin here, keep a summed-area
+			// table of the whole capture. Every skin on it can then find its average
+			// with a few lookups, even after being dragged somewhere else.
+			*context = std::make_shared<ContextFrame>(makeView(imgData, w, h), imgX + xRef, imgY + yRef, bmpInfo->bmiHeader.biHeight > 0);
+		}
+
+		captureTimer.stop();
+
+		DeleteObject(hBmp);
+		DeleteDC(hdc);
+		ReleaseDC(hwDesktop, hdcDesktop);
+		free(bmpInfo);
+		poolFree(byteData);
+
+		if (!converted)
+		{
+			stbi_image_free(imgData);
+			return SAMPLE_FALLBACK;
+		}
+	}
+	else
+	{
+		// Same file, crop and settings as something we've already sampled?
+		// Then there's no need to decode anything.
+		if (cacheable)
+		{
+			if (paletteCache.find(cacheKey, colors))
+			{
+				countEvent(COUNTER_CACHE_HITS);
+
+				return SAMPLE_DONE;
+			}
+
+			countEvent(COUNTER_CACHE_MISSES);
+		}
+
+		// Only the crop changed since we last decoded the file? Then it can
+		// just be cropped again, as long as it wasn't decoded too small for
+		// the new crop.
+		if (keepFrame)
+		{
+			frame = frameCache.find(job.path, job.modified, job.size);
+
+			if (frame != nullptr && !frame->isIcon)
+			{
+				int region[4];
+				cropRegion(crop, frame->fullW, frame->fullH, region);
+
+				if (frame->decodeScale > pickDecodeScale(frame->fullW, frame->fullH, region[0], region[1], region[2], region[3], SAMPLE_MAX_DIMENSION))
+				{
+					frame = nullptr;
+				}
+			}
+
+			countEvent(frame != nullptr ? COUNTER_FRAME_HITS : COUNTER_FRAME_MISSES);
+		}
+
+		if (frame == nullptr)
+		{
+			route = decodeRoutes.find(job.path, job.modified, job.size);
+
+			if (route != DECODE_IMAGE)
+			{
+				countEvent(COUNTER_DECODE_ROUTE_HITS);
+			}
+
+			// We already know there's nothing here we can use
+			if (route == DECODE_NOTHING)
+			{
+				return SAMPLE_FALLBACK;
+			}
+		}
+	}
+
+	if (frame != nullptr)
+	{
+		w = frame->w;
+		h = frame->h;
+		decodeScale = frame->decodeScale;
+		isIcon = frame->isIcon;
+	}
+	else if (!job.captureDesktop)
+	{
+		// Map the whole file in rather than going through stdio. Hashing and
+		// decoding then both read it straight out of the page cache, with no
+		// copying it around a few KB at a time.
+		StageTimer decodeTimer(STAGE_DECODE);
+		MappedFile file;
+
+		// Something goofed, but we can try again. Unless all we're after is
+		// the icon, which the shell can still get for us.
+		if (!file.open(job.path) && route == DECODE_IMAGE)
+		{
+			return SAMPLE_RETRY;
+		}
+
+		// What the first few bytes say it is. Images go straight to the one
+		// decoder that reads them, rather than stb asking each decoder in
+		// turn, and things stb can't read at all go straight to their icon
+		// without the whole file being hashed first.
+		ImageFormat format = sniffFormat(file.data(), file.size());
+		bool readable = route == DECODE_IMAGE && stbCanRead(format);
+
+		if (!readable)
+		{
+			// .ico files and programs with icons of their own can be read
+			// straight out of the file, anything else needs the shell
+			if (format == FORMAT_ICO || format == FORMAT_EXECUTABLE)
+			{
+				// Anything with the same icons in it (copies of the same
+				// program, say) samples the same, so there's no need to
+				// decode them again
+				uint64_t hash;
+				StageTimer hashTimer(STAGE_HASH, &decodeTimer);
+				bool hasIcon = cacheable && hashIcon(file.data(), file.size(), &hash);
+				hashTimer.stop();
+
+				if (hasIcon)
+				{
+					makeIconKey(cacheKey, false, hash, &iconKey);
+					iconKeyed = true;
+
+					if (iconCache.find(iconKey, colors))
+					{
+						countEvent(COUNTER_ICON_HITS);
+
+						paletteCache.insert(cacheKey, *colors);
+
+						return SAMPLE_DONE;
+					}
+
+					countEvent(COUNTER_ICON_MISSES);
+				}
+
+				imgData = decodeIcon(file.data(), file.size(), &w, &h);
+			}
+
+			std::wstring debug = imgData != nullptr ? L"Chameleon: Read the icon out of " : L"Chameleon: Using the icon for ";
+			debug += formatName(format);
+			debug += L" file ";
+			debug += job.path;
+			RmLog(LOG_DEBUG, debug.c_str());
+
+			if (imgData != nullptr)
+			{
+				isIcon = true;
+				fullW = w;
+				fullH = h;
+
+				decodeRoutes.insert(job.path, job.modified, job.size, DECODE_ICON);
+			}
+
+			route = DECODE_ICON;
+		}
+
+		// Album art players love rewriting the same cover, or just touching
+		// it. If what's in the file is something we've already sampled,
+		// there's no need to decode it.
+		if (cacheable && readable)
+		{
+			StageTimer hashTimer(STAGE_HASH, &decodeTimer);
+			uint64_t hash = hashContent(file.data(), file.size());
+			hashTimer.stop();
+
+			hashed = true;
+			makeContentKey(cacheKey, hash, &contentKey);
+
+			if (contentCache.find(contentKey, colors))
+			{
+				countEvent(COUNTER_CONTENT_HITS);
+
+				paletteCache.insert(cacheKey, *colors);
+
+				return SAMPLE_DONE;
+			}
+
+			countEvent(COUNTER_CONTENT_MISSES);
+		}
+
+		// Load image data, no bigger than the crop needs
+		if (readable)
+		{
+			imgData = decodeImage(file.data(), file.size(), format, crop, &w, &h, &fullW, &fullH, &decodeScale);
+		}
+
+		file.close();
+		decodeTimer.stop();
+	}
+
+	if (imgData == nullptr && frame == nullptr)
+	{
+		// Only worth mentioning the first time
+		if (route == DECODE_IMAGE)
+		{
+			RmLog(LOG_ERROR, L"Chameleon: Could not load file!");
+		}
+
+		StageTimer iconTimer(STAGE_DECODE);
+		int index = iconIndex(job.path.c_str());
+
+		// Every file the shell gives the same icon to samples the same
+		bool found = false;
+		if (cacheable && index >= 0)
+		{
+			makeIconKey(cacheKey, true, (uint64_t)index, &iconKey);
+			iconKeyed = true;
+
+			found = iconCache.find(iconKey, colors);
+			countEvent(found ? COUNTER_ICON_HITS : COUNTER_ICON_MISSES);
+		}
+
+		if (!found)
+		{
+			imgData = loadIcon(index, &w, &h);
+		}
+
+		iconTimer.stop();
+
+		// Next time this file comes up (a new crop, say) it can skip
+		// straight here, or past here altogether
+		if (!job.captureDesktop)
+		{
+			decodeRoutes.insert(job.path, job.modified, job.size, imgData != nullptr || found ? DECODE_ICON : DECODE_NOTHING);
+		}
+
+		if (found)
+		{
+			paletteCache.insert(cacheKey, *colors);
+
+			return SAMPLE_DONE;
+		}
+
+		if (imgData == nullptr)
+		{
+			// It's something we don't actually know how to handle, so let's not.
+			return SAMPLE_FALLBACK;
+		}
+
+		isIcon = true;
+		fullW = w;
+		fullH = h;
+	}
+
+	// Hang on to what we just decoded in case the crop changes next, if
+	// it isn't too big to (smaller copies and all)
+	if (keepFrame && frame == nullptr && DecodedFrame::bytesFor(w, h) <= job.frameBudget)
+	{
+		frame = std::make_shared<DecodedFrame>(imgData, w, h, fullW, fullH, decodeScale, isIcon);
+		imgData = nullptr;
+
+		frameCache.insert(job.path, job.modified, job.size, frame);
+	}
+
+	isIcon |= job.forceIcon;
+
+	// Everything from here on looks at the image through a view, so
+	// cropping is just moving a pointer around rather than copying
+	ImageView image = frame != nullptr ? makeView(frame->pixels, w, h) : makeView(imgData, w, h);
+	const MipPyramid *pyramid = frame != nullptr ? &frame->pyramid : nullptr;
+
+	//  Crop image as requested
+	bool outOfBounds;
+	ImageView view = cropDecoded(image, pyramid, decodeScale, crop, &outOfBounds);
+
+	if (outOfBounds)
+	{
+		RmLog(LOG_ERROR, L"Chameleon: Cropping out of bounds of image! Check your parameters.");
+	}
+
+	// Quick Sanity Check
+	if (view.w <= 0 || view.h <= 0)
+	{
+		// I debated having a crop size of 0 being an error, but some skins might
+		// need to set it to that as a kind of "don't do anything" or maybe through a
+		// procedural generation of the crop bounds so we'll just skip doing anything.
+		
+//		RmLog(LOG_ERROR, L"Chameleon: Width or height is less than or equal to zero!");
+//		useDefaultColors(img);
+
+		stbi_image_free(imgData);
+
+		return SAMPLE_SKIPPED;
+	}
+
+	// Shrink it down and let Chameleon pick the colors (and work out the
+	// cells while the image is small)
+	std::shared_ptr<GridColors> cells;
+	if (job.gridColumns > 0)
+	{
+		cells = std::make_shared<GridColors>();
+		cells->columns = job.gridColumns;
+		cells->rows = job.gridRows;
+	}
+
+	analyzeView(view, isIcon, colors, job.sampleMode, job.sampleBudget, cells.get());
+	*grid = cells;
+
+	// Remember what Chameleon picked
+	if (cacheable)
+	{
+		paletteCache.insert(cacheKey, *colors);
+	}
+
+	if (hashed)
+	{
+		contentCache.insert(contentKey, *colors);
+	}
+
+	if (iconKeyed)
+	{
+		iconCache.insert(iconKey, *colors);
+	}
+
+	stbi_image_free(imgData);
+
+	return SAMPLE_DONE;
+}
+
+// Shuffle the backgrounds/foregrounds so the background is the color
+// closest to what's actually under the skin
+void applyContext(ColorSet *colors, ColorStat spotAverage)
+{
+	// Find which value is closest to the average value for the skin
+	ColorStat bg1 = { 0 };
+	ColorStat bg2 = { 0 };
+	ColorStat fg1 = { 0 };
+	ColorStat fg2 = { 0 };
+
+	processRGB(_byteswap_ulong(colors->bg1), &bg1);
+	calcYUV(&bg1, 1);
+	processRGB(_byteswap_ulong(colors->bg2), &bg2);
+	calcYUV(&bg2, 1);
+	processRGB(_byteswap_ulong(colors->fg1), &fg1);
+	calcYUV(&fg1, 1);
+	processRGB(_byteswap_ulong(colors->fg2), &fg2);
+	calcYUV(&fg2, 1);
+
+	float bg1Dist = distance(&spotAverage, &bg1);
+	float bg2Dist = distance(&spotAverage, &bg2);
+	float fg1Dist = distance(&spotAverage, &fg1);
+	float fg2Dist = distance(&spotAverage, &fg2);
+
+	uint32_t sbg1 = colors->bg1;
+	uint32_t sbg2 = colors->bg2;
+	uint32_t sfg1 = colors->fg1;
+	uint32_t sfg2 = colors->fg2;
+	// Set the background/foreground based on that
+	if ((bg2Dist < bg1Dist) && (bg2Dist < fg1Dist) && (bg2Dist < fg2Dist))
+	{
+		// BG2 is the closest match for the background under the skin, use that instead
+		
+		colors->bg1 = sbg2;
+		colors->bg2 = sbg1;
+	}
+	else if ((fg1Dist < bg1Dist) && (fg1Dist < fg2Dist))
+	{
+		// FG1 is the closest match, swap the FG and BG
+		colors->bg1 = sfg1;
+		colors->bg2 = sfg2;
+		colors->fg1 = sbg1;
+		colors->fg2 = sbg2;
+	}
+	else if (fg2Dist < bg1Dist)
+	{
+		// FG2 is the closest match
+		colors->bg1 = sfg2;
+		colors->bg2 = sfg1;
+		colors->fg1 = sbg1;
+		colors->fg2 = sbg2;
+	}
+}
+
+// Average color of the part of a captured frame under rect, which is
+// in desktop coordinates
+ColorStat contextAverage(const ContextFrame &frame, RECT rect)
+{
+	int h = frame.table.height();
+
+	rect.left -= frame.left;
+	rect.right -= frame.left;
+	rect.top -= frame.top;
+	rect.bottom -= frame.top;
+
+	if (frame.flipped)
+	{
+		// Oh, we're vertically flipped.
+		// Gotta "flip" the rect to match (actually just shifting it)
+		LONG bottom = rect.bottom;
+		rect.bottom = h - rect.top;
+		rect.top = h - bottom;
+	}
+
+	uint64_t totals[3];
+	uint64_t count = frame.table.sum(rect.left, rect.top, rect.right, rect.bottom, totals);
+
+	if (count == 0)
+	{
+		// Not over the capture at all, just go with the whole thing
+		count = frame.table.sum(0, 0, frame.table.width(), h, totals);
+	}
+
+	// Same as running every pixel through processRGB, just without the pixels
+	ColorStat average = { 0 };
+	average.rgbc = _mm_set_ps((float)count, (float)(totals[2] / 255.0), (float)(totals[1] / 255.0), (float)(totals[0] / 255.0));
+
+	fixRGB(&average, (float)count);
+	calcYUV(&average, 1);
+
+	return average;
+}
+
+// Builds the key that identifies a sample, for both sharing it and caching it
+void makePaletteKey(const SampleJob &job, PaletteKey *key)
+{
+	key->path = job.path;
+	key->modified = job.modified;
+	key->size = job.size;
+	key->forceIcon = job.forceIcon;
+	key->sampleMode = (uint8_t)job.sampleMode;
+	key->sampleBudget = job.sampleMode == SAMPLE_MODE_STRATIFIED ? job.sampleBudget : 0;
+	key->grid[0] = (uint8_t)job.gridColumns;
+	key->grid[1] = (uint8_t)job.gridRows;
+	key->capture = job.captureDesktop;
+	key->keepContext = job.captureDesktop && job.contextAware;
+
+	memset(key->crop, 0, sizeof(key->crop));
+	memset(key->monitor, 0, sizeof(key->monitor));
+
+	if (job.customCrop)
+	{
+		key->crop[0] = job.cropRect.left;
+		key->crop[1] = job.cropRect.top;
+		key->crop[2] = job.cropRect.right;
+		key->crop[3] = job.cropRect.bottom;
+
+	}
+
+	// Captures are of the monitor, and 24H2 maps the crop onto the
+	// wallpaper based on the monitor
+	if (job.captureDesktop || (job.customCrop && job.type == IMG_DESKTOP && job.is24H2))
+	{
+		key->monitor[0] = job.monitor.left;
+		key->monitor[1] = job.monitor.top;
+		key->monitor[2] = job.monitor.right;
+		key->monitor[3] = job.monitor.bottom;
+	}
+}
+
+// Same settings, but the file is identified by its contents instead of
+// its path and modified time
+void makeContentKey(const PaletteKey &key, uint64_t hash, PaletteKey *contentKey)
+{
+	*contentKey = key;
+	contentKey->path = L"#";
+	contentKey->modified = 0;
+
+	for (int shift = 60; shift >= 0; shift -= 4)
+	{
+		contentKey->path += whex[(hash >> shift) & 0xF];
+	}
+}
+
+// Same settings again, but the file is identified by its icon: where it is
+// in the shell's image list, or a hash of the icons in it when we read them
+// ourselves
+void makeIconKey(const PaletteKey &key, bool shell, uint64_t identity, PaletteKey *iconKey)
+{
+	makeContentKey(key, identity, iconKey);
+	iconKey->path[0] = shell ? L'!' : L'*';
+	iconKey->size = 0;
+
+	// Icons always get sampled as icons
+	iconKey->forceIcon = false;
+}
+
+// The cache lives next to Rainmeter.ini
+void loadPaletteCache()
+{
+	paletteCachePath = RmGetSettingsFile();
+	paletteCachePath.erase(paletteCachePath.find_last_of(L"\\/") + 1);
+	paletteCachePath += L"Chameleon.cache";
+
+	FILE *fp;
+	if (_wfopen_s(&fp, paletteCachePath.c_str(), L"rb") == 0)
+	{
+		if (!paletteCache.load(fp))
+		{
+			RmLog(LOG_DEBUG, L"Chameleon: Palette cache is from another version, starting over");
+		}
+
+		fclose(fp);
+	}
+}
+
+void savePaletteCache()
+{
+	if (paletteCachePath.empty() || !paletteCache.changed())
+	{
+		return;
+	}
+
+	// Write it out to the side first so a crash halfway through
+	// doesn't leave us with half a cache
+	std::wstring tempPath = paletteCachePath + L".tmp";
+
+	FILE *fp;
+	if (_wfopen_s(&fp, tempPath.c_str(), L"wb") != 0)
+	{
+		return;
+	}
+
+	bool saved = paletteCache.save(fp);
+	saved = (fclose(fp) == 0) && saved;
+
+	if (saved)
+	{
+		MoveFileExW(tempPath.c_str(), paletteCachePath.c_str(), MOVEFILE_REPLACE_EXISTING);
+	}
+	else
+	{
+		DeleteFileW(tempPath.c_str());
+	}
+}
+
+// The crop as Sampler wants it. 24H2 desktops sample the wallpaper file,
+// which the crop gets mapped onto by way of the monitor it's on.
+SampleCrop makeSampleCrop(const SampleJob &job)
+{
+	SampleCrop crop;
+
+	crop.custom = job.customCrop;
+	crop.left = job.cropRect.left;
+	crop.top = job.cropRect.top;
+	crop.right = job.cropRect.right;
+	crop.bottom = job.cropRect.bottom;
+
+	crop.onWallpaper = job.type == IMG_DESKTOP && job.is24H2;
+	crop.monitorLeft = job.monitor.left;
+	crop.monitorTop = job.monitor.top;
+	crop.monitorW = job.monitor.right - job.monitor.left;
+	crop.monitorH = job.monitor.bottom - job.monitor.top;
+
+	return crop;
+}
+
+// Prepares the measure for Rainmeter to use
+PLUGIN_EXPORT void Initialize(void* *data, void *rm)
+{
+	Measure* measure = new Measure;
+	measure->type = MEASURE_CONTAINER;
+	measure->parent = nullptr;
+	measure->ownsImage = false;
+	*data = measure;
+}
+
+// Sets the initial state for the measure
+PLUGIN_EXPORT void Reload(void *data, void *rm, double *maxVal)
+{
+	Measure *measure = static_cast<Measure*>(data);
+
+	void *skin = RmGetSkin(rm);
+
+	std::wstring parent = RmReadString(rm, L"Parent", L"");
+
+	if (parent.empty())
+	{
+		std::wstring type = RmReadString(rm, L"Type", L"Desktop");
+		std::wstring path = RmReadPath(rm, L"Path", L"");
+		bool desktopCrop = RmReadBool(rm, L"CropDesktop", true);
+		bool forceIcon = RmReadBool(rm, L"ForceIcon", false);
+		bool contextAware = RmReadBool(rm, L"ContextAwareColors", true);
+		std::wstring sampleModeName = RmReadString(rm, L"SampleMode", L"Box");
+		int sampleBudget = RmReadInt(rm, L"SampleBudget", SAMPLE_DEFAULT_BUDGET);
+		int frameBudget = RmReadInt(rm, L"FrameBudget", FRAME_DEFAULT_BUDGET / (1024 * 1024));
+		std::wstring gridSize = RmReadString(rm, L"Grid", L"");
+
+		uint32_t fallback_bg1 = RmReadColor(rm, L"FallbackBG1", 0xFFFFFFFF);
+		uint32_t fallback_bg2 = RmReadColor(rm, L"FallbackBG2", fallback_bg1);
+		uint32_t fallback_fg1 = RmReadColor(rm, L"FallbackFG1", 0x000000FF);
+		uint32_t fallback_fg2 = RmReadColor(rm, L"FallbackFG2", fallback_fg1);
+
+		int cropX = RmReadInt(rm, L"CropX", 0);
+		int cropY = RmReadInt(rm, L"CropY", 0);
+		int cropW = RmReadInt(rm, L"CropW", CROP_MAX_DIMENSION);
+		int cropH = RmReadInt(rm, L"CropH", CROP_MAX_DIMENSION);
+
+		bool customCrop = !(cropX == 0 && cropY == 0 && cropW == CROP_MAX_DIMENSION && cropH == CROP_MAX_DIMENSION);
+
+		// Does the measure already have a parent?
+		std::shared_ptr<Image> img;
+
+		if (measure->parent != nullptr)
+		{
+			// Refresh it!
+			img = measure->parent;
+		}
+		else
+		{
+			img = std::make_shared<Image>();
+			img->rm = rm;
+			img->name = RmGetMeasureName(rm);
+			img->skin = skin;
+			img->hWnd = RmGetSkinWindow(rm);
+
+			img->lastMod.dwHighDateTime = img->lastMod.dwLowDateTime = 0;
+			img->fileSize = 0;
+			img->watchSeen = 0;
+
+			measure->type = MEASURE_CONTAINER;
+			measure->parent = img;
+			measure->ownsImage = true;
+
+			images.push_back(img);
+
+			img->customCrop = false;
+			img->sharedGeneration = 0;
+			img->contextDirty = false;
+			img->contextRect = { 0 };
+			img->cachedContext = { 0 };
+
+			img->skinX = 0;
+			img->skinY = 0;
+			img->draggingSkin = false;
+
+			img->sampleMode = SAMPLE_MODE_BOX;
+			img->sampleBudget = SAMPLE_DEFAULT_BUDGET;
+			img->frameBudget = FRAME_DEFAULT_BUDGET;
+			img->gridColumns = 0;
+			img->gridRows = 0;
+
+			// We'll need to reload the color data...
+			img->dirty = true;
+
+			// First container around gets the worker going
+			if (containerCount++ == 0)
+			{
+				if (paletteCachePath.empty())
+				{
+					loadPaletteCache();
+				}
+
+				worker = new Worker([] { CoInitializeEx(NULL, COINIT_APARTMENTTHREADED); }, [] { CoUninitialize(); });
+				changeNotifier = new ChangeNotifier(createFileWatcher());
+				wallpapers = new WallpaperCache(createWallpaperSource());
+			}
+
+			std::wstring debug = L"Chameleon: Created container ";
+			debug += RmGetMeasureName(rm);
+			RmLog(LOG_DEBUG, debug.c_str());
+		}
+
+		if (type.compare(L"Desktop") == 0)
+		{
+			img->type = IMG_DESKTOP;
+			img->forceIcon = false;
+
+			// Define a "custom" crop of max-size to prevent the default
+			// "crop to monitor size" behavior but only use it if
+			// CropDesktop is anything other than 0
+			img->cropRect.left = img->cropRect.top = 0;
+			img->cropRect.right = img->cropRect.bottom = LONG_MAX;
+			img->customCrop = !desktopCrop;
+		}
+		else if (type.compare(L"File") == 0)
+		{
+			img->type = IMG_FILE;
+			
+			if (path.compare(img->path) != 0)
+			{
+				img->path = path;
+				img->dirty = true;
+			}
+
+			img->forceIcon = forceIcon;
+		}
+		else
+		{
+			RmLog(LOG_ERROR, L"Chameleon: Invalid Type=");
+			return;
+		}
+
+		// Shuffle the colors based on the average color
+		// of the area under the skin
+		img->contextAware = contextAware;
+
+		// Averaging every pixel of a huge image is a lot of reading for a
+		// 256x256 result, so skins can ask for just a sample of them
+		SampleMode sampleMode = SAMPLE_MODE_BOX;
+		if (sampleModeName.compare(L"Stratified") == 0)
+		{
+			sampleMode = SAMPLE_MODE_STRATIFIED;
+		}
+		else if (sampleModeName.compare(L"Box") != 0)
+		{
+			RmLog(LOG_ERROR, L"Chameleon: Invalid SampleMode=, using Box");
+		}
+
+		// Less than a pixel for each one Chameleon gets would just be
+		// reading the same ones again
+		if (sampleBudget < SAMPLE_DEFAULT_BUDGET)
+		{
+			sampleBudget = SAMPLE_DEFAULT_BUDGET;
+		}
+
+		if (sampleMode != img->sampleMode || sampleBudget != img->sampleBudget)
+		{
+			img->sampleMode = sampleMode;
+			img->sampleBudget = sampleBudget;
+			img->dirty = true;
+		}
+
+		// How many MB of decoded image to keep around for a crop that keeps
+		// changing. Doesn't change the colors, so nothing to resample.
+		img->frameBudget = frameBudget > 0 ? (size_t)frameBudget * 1024 * 1024 : 0;
+
+		// Colors for each cell of a grid over the image, like Grid=4x3
+		int gridColumns = 0;
+		int gridRows = 0;
+		if (!gridSize.empty())
+		{
+			if (swscanf(gridSize.c_str(), L"%dx%d", &gridColumns, &gridRows) != 2 ||
+				gridColumns < 1 || gridColumns > GRID_MAX_CELLS || gridRows < 1 || gridRows > GRID_MAX_CELLS)
+			{
+				RmLog(LOG_ERROR, L"Chameleon: Invalid Grid=, should be like 4x3 with at most 16 each way");
+				gridColumns = gridRows = 0;
+			}
+		}
+
+		if (gridColumns != img->gridColumns || gridRows != img->gridRows)
+		{
+			img->gridColumns = gridColumns;
+			img->gridRows = gridRows;
+			img->dirty = true;
+		}
+
+		img->fallback_bg1 = fallback_bg1;
+		img->fallback_bg2 = fallback_bg2;
+		img->fallback_fg1 = fallback_fg1;
+		img->fallback_fg2 = fallback_fg2;
+
+		// Make sure the initial colors are the fallback
+		// (but don't throw away real colors on a dynamic variable reload)
+		if (std::atomic_load(&img->colors) == nullptr)
+		{
+			useDefaultColors(img);
+		}
+
+		// Grab cropping info
+		img->cropRect.left = cropX;
+		img->cropRect.top = cropY;
+		img->cropRect.right = cropW + cropX;
+		img->cropRect.bottom = cropH + cropY;
+
+		// Use the cropping info if it's not the defaults
+		img->customCrop = customCrop;
+
+		Update(data);
+	}
+	else
+	{
+		// Until we know what it's meant to be, so bailing out anywhere
+		// below doesn't leave it looking like a container
+		measure->type = MEASURE_INVALID;
+
+		for (std::weak_ptr<Image> imgPtr : images)
+		{
+			if (!imgPtr.expired())
+			{
+				std::shared_ptr<Image> img = imgPtr.lock();
+				if (img->skin == skin && img->name.compare(parent) == 0)
+				{
+					measure->parent = img;
+
+					std::wstring debug = L"Measure ";
+					debug += RmGetMeasureName(rm);
+					debug += L" has a parent of ";
+					debug += measure->parent->name;
+					debug += L" and is exposing the color ";
+
+					std::wstring color = RmReadString(rm, L"Color", L"");
+					debug += color;
+					RmLog(LOG_DEBUG, debug.c_str());
+
+					// Colors of one cell of the parent's grid look like Average@2,1
+					size_t at = color.find(L'@');
+					if (at != std::wstring::npos)
+					{
+						std::wstring cellColor = color.substr(0, at);
+
+						if (swscanf(color.c_str() + at + 1, L"%d,%d", &measure->cellColumn, &measure->cellRow) != 2 || measure->cellColumn < 0 || measure->cellRow < 0)
+						{
+							RmLog(LOG_ERROR, L"Chameleon: Invalid cell in Color=, should be like Average@2,1");
+							return;
+						}
+
+						if (cellColor.compare(L"Average") == 0)
+						{
+							measure->type = MEASURE_CELL_AVG_COLOR;
+						}
+						else if (cellColor.compare(L"Luminance") == 0)
+						{
+							measure->type = MEASURE_CELL_AVG_LUM;
+						}
+						else if (cellColor.compare(L"Dominant") == 0)
+						{
+							measure->type = MEASURE_CELL_DOMINANT;
+						}
+						else
+						{
+							RmLog(LOG_ERROR, L"Chameleon: Invalid Color=, cells only have Average, Luminance and Dominant");
+							return;
+						}
+					}
+					else if (color.compare(L"Background1") == 0)
+					{
+						measure->type = MEASURE_BG1;
+					}
+					else if (color.compare(L"Background2") == 0)
+					{
+						measure->type = MEASURE_BG2;
+					}
+					else if (color.compare(L"Foreground1") == 0)
+					{
+						measure->type = MEASURE_FG1;
+					}
+					else if (color.compare(L"Foreground2") == 0)
+					{
+						measure->type = MEASURE_FG2;
+					}
+					else if (color.compare(L"Luminance") == 0)
+					{
+						measure->type = MEASURE_AVG_LUM;
+					}
+					else if (color.compare(L"Average") == 0)
+					{
+						measure->type = MEASURE_AVG_COLOR;
+					}
+					else if (color.compare(L"Light1") == 0)
+					{
+						measure->type = MEASURE_L1;
+					}
+					else if (color.compare(L"Light2") == 0)
+					{
+						measure->type = MEASURE_L2;
+					}
+					else if (color.compare(L"Light3") == 0)
+					{
+						measure->type = MEASURE_L3;
+					}
+					else if (color.compare(L"Light4") == 0)
+					{
+						measure->type = MEASURE_L4;
+					}
+					else if (color.compare(L"Dark1") == 0)
+					{
+						measure->type = MEASURE_D1;
+					}
+					else if (color.compare(L"Dark2") == 0)
+					{
+						measure->type = MEASURE_D2;
+					}
+					else if (color.compare(L"Dark3") == 0)
+					{
+						measure->type = MEASURE_D3;
+					}
+					else if (color.compare(L"Dark4") == 0)
+					{
+						measure->type = MEASURE_D4;
+					}
+					else if (color.compare(L"Counter") == 0)
+					{
+						measure->counter = findCounter(RmReadString(rm, L"Counter", L""));
+
+						if (measure->counter == COUNTER_MAX)
+						{
+							RmLog(LOG_ERROR, L"Chameleon: Invalid Counter=");
+							return;
+						}
+
+						measure->type = MEASURE_COUNTER;
+					}
+					else if (color.compare(L"Stats") == 0)
+					{
+						measure->stage = findStage(RmReadString(rm, L"Stage", L"Sample"));
+						measure->stat = findStat(RmReadString(rm, L"Stat", L"Avg"));
+
+						if (measure->stage == STAGE_MAX)
+						{
+							RmLog(LOG_ERROR, L"Chameleon: Invalid Stage=");
+							return;
+						}
+
+						if (measure->stat == STAT_MAX)
+						{
+							RmLog(LOG_ERROR, L"Chameleon: Invalid Stat=");
+							return;
+						}
+
+						measure->type = MEASURE_STATS;
+					}
+					else
+					{
+						RmLog(LOG_ERROR, L"Chameleon: Invalid Color=");
+						return;
+					}
+
+					std::wstring useHex = RmReadString(rm, L"Format", L"Hex");
+
+					if (useHex.compare(L"Hex") == 0)
+					{
+						measure->useHex = true;
+					}
+					else if (useHex.compare(L"Dec") == 0)
+					{
+						measure->useHex = false;
+					}
+					else
+					{
+						measure->useHex = true;
+						RmLog(LOG_ERROR, L"Chameleon: Invalid Format=");
+						return;
+					}
+
+					return;
+				}
+			}
+		}
+
+		// If we got here, we didn't find the parent
+		std::wstring err = L"Chameleon: Invalid Parent=";
+		err += parent;
+		err += L" in ";
+		err += RmGetMeasureName(rm);
+		RmLog(LOG_ERROR, err.c_str());
+	}
+}
+
+// Called periodically to refresh the values passed to and returned from the measure
+// Dynamic variables should be re-read here.
+PLUGIN_EXPORT double Update(void *data)
+{
+	Measure *measure = static_cast<Measure*>(data);
+
+	// Containers are the "parent" type, so they get to be the ones that actually update
+	if (measure->type == MEASURE_CONTAINER)
+	{
+		// Update the path
+		if (measure->parent->type == IMG_FILE)
+		{
+			std::wstring newPath = RmReadPath(measure->parent->rm, L"Path", L"");
+			if (measure->parent->path.compare(newPath) != 0)
+			{
+				// Different path, need to update image
+				measure->parent->path = newPath;
+				measure->parent->dirty = true;
+			}
+		}
+
+		int cropX = RmReadInt(measure->parent->rm, L"CropX", 0);
+		int cropY = RmReadInt(measure->parent->rm, L"CropY", 0);
+		int cropW = RmReadInt(measure->parent->rm, L"CropW", CROP_MAX_DIMENSION);
+		int cropH = RmReadInt(measure->parent->rm, L"CropH", CROP_MAX_DIMENSION);
+
+		bool customCrop = !(cropX == 0 && cropY == 0 && cropW == CROP_MAX_DIMENSION && cropH == CROP_MAX_DIMENSION);
+
+		// Grab cropping info
+		measure->parent->cropRect.left = cropX;
+		measure->parent->cropRect.top = cropY;
+		measure->parent->cropRect.right = cropW + cropX;
+		measure->parent->cropRect.bottom = cropH + cropY;
+
+		int contextX = RmReadInt(measure->parent->rm, L"ContextX", 0);
+		int contextY = RmReadInt(measure->parent->rm, L"ContextY", 0);
+		int contextW = RmReadInt(measure->parent->rm, L"ContextW", 0);
+		int contextH = RmReadInt(measure->parent->rm, L"ContextH", 0);
+		measure->parent->contextRect.left = contextX;
+		measure->parent->contextRect.top = contextY;
+		measure->parent->contextRect.right = contextX + contextW;
+		measure->parent->contextRect.bottom = contextY + contextH;
+
+		// Use the cropping info if it's not the defaults
+		measure->parent->customCrop = customCrop;
+
+		SampleImage(measure->parent);
+	}
+	else
+	{
+		// We're updating a child measure, it just needs to format the value from the parent
+		uint32_t value = 0;
+
+		if (measure->type == MEASURE_INVALID)
+		{
+			return 0;
+		}
+
+		if (measure->type == MEASURE_COUNTER)
+		{
+			return (double)readCounter(measure->counter);
+		}
+
+		if (measure->type == MEASURE_STATS)
+		{
+			return readStat(measure->stage, measure->stat);
+		}
+
+		// Grab the whole set at once in case the worker swaps in a new one
+		std::shared_ptr<const ColorSet> colors = std::atomic_load(&measure->parent->colors);
+
+		if (colors == nullptr)
+		{
+			return 0;
+		}
+
+		// Cells outside the grid (or with no grid yet) get the whole
+		// image's average, which is the closest thing we've got
+		const CellColors *cell = nullptr;
+		std::shared_ptr<const GridColors> grid;
+
+		if (measure->type == MEASURE_CELL_AVG_COLOR || measure->type == MEASURE_CELL_AVG_LUM || measure->type == MEASURE_CELL_DOMINANT)
+		{
+			grid = std::atomic_load(&measure->parent->grid);
+			if (grid != nullptr)
+			{
+				cell = grid->cell(measure->cellColumn, measure->cellRow);
+			}
+		}
+
+		if (measure->type == MEASURE_AVG_LUM)
+		{
+			return colors->lum;
+		}
+
+		if (measure->type == MEASURE_CELL_AVG_LUM)
+		{
+			return cell != nullptr ? cell->lum : colors->lum;
+		}
+
+		// Choose the right value
+		switch (measure->type)
+		{
+		case MEASURE_BG1:
+			value = colors->bg1;
+			break;
+		case MEASURE_BG2:
+			value = colors->bg2;
+			break;
+		case MEASURE_FG1:
+			value = colors->fg1;
+			break;
+		case MEASURE_FG2:
+			value = colors->fg2;
+			break;
+
+		case MEASURE_AVG_COLOR:
+			value = colors->avg;
+			break;
+
+		case MEASURE_L1:
+			value = colors->l1;
+			break;
+		case MEASURE_L2:
+			value = colors->l2;
+			break;
+		case MEASURE_L3:
+			value = colors->l3;
+			break;
+		case MEASURE_L4:
+			value = colors->l4;
+			break;
+
+		case MEASURE_D1:
+			value = colors->d1;
+			break;
+		case MEASURE_D2:
+			value = colors->d2;
+			break;
+		case MEASURE_D3:
+			value = colors->d3;
+			break;
+		case MEASURE_D4:
+			value = colors->d4;
+			break;
+
+		case MEASURE_CELL_AVG_COLOR:
+			value = cell != nullptr ? cell->avg : colors->avg;
+			break;
+		case MEASURE_CELL_DOMINANT:
+			value = cell != nullptr ? cell->dominant : colors->avg;
+			break;
+		}
+
+		// Lop off the alpha
+		value >>= 8;
+
+		measure->value.clear();
+
+		// Which format?
+		if (measure->useHex)
+		{
+			for (size_t i = 0; i < 6; ++i) { measure->value += whex[(value >> (20 - 4 * i)) & 0x0F]; }
+		}
+		else
+		{
+			measure->value = std::to_wstring((value >> 16) & 0xFF) + L"," + std::to_wstring((value >> 8) & 0xFF) + L"," + std::to_wstring(value & 0xFF);
+		}
+	}
+
+	// This plugin only returns strings so...
+	return 0;
+}
+
+// Reading the value of a measure as a c-string
+PLUGIN_EXPORT LPCWSTR GetString(void *data)
+{
+	Measure *measure = static_cast<Measure*>(data);
+	std::shared_ptr<Image> img = measure->parent;
+
+	if (img == nullptr || measure->type == MEASURE_INVALID)
+	{
+		return invalidErr;
+	}
+
+	if (measure->type == MEASURE_CONTAINER)
+	{
+		return img->path.c_str();
+	}
+	else if (measure->type == MEASURE_AVG_LUM || measure->type == MEASURE_CELL_AVG_LUM || measure->type == MEASURE_COUNTER || measure->type == MEASURE_STATS)
+	{
+		return NULL;
+	}
+	else
+	{
+		return measure->value.c_str();
+	}
+}
+
+// When we're removing a measure we don't need anymore
+PLUGIN_EXPORT void Finalize(void *data)
+{
+	Measure *measure = static_cast<Measure*>(data);
+
+	// Children just let go of their parent, only the container that
+	// created it has anything to tear down
+	if (measure->ownsImage)
+	{
+		// Let go of the shared sample (the children still hold on to the Image)
+		// and if we were the last one using it, drop its work too, since
+		// there's no point sampling something nobody is going to see
+		if (measure->parent->shared != nullptr)
+		{
+			SharedSample *shared = measure->parent->shared.get();
+			std::weak_ptr<SharedSample> weakShared = measure->parent->shared;
+
+			measure->parent->shared = nullptr;
+
+			if (weakShared.expired())
+			{
+				worker->cancel(shared);
+			}
+		}
+
+		if (!measure->parent->watchedPath.empty())
+		{
+			changeNotifier->unsubscribe(measure->parent->watchedPath);
+			measure->parent->watchedPath.clear();
+		}
+
+		// Last one out stops the worker so it isn't running when Rainmeter unloads us
+		if (--containerCount == 0)
+		{
+			delete worker;
+			worker = nullptr;
+
+			delete changeNotifier;
+			changeNotifier = nullptr;
+
+			delete wallpapers;
+			wallpapers = nullptr;
+
+			savePaletteCache();
+
+			// Nothing left to reuse them for
+			frameCache.clear();
+			iconCache.clear();
+			retryBackoff.clear();
+			decodeRoutes.clear();
+			poolTrim();
+			stopParallelThreads();
+		}
+	}
+
+	delete measure;
+}
+
+// Dumb function for dumb broken desktop sampling
+bool isWin1124h2 = false;
+bool isWin1124h2Detected = false;
+#define WIN11_24H2_BUILD 26100
+bool IsWindows11_24H2OrGreater() {
+	// I highly doubt we'll need to detect this literally every time we call this function,
+	// so we cache the value and return that
+	if (isWin1124h2Detected)
+		return isWin1124h2;
+
+	// Get the version info
+	NTSTATUS(WINAPI * RtlGetVersion)(LPOSVERSIONINFOEXW);
+	OSVERSIONINFOEXW versionInfo;
+
+	*(FARPROC*)&RtlGetVersion = GetProcAddress(GetModuleHandleA("ntdll"), "RtlGetVersion");
+
+	if(RtlGetVersion != NULL)
+	{
+		versionInfo = { sizeof(versionInfo) };
+		RtlGetVersion(&versionInfo);
+
+		isWin1124h2 = versionInfo.dwMajorVersion == 10 && versionInfo.dwBuildNumber >= WIN11_24H2_BUILD;
+	}
+	else
+	{
+		// if we couldn't tell, just assume it is because we want to take a
+		// fallback route for 24h2. Don't use this for enabling features!
+		isWin1124h2 = true;
+	}
+
+	isWin1124h2Detected = true;
+
+	return isWin1124h2;
 }
\ No newline at end of file
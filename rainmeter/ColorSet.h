@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+
+// The colors a container hands out to its children. A sample builds a
+// whole new set and swaps it in at once, so children never see half of
+// one image and half of another.
+struct ColorSet
+{
+	uint32_t bg1;
+	uint32_t bg2;
+	uint32_t fg1;
+	uint32_t fg2;
+
+	uint32_t l1;
+	uint32_t l2;
+	uint32_t l3;
+	uint32_t l4;
+
+	uint32_t d1;
+	uint32_t d2;
+	uint32_t d3;
+	uint32_t d4;
+
+	float lum;
+	uint32_t avg;
+};
@@ -0,0 +1,164 @@
+#include <cstring>
+
+#include "ContentHash.h"
+
+// The XXH64 primes
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+// Unaligned little endian reads. Every compiler we care about turns the
+// memcpy into a plain load.
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t mixLane(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME2;
+	acc = rotateLeft(acc, 31);
+	return acc * PRIME1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t lane)
+{
+	acc ^= mixLane(0, lane);
+	return acc * PRIME1 + PRIME4;
+}
+
+ContentHasher::ContentHasher(uint64_t seed) : total(0), pendingLength(0), seed(seed)
+{
+	lanes[0] = seed + PRIME1 + PRIME2;
+	lanes[1] = seed + PRIME2;
+	lanes[2] = seed;
+	lanes[3] = seed - PRIME1;
+}
+
+void ContentHasher::update(const void *data, size_t length)
+{
+	const uint8_t *p = static_cast<const uint8_t*>(data);
+	const uint8_t *end = p + length;
+	total += length;
+
+	// Finish off a stripe left over from last time
+	if (pendingLength > 0)
+	{
+		size_t fill = 32 - pendingLength;
+		if (fill > length)
+		{
+			fill = length;
+		}
+
+		memcpy(pending + pendingLength, p, fill);
+		pendingLength += fill;
+		p += fill;
+
+		if (pendingLength < 32)
+		{
+			return;
+		}
+
+		lanes[0] = mixLane(lanes[0], read64(pending));
+		lanes[1] = mixLane(lanes[1], read64(pending + 8));
+		lanes[2] = mixLane(lanes[2], read64(pending + 16));
+		lanes[3] = mixLane(lanes[3], read64(pending + 24));
+		pendingLength = 0;
+	}
+
+	// The bulk of it, 32 bytes at a time across four independent lanes
+	uint64_t v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+
+	while (end - p >= 32)
+	{
+		v1 = mixLane(v1, read64(p));
+		v2 = mixLane(v2, read64(p + 8));
+		v3 = mixLane(v3, read64(p + 16));
+		v4 = mixLane(v4, read64(p + 24));
+		p += 32;
+	}
+
+	lanes[0] = v1;
+	lanes[1] = v2;
+	lanes[2] = v3;
+	lanes[3] = v4;
+
+	// Hang on to the rest for next time
+	pendingLength = end - p;
+	memcpy(pending, p, pendingLength);
+}
+
+uint64_t ContentHasher::digest() const
+{
+	uint64_t hash;
+
+	if (total >= 32)
+	{
+		hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18);
+		hash = mergeRound(hash, lanes[0]);
+		hash = mergeRound(hash, lanes[1]);
+		hash = mergeRound(hash, lanes[2]);
+		hash = mergeRound(hash, lanes[3]);
+	}
+	else
+	{
+		hash = seed + PRIME5;
+	}
+
+	hash += total;
+
+	const uint8_t *p = pending;
+	const uint8_t *end = pending + pendingLength;
+
+	while (end - p >= 8)
+	{
+		hash ^= mixLane(0, read64(p));
+		hash = rotateLeft(hash, 27) * PRIME1 + PRIME4;
+		p += 8;
+	}
+
+	if (end - p >= 4)
+	{
+		hash ^= (uint64_t)read32(p) * PRIME1;
+		hash = rotateLeft(hash, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+
+	while (p < end)
+	{
+		hash ^= (*p) * PRIME5;
+		hash = rotateLeft(hash, 11) * PRIME1;
+		++p;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+uint64_t hashContent(const void *data, size_t length)
+{
+	ContentHasher hasher;
+	hasher.update(data, length);
+	return hasher.digest();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A fast 64-bit fingerprint of a file's contents (XXH64), so a file that
+// got rewritten or touched without actually changing can be recognized
+// without decoding it. Not for anything security related, it's only
+// meant to tell images apart.
+class ContentHasher
+{
+public:
+	ContentHasher(uint64_t seed = 0);
+
+	// Can be fed in pieces of any size, the result's the same
+	void update(const void *data, size_t length);
+	uint64_t digest() const;
+
+private:
+	uint64_t lanes[4];
+	uint64_t total;
+	uint8_t pending[32];
+	size_t pendingLength;
+	uint64_t seed;
+};
+
+// The whole thing in one go
+uint64_t hashContent(const void *data, size_t length);
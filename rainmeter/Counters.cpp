@@ -0,0 +1,50 @@
+#include <atomic>
+#include <cwchar>
+
+#include "Counters.h"
+
+static std::atomic<uint64_t> counters[COUNTER_MAX];
+
+// Has to stay in the same order as the enum
+static const wchar_t *counterNames[COUNTER_MAX] =
+{
+	L"CacheHits",
+	L"CacheMisses",
+	L"SharedHits",
+	L"PoolHits",
+	L"PoolMisses",
+	L"ContentHits",
+	L"ContentMisses",
+	L"FrameHits",
+	L"FrameMisses",
+	L"WallpaperHits",
+	L"WallpaperMisses",
+	L"Retries",
+	L"RetryBackoffs",
+	L"DecodeRouteHits",
+	L"IconHits",
+	L"IconMisses"
+};
+
+void countEvent(Counter counter, uint64_t amount)
+{
+	counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+uint64_t readCounter(Counter counter)
+{
+	return counters[counter].load(std::memory_order_relaxed);
+}
+
+Counter findCounter(const wchar_t *name)
+{
+	for (int i = 0; i < COUNTER_MAX; ++i)
+	{
+		if (wcscmp(name, counterNames[i]) == 0)
+		{
+			return (Counter)i;
+		}
+	}
+
+	return COUNTER_MAX;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+// Running totals of things worth keeping an eye on, mostly so it's possible
+// to check the caches are doing their job. Skins can read these with a
+// Color=Counter child measure.
+enum Counter
+{
+	COUNTER_CACHE_HITS,
+	COUNTER_CACHE_MISSES,
+
+	// A container found someone else already sampling the same thing
+	COUNTER_SHARED_HITS,
+
+	// A big image buffer got reused instead of coming from the heap
+	COUNTER_POOL_HITS,
+	COUNTER_POOL_MISSES,
+
+	// A file that changed on paper turned out to have the same contents
+	// as something we'd already sampled
+	COUNTER_CONTENT_HITS,
+	COUNTER_CONTENT_MISSES,
+
+	// A crop changed and the image it's cropping was still around from the
+	// last time, so the file didn't need decoding again
+	COUNTER_FRAME_HITS,
+	COUNTER_FRAME_MISSES,
+
+	// A desktop container found out which wallpaper it's on without
+	// having to ask Windows
+	COUNTER_WALLPAPER_HITS,
+	COUNTER_WALLPAPER_MISSES,
+
+	// A file the worker couldn't open was tried again, or was left alone
+	// for an update because it hadn't waited long enough yet
+	COUNTER_RETRIES,
+	COUNTER_RETRY_BACKOFFS,
+
+	// A file stb already couldn't read went straight to its icon (or the
+	// fallback colors) without trying again
+	COUNTER_DECODE_ROUTE_HITS,
+
+	// A file's icon had already been sampled for another file with the
+	// same one (every .txt file shares the one icon, say), or hadn't
+	COUNTER_ICON_HITS,
+	COUNTER_ICON_MISSES,
+
+	COUNTER_MAX
+};
+
+// Safe to call from any thread
+void countEvent(Counter counter, uint64_t amount = 1);
+uint64_t readCounter(Counter counter);
+
+// Look up a counter by the name skins use for it (like CacheHits).
+// Returns COUNTER_MAX if there's no such counter.
+Counter findCounter(const wchar_t *name);
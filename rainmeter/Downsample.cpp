@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "Downsample.h"
+#include "ThreadPool.h"
+
+// How many destination rows each thread takes at a time
+#define DOWNSAMPLE_BAND_ROWS 16
+
+#ifdef PIXEL_X86
+#include <emmintrin.h>
+#endif
+
+// Which source pixels make up one destination pixel: the whole ones in
+// [start, end), plus however much of the ones either side is covered
+// (start - 1 and end, a weight of 0 meaning none of it)
+struct Span
+{
+	int start;
+	int end;
+	float startWeight;
+	float endWeight;
+};
+
+static void makeSpans(int srcSize, int dstSize, Span *spans)
+{
+	double scale = (double)srcSize / dstSize;
+
+	for (int i = 0; i < dstSize; ++i)
+	{
+		double from = i * scale;
+		double to = (i + 1) * scale;
+
+		// The last one always ends exactly on the edge, no matter how the
+		// multiplication rounded
+		if (i == dstSize - 1)
+			to = srcSize;
+
+		Span &span = spans[i];
+		span.start = (int)from;
+		span.end = (int)to;
+		span.startWeight = 0;
+		span.endWeight = 0;
+
+		if (span.start < from)
+		{
+			span.startWeight = (float)(span.start + 1 - from);
+			span.start++;
+		}
+
+		if (span.end < to && span.end < srcSize)
+		{
+			span.endWeight = (float)(to - span.end);
+		}
+	}
+}
+
+// How many source pixels go into each destination pixel if it's the same
+// whole number for all of them, otherwise 0
+static int exactRatio(int srcSize, int dstSize)
+{
+	return srcSize % dstSize == 0 ? srcSize / dstSize : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Horizontal passes. Each one shrinks a single source row into dstW sums
+// (four floats each, not yet divided by anything). ratio is exactRatio of
+// the width, for the passes that have something quicker for it.
+
+// Goes span by span whatever the ratio
+static void sumRowScalar(const uint8_t *src, int dstW, const Span *spans, int /*ratio*/, float *sums)
+{
+	for (int x = 0; x < dstW; ++x)
+	{
+		const Span &span = spans[x];
+		uint32_t whole[4] = { 0, 0, 0, 0 };
+
+		for (int i = span.start; i < span.end; ++i)
+		{
+			const uint8_t *p = src + i * 4;
+			whole[0] += p[0];
+			whole[1] += p[1];
+			whole[2] += p[2];
+			whole[3] += p[3];
+		}
+
+		for (int c = 0; c < 4; ++c)
+		{
+			float sum = (float)whole[c];
+
+			if (span.startWeight > 0)
+				sum = sum + src[(span.start - 1) * 4 + c] * span.startWeight;
+			if (span.endWeight > 0)
+				sum = sum + src[span.end * 4 + c] * span.endWeight;
+
+			sums[x * 4 + c] = sum;
+		}
+	}
+}
+
+#ifdef PIXEL_X86
+
+static inline __m128 pixelToFloatSSE2(const uint8_t *p)
+{
+	int32_t value;
+	memcpy(&value, p, sizeof(value));
+
+	const __m128i zero = _mm_setzero_si128();
+	__m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(value), zero), zero);
+
+	return _mm_cvtepi32_ps(wide);
+}
+
+// Adds up count pixels, one channel per 32-bit lane
+static inline __m128i sumPixelsSSE2(const uint8_t *p, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i total = zero;
+	int i = 0;
+
+	while (count - i >= 4)
+	{
+		// Four pixels at a time into 16-bit lanes, two pixels' worth per
+		// lane each time. 64 goes before that could overflow.
+		__m128i partial = zero;
+		int blockEnd = i + ((count - i < 256 ? count - i : 256) & ~3);
+
+		for (; i < blockEnd; i += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(p + i * 4));
+			partial = _mm_add_epi16(partial, _mm_add_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero)));
+		}
+
+		total = _mm_add_epi32(total, _mm_add_epi32(_mm_unpacklo_epi16(partial, zero), _mm_unpackhi_epi16(partial, zero)));
+	}
+
+	for (; i < count; ++i)
+	{
+		int32_t value;
+		memcpy(&value, p + i * 4, sizeof(value));
+		total = _mm_add_epi32(total, _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(value), zero), zero));
+	}
+
+	return total;
+}
+
+static void sumRowSSE2(const uint8_t *src, int dstW, const Span *spans, int ratio, float *sums)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int x = 0;
+
+	// The whole number ratios don't need the spans at all, every output is
+	// just the next ratio pixels added up
+	if (ratio == 1)
+	{
+		for (; x < dstW; ++x)
+		{
+			_mm_storeu_ps(&sums[x * 4], pixelToFloatSSE2(src + x * 4));
+		}
+	}
+	else if (ratio == 2)
+	{
+		for (; x + 2 <= dstW; x += 2)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + x * 8));
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+
+			// Pixels 0+1 in the bottom half, 2+3 in the top
+			__m128i pairs = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+
+			_mm_storeu_ps(&sums[x * 4], _mm_cvtepi32_ps(_mm_unpacklo_epi16(pairs, zero)));
+			_mm_storeu_ps(&sums[x * 4 + 4], _mm_cvtepi32_ps(_mm_unpackhi_epi16(pairs, zero)));
+		}
+	}
+	else if (ratio == 4)
+	{
+		for (; x < dstW; ++x)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + x * 16));
+			__m128i halves = _mm_add_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero));
+			__m128i all = _mm_add_epi16(halves, _mm_srli_si128(halves, 8));
+
+			_mm_storeu_ps(&sums[x * 4], _mm_cvtepi32_ps(_mm_unpacklo_epi16(all, zero)));
+		}
+	}
+	else if (ratio == 8)
+	{
+		for (; x < dstW; ++x)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(src + x * 32));
+			__m128i b = _mm_loadu_si128((const __m128i*)(src + x * 32 + 16));
+			__m128i halves = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero)),
+				_mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero)));
+			__m128i all = _mm_add_epi16(halves, _mm_srli_si128(halves, 8));
+
+			_mm_storeu_ps(&sums[x * 4], _mm_cvtepi32_ps(_mm_unpacklo_epi16(all, zero)));
+		}
+	}
+
+	// Anything else (and whatever an odd width left over) goes span by span
+	for (; x < dstW; ++x)
+	{
+		const Span &span = spans[x];
+		__m128 sum = _mm_cvtepi32_ps(sumPixelsSSE2(src + span.start * 4, span.end - span.start));
+
+		if (span.startWeight > 0)
+			sum = _mm_add_ps(sum, _mm_mul_ps(pixelToFloatSSE2(src + (span.start - 1) * 4), _mm_set1_ps(span.startWeight)));
+		if (span.endWeight > 0)
+			sum = _mm_add_ps(sum, _mm_mul_ps(pixelToFloatSSE2(src + span.end * 4), _mm_set1_ps(span.endWeight)));
+
+		_mm_storeu_ps(&sums[x * 4], sum);
+	}
+}
+
+#endif // PIXEL_X86
+
+// ---------------------------------------------------------------------------
+
+// Adds a row's sums into the destination row being built up
+static void accumulate(float *total, const float *sums, int count, float weight)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		total[i] = total[i] + sums[i] * weight;
+	}
+}
+
+bool downsampleView(const ImageView &view, uint32_t *dst, int dstW, int dstH, PixelKernel kernel)
+{
+	if (view.format.bytesPerPixel != 4 || dstW <= 0 || dstH <= 0 || dstW > view.w || dstH > view.h)
+		return false;
+
+	void (*sumRow)(const uint8_t*, int, const Span*, int, float*) = sumRowScalar;
+
+#ifdef PIXEL_X86
+	// AVX2 wouldn't buy much here, it's all waiting on memory
+	if (kernel != PIXEL_KERNEL_SCALAR && bestPixelKernel() != PIXEL_KERNEL_SCALAR)
+		sumRow = sumRowSSE2;
+#endif
+
+	// Working out which pixels go where, kept around for the next one since
+	// it's usually the same size
+	static thread_local std::vector<Span> columns, rows;
+
+	columns.resize(dstW);
+	rows.resize(dstH);
+
+	makeSpans(view.w, dstW, columns.data());
+	makeSpans(view.h, dstH, rows.data());
+
+	// The threads below would each see their own (empty) copies of those,
+	// so hand them ours
+	const Span *columnSpans = columns.data();
+	const Span *rowSpans = rows.data();
+
+	int ratio = exactRatio(view.w, dstW);
+	float scale = (float)((double)dstW * dstH / ((double)view.w * view.h));
+	int count = dstW * 4;
+
+	// Bands of destination rows go to different threads. Each one only
+	// writes its own rows, so it comes out the same however it's split.
+	parallelFor(dstH, DOWNSAMPLE_BAND_ROWS, [&](int first, int last)
+	{
+		// Each thread's own working space
+		static thread_local std::vector<float> total, sums, edge;
+
+		total.resize((size_t)count);
+		sums.resize((size_t)count);
+		edge.resize((size_t)count);
+
+		// A source row straddling two destination rows is the bottom edge
+		// of one and the top edge of the next. Its sums get kept around so
+		// it only has to be read once.
+		int edgeRow = -1;
+
+		for (int y = first; y < last; ++y)
+		{
+			const Span &span = rowSpans[y];
+			std::fill(total.begin(), total.end(), 0.0f);
+
+			if (span.startWeight > 0)
+			{
+				if (edgeRow != span.start - 1)
+				{
+					sumRow(view.row(span.start - 1), dstW, columnSpans, ratio, edge.data());
+				}
+
+				accumulate(total.data(), edge.data(), count, span.startWeight);
+			}
+
+			for (int row = span.start; row < span.end; ++row)
+			{
+				sumRow(view.row(row), dstW, columnSpans, ratio, sums.data());
+				accumulate(total.data(), sums.data(), count, 1.0f);
+			}
+
+			if (span.endWeight > 0)
+			{
+				sumRow(view.row(span.end), dstW, columnSpans, ratio, edge.data());
+				edgeRow = span.end;
+
+				accumulate(total.data(), edge.data(), count, span.endWeight);
+			}
+
+			// Back down to an average, rounded to the nearest
+			uint8_t *out = (uint8_t*)&dst[(size_t)y * dstW];
+			for (int i = 0; i < count; ++i)
+			{
+				int value = (int)(total[i] * scale + 0.5f);
+				out[i] = (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value);
+			}
+		}
+	});
+
+	return true;
+}
+
+// Scrambles the bits of a number, for picking spots that look random but
+// aren't
+static inline uint32_t mixBits(uint32_t value)
+{
+	value ^= value >> 16;
+	value *= 0x7FEB352D;
+	value ^= value >> 15;
+	value *= 0x846CA68B;
+	value ^= value >> 16;
+	return value;
+}
+
+bool stratifiedSampleView(const ImageView &view, uint32_t *dst, int dstW, int dstH, int budget)
+{
+	if (view.format.bytesPerPixel != 4 || dstW <= 0 || dstH <= 0 || dstW > view.w || dstH > view.h)
+		return false;
+
+	// Spots per destination pixel, as a grid that many squares on a side
+	int perPixel = budget / (dstW * dstH);
+	int grid = 1;
+	while ((grid + 1) * (grid + 1) <= perPixel)
+	{
+		++grid;
+	}
+
+	int spots = grid * grid;
+
+	// How big each square is in source pixels, as 32.32 fixed point
+	uint64_t stepX = ((uint64_t)view.w << 32) / ((uint64_t)dstW * grid);
+	uint64_t stepY = ((uint64_t)view.h << 32) / ((uint64_t)dstH * grid);
+
+	parallelFor(dstH, DOWNSAMPLE_BAND_ROWS, [&](int first, int last)
+	{
+		static thread_local std::vector<uint32_t> totals;
+		totals.resize((size_t)dstW * 4);
+
+		for (int y = first; y < last; ++y)
+		{
+			std::fill(totals.begin(), totals.end(), 0);
+
+			// A row of squares at a time, so the reads go along the image
+			// rather than up and down it
+			for (int gy = 0; gy < grid; ++gy)
+			{
+				// Every square in the row looks at the same source row.
+				// Picking a different one for each would be a little more
+				// random, but then nearly every read misses the cache, which
+				// costs more than reading the whole image in order.
+				uint32_t band = mixBits((uint32_t)y * 0x85EBCA6B ^ (uint32_t)gy);
+				int sy = (int)((((uint64_t)y * grid + gy) * stepY + (stepY >> 16) * (band & 0xFFFF)) >> 32);
+
+				// Shouldn't be able to step off the far edge, but just in case
+				if (sy >= view.h)
+					sy = view.h - 1;
+
+				const uint8_t *row = view.row(sy);
+
+				for (int x = 0; x < dstW; ++x)
+				{
+					for (int gx = 0; gx < grid; ++gx)
+					{
+						// 16 bits of where in the square to look
+						uint32_t spot = mixBits((uint32_t)(x * grid + gx) * 0x9E3779B9 ^ band);
+						int sx = (int)((((uint64_t)x * grid + gx) * stepX + (stepX >> 16) * (spot & 0xFFFF)) >> 32);
+
+						if (sx >= view.w)
+							sx = view.w - 1;
+
+						const uint8_t *p = row + sx * 4;
+						uint32_t *total = &totals[x * 4];
+						total[0] += p[0];
+						total[1] += p[1];
+						total[2] += p[2];
+						total[3] += p[3];
+					}
+				}
+			}
+
+			uint8_t *out = (uint8_t*)&dst[(size_t)y * dstW];
+			for (int i = 0; i < dstW * 4; ++i)
+			{
+				out[i] = (uint8_t)((totals[i] + spots / 2) / spots);
+			}
+		}
+	});
+
+	return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ImageView.h"
+#include "PixelConvert.h"
+
+// Shrinks an RGBA view down to dstW by dstH (packed) by averaging every
+// source pixel that lands in each destination pixel, pixels straddling the
+// edge counting for however much of them is inside. That's the same box
+// filter stb_image_resize does, give or take a rounding, but it reads the
+// view one row at a time straight from wherever it points (so a crop never
+// gets copied) and never touches anything outside it.
+//
+// Widths that divide exactly by 2, 4 or 8 get their own kernels for the
+// pass along each row, since that's all integer adds. Heights don't need
+// them: rows that divide exactly are only ever added in whole anyway.
+// Every kernel gives exactly the same output.
+//
+// dstW/dstH can't be bigger than the view. Returns false if the view isn't
+// RGBA or the sizes don't make sense.
+bool downsampleView(const ImageView &view, uint32_t *dst, int dstW, int dstH, PixelKernel kernel = PIXEL_KERNEL_AUTO);
+
+// Shrinks the view the same way, but rather than averaging every pixel it
+// only reads about budget of them: each destination pixel's share of the
+// view gets split into a grid and one spot picked inside each square (a
+// row of squares shares a source row, to keep the reads in order). The
+// spots are jittered so regular patterns don't line up with the grid, but
+// always the same for the same sizes, so the same image always gives the
+// same result.
+//
+// At least one pixel per destination pixel gets read, however small the
+// budget.
+bool stratifiedSampleView(const ImageView &view, uint32_t *dst, int dstW, int dstH, int budget);
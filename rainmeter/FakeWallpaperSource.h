@@ -0,0 +1,47 @@
+#pragma once
+
+#include "WallpaperSource.h"
+
+// Stands in for Windows, for trying out WallpaperCache somewhere without
+// real monitors to change. Hands back whatever's in monitors, and only says
+// something changed after notify().
+class FakeWallpaperSource : public WallpaperSource
+{
+public:
+	FakeWallpaperSource() : failing(false), queryCount(0), notified(false) { }
+
+	bool query(std::vector<MonitorWallpaper> *found)
+	{
+		queryCount++;
+
+		if (failing)
+		{
+			return false;
+		}
+
+		*found = monitors;
+		return true;
+	}
+
+	bool changed()
+	{
+		bool was = notified;
+		notified = false;
+		return was;
+	}
+
+	// Pretend Windows said the monitors or wallpapers changed
+	void notify() { notified = true; }
+
+	// What the next query hands back
+	std::vector<MonitorWallpaper> monitors;
+
+	// Make queries fail, like COM not being there
+	bool failing;
+
+	// How many times it's been asked
+	int queryCount;
+
+private:
+	bool notified;
+};
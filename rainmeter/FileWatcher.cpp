@@ -0,0 +1,131 @@
+#include "FileWatcher.h"
+
+ChangeNotifier::ChangeNotifier(FileWatcher *watcher, std::chrono::steady_clock::duration pollInterval) :
+	watcher(watcher), pollInterval(pollInterval)
+{
+}
+
+void ChangeNotifier::subscribe(const std::wstring &path)
+{
+	std::wstring dir = directoryOf(path);
+
+	auto it = directories.find(dir);
+	if (it != directories.end())
+	{
+		it->second.subscribers++;
+		return;
+	}
+
+	Directory entry;
+	entry.subscribers = 1;
+	entry.watched = watcher != nullptr && !dir.empty() && watcher->watch(dir);
+	entry.generation = 1;
+	entry.lastPoll = std::chrono::steady_clock::now();
+
+	directories[dir] = entry;
+}
+
+void ChangeNotifier::unsubscribe(const std::wstring &path)
+{
+	auto it = directories.find(directoryOf(path));
+	if (it == directories.end())
+	{
+		return;
+	}
+
+	if (--it->second.subscribers == 0)
+	{
+		if (it->second.watched)
+		{
+			watcher->unwatch(it->first);
+		}
+
+		directories.erase(it);
+	}
+}
+
+bool ChangeNotifier::changed(const std::wstring &path, uint64_t *seen)
+{
+	auto it = directories.find(directoryOf(path));
+
+	// Not something we know about, so we can't say it hasn't changed
+	if (it == directories.end())
+	{
+		return true;
+	}
+
+	if (it->second.generation != *seen)
+	{
+		*seen = it->second.generation;
+		return true;
+	}
+
+	return false;
+}
+
+void ChangeNotifier::update()
+{
+	if (watcher != nullptr)
+	{
+		std::vector<std::wstring> changedDirs;
+		std::vector<std::wstring> lostDirs;
+		watcher->poll(&changedDirs, &lostDirs);
+
+		for (const std::wstring &dir : changedDirs)
+		{
+			auto it = directories.find(dir);
+			if (it != directories.end())
+			{
+				it->second.generation++;
+			}
+		}
+
+		// Couldn't keep watching, so fall back to polling (and check it
+		// now, since we don't know what we missed)
+		for (const std::wstring &dir : lostDirs)
+		{
+			auto it = directories.find(dir);
+			if (it != directories.end())
+			{
+				it->second.watched = false;
+				it->second.generation++;
+			}
+		}
+	}
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	for (auto &it : directories)
+	{
+		if (!it.second.watched && now - it.second.lastPoll >= pollInterval)
+		{
+			it.second.generation++;
+			it.second.lastPoll = now;
+		}
+	}
+}
+
+std::wstring ChangeNotifier::directoryOf(const std::wstring &path)
+{
+	size_t slash = path.find_last_of(L"\\/");
+	if (slash == std::wstring::npos)
+	{
+		return L"";
+	}
+
+	// Keep the slash on drive roots, C: on its own means something else
+	if (slash == 0 || (slash > 0 && path[slash - 1] == L':'))
+	{
+		return path.substr(0, slash + 1);
+	}
+
+	return path.substr(0, slash);
+}
+
+#if !defined(_WIN32) && !defined(__linux__)
+// Nothing to watch with, everything gets polled
+FileWatcher* createFileWatcher()
+{
+	return nullptr;
+}
+#endif
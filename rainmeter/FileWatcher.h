@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Tells us when something in a directory changes, so we don't have to keep
+// opening files to find out. Each platform has its own (see
+// FileWatcherWin32.cpp and FileWatcherInotify.cpp), everything else only
+// ever talks to this.
+class FileWatcher
+{
+public:
+	virtual ~FileWatcher() {}
+
+	// Start/stop hearing about changes to the files in dir. Returns false
+	// if it can't be watched (network shares and the like), in which case
+	// it'll need polling instead.
+	virtual bool watch(const std::wstring &dir) = 0;
+	virtual void unwatch(const std::wstring &dir) = 0;
+
+	// Adds every watched directory that's changed since the last call to
+	// changed, and any that can't be watched anymore to lost (those are
+	// forgotten about, no need to unwatch them)
+	virtual void poll(std::vector<std::wstring> *changed, std::vector<std::wstring> *lost) = 0;
+};
+
+// The watcher for whatever we're running on, or nullptr if there isn't one
+FileWatcher* createFileWatcher();
+
+// How long a directory that can't be watched goes between checks
+#define CHANGE_POLL_INTERVAL std::chrono::milliseconds(1000)
+
+// Keeps track of which files every container cares about, shared between
+// all of them, and works out when each one needs checking again. Changes
+// are only tracked per directory, so a change next to the file means
+// looking at the file itself to see if it was the one that changed.
+//
+// Files in directories the watcher can't handle (or when there's no
+// watcher at all) get checked every pollInterval instead.
+//
+// Main thread only.
+class ChangeNotifier
+{
+public:
+	ChangeNotifier(FileWatcher *watcher, std::chrono::steady_clock::duration pollInterval = CHANGE_POLL_INTERVAL);
+
+	void subscribe(const std::wstring &path);
+	void unsubscribe(const std::wstring &path);
+
+	// Whether path might have changed since the last time this returned
+	// true for the same seen (start it at 0 so the first call says yes)
+	bool changed(const std::wstring &path, uint64_t *seen);
+
+	// Picks up whatever the watcher noticed and ticks over the polled
+	// directories. Call it before asking about anything.
+	void update();
+
+	// Where the file lives, which is what actually gets watched
+	static std::wstring directoryOf(const std::wstring &path);
+
+private:
+	struct Directory
+	{
+		size_t subscribers;
+		bool watched;
+		uint64_t generation;
+		std::chrono::steady_clock::time_point lastPoll;
+	};
+
+	std::unique_ptr<FileWatcher> watcher;
+	std::chrono::steady_clock::duration pollInterval;
+	std::map<std::wstring, Directory> directories;
+};
@@ -0,0 +1,115 @@
+#ifdef __linux__
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "FileWatcher.h"
+#include "PathPosix.h"
+
+// Same idea as the Win32 one, but on inotify so the rest of the change
+// tracking can be run (and tested) on Linux too.
+class InotifyFileWatcher : public FileWatcher
+{
+public:
+	InotifyFileWatcher(int fd) : fd(fd) {}
+
+	~InotifyFileWatcher()
+	{
+		close(fd);
+	}
+
+	bool watch(const std::wstring &dir)
+	{
+		int wd = inotify_add_watch(fd, toUtf8(dir).c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+		if (wd < 0)
+		{
+			return false;
+		}
+
+		dirs[wd] = dir;
+		return true;
+	}
+
+	void unwatch(const std::wstring &dir)
+	{
+		for (auto it = dirs.begin(); it != dirs.end(); ++it)
+		{
+			if (it->second == dir)
+			{
+				inotify_rm_watch(fd, it->first);
+				dirs.erase(it);
+				break;
+			}
+		}
+	}
+
+	void poll(std::vector<std::wstring> *changed, std::vector<std::wstring> *lost)
+	{
+		alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+
+		while (true)
+		{
+			ssize_t length = read(fd, buffer, sizeof(buffer));
+			if (length <= 0)
+			{
+				// EAGAIN, we've caught up
+				break;
+			}
+
+			for (char *p = buffer; p < buffer + length;)
+			{
+				inotify_event *event = (inotify_event*)p;
+				p += sizeof(inotify_event) + event->len;
+
+				if (event->mask & IN_Q_OVERFLOW)
+				{
+					// Missed some, so everything might have changed
+					for (auto &it : dirs)
+					{
+						changed->push_back(it.second);
+					}
+					continue;
+				}
+
+				auto it = dirs.find(event->wd);
+				if (it == dirs.end())
+				{
+					continue;
+				}
+
+				if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+				{
+					// The directory itself is gone (or moved), the watch is no good anymore
+					inotify_rm_watch(fd, event->wd);
+					lost->push_back(it->second);
+					dirs.erase(it);
+				}
+				else
+				{
+					changed->push_back(it->second);
+				}
+			}
+		}
+	}
+
+private:
+	int fd;
+	std::map<int, std::wstring> dirs;
+};
+
+FileWatcher* createFileWatcher()
+{
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+	{
+		return nullptr;
+	}
+
+	return new InotifyFileWatcher(fd);
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifdef _WIN32
+
+#include <Windows.h>
+
+#include "FileWatcher.h"
+
+// Change notification handles get signalled when anything in the directory
+// is renamed, written or resized, so checking them is just a zero timeout
+// wait. No threads needed.
+class Win32FileWatcher : public FileWatcher
+{
+public:
+	~Win32FileWatcher()
+	{
+		for (auto &it : handles)
+		{
+			FindCloseChangeNotification(it.second);
+		}
+	}
+
+	bool watch(const std::wstring &dir)
+	{
+		HANDLE handle = FindFirstChangeNotificationW(dir.c_str(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		handles[dir] = handle;
+		return true;
+	}
+
+	void unwatch(const std::wstring &dir)
+	{
+		auto it = handles.find(dir);
+		if (it != handles.end())
+		{
+			FindCloseChangeNotification(it->second);
+			handles.erase(it);
+		}
+	}
+
+	void poll(std::vector<std::wstring> *changed, std::vector<std::wstring> *lost)
+	{
+		for (auto it = handles.begin(); it != handles.end();)
+		{
+			if (WaitForSingleObject(it->second, 0) == WAIT_OBJECT_0)
+			{
+				changed->push_back(it->first);
+
+				// Wait for the next one. If that doesn't work (say, the
+				// directory got deleted) we can't watch it anymore.
+				if (!FindNextChangeNotification(it->second))
+				{
+					FindCloseChangeNotification(it->second);
+					lost->push_back(it->first);
+					it = handles.erase(it);
+					continue;
+				}
+			}
+
+			++it;
+		}
+	}
+
+private:
+	std::map<std::wstring, HANDLE> handles;
+};
+
+FileWatcher* createFileWatcher()
+{
+	return new Win32FileWatcher();
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include <vector>
+
+#include "BufferPool.h"
+#include "FrameCache.h"
+#include "Sampler.h"
+
+DecodedFrame::DecodedFrame(uint32_t *pixels, int w, int h, int fullW, int fullH, int decodeScale, bool isIcon) :
+	pixels(pixels), w(w), h(h), fullW(fullW), fullH(fullH), decodeScale(decodeScale), isIcon(isIcon),
+	pyramid(makeView(pixels, w, h), SAMPLE_MAX_DIMENSION)
+{
+}
+
+size_t DecodedFrame::bytesFor(int w, int h)
+{
+	return (size_t)w * h * sizeof(uint32_t) + MipPyramid::bytesFor(w, h, SAMPLE_MAX_DIMENSION);
+}
+
+DecodedFrame::~DecodedFrame()
+{
+	// Same as stbi_image_free, just without needing stb for it
+	poolFree((void*)pixels);
+}
+
+FrameCache::FrameCache(size_t maxBytes) :
+	maxBytes(maxBytes), bytes(0), clock(0)
+{
+}
+
+std::shared_ptr<const DecodedFrame> FrameCache::find(const std::wstring &path, uint64_t modified, uint64_t size)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto it = entries.find(path);
+	if (it == entries.end())
+	{
+		return nullptr;
+	}
+
+	// The file changed, what we have isn't any use to anyone any more
+	if (it->second.modified != modified || it->second.size != size)
+	{
+		bytes -= it->second.frame->bytes();
+		entries.erase(it);
+
+		return nullptr;
+	}
+
+	it->second.lastUsed = ++clock;
+
+	return it->second.frame;
+}
+
+void FrameCache::insert(const std::wstring &path, uint64_t modified, uint64_t size, std::shared_ptr<const DecodedFrame> frame)
+{
+	// Wouldn't fit even with everything else gone
+	if (frame == nullptr || frame->bytes() > maxBytes)
+	{
+		return;
+	}
+
+	// Frames that get dropped are freed once we're out of the lock
+	std::shared_ptr<const DecodedFrame> replaced;
+	std::vector< std::shared_ptr<const DecodedFrame> > dropped;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	Entry &entry = entries[path];
+	if (entry.frame != nullptr)
+	{
+		bytes -= entry.frame->bytes();
+		replaced = entry.frame;
+	}
+
+	entry.modified = modified;
+	entry.size = size;
+	entry.frame = frame;
+	entry.lastUsed = ++clock;
+	bytes += frame->bytes();
+
+	// Over budget, drop whatever was used the longest time ago. The new
+	// one is always the most recent, so it's never the one to go.
+	while (bytes > maxBytes)
+	{
+		auto oldest = entries.begin();
+		for (auto it = entries.begin(); it != entries.end(); ++it)
+		{
+			if (it->second.lastUsed < oldest->second.lastUsed)
+			{
+				oldest = it;
+			}
+		}
+
+		bytes -= oldest->second.frame->bytes();
+		dropped.push_back(oldest->second.frame);
+		entries.erase(oldest);
+	}
+}
+
+void FrameCache::clear()
+{
+	std::unordered_map<std::wstring, Entry> dropped;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		dropped.swap(entries);
+		bytes = 0;
+	}
+}
+
+size_t FrameCache::retained()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return bytes;
+}
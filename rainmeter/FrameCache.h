@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "MipPyramid.h"
+
+// Decoded images kept around for skins that move their crop around.
+// Animating CropX/CropY (or binding them to a variable) changes the crop
+// on every update, and without these every one of those meant reading and
+// decoding the whole file again just to look at a different part of it.
+//
+// Each file only ever has one frame, for whatever it held when it was
+// last decoded. Asking for it with a different modified time or size
+// throws it away.
+//
+// How big a frame a container is willing to keep (per container, see
+// FrameBudget in the readme)
+#define FRAME_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+// How much every frame together can add up to
+#define FRAME_CACHE_MAX_BYTES (256 * 1024 * 1024)
+
+// An RGBA image, straight out of the decoder, along with smaller copies of
+// it for crops that don't need every pixel. Frees its pixels (which came
+// from the buffer pool) when the last one using it lets go.
+struct DecodedFrame
+{
+	DecodedFrame(uint32_t *pixels, int w, int h, int fullW, int fullH, int decodeScale, bool isIcon);
+	~DecodedFrame();
+
+	DecodedFrame(const DecodedFrame&) = delete;
+	DecodedFrame& operator=(const DecodedFrame&) = delete;
+
+	size_t bytes() const { return (size_t)w * h * sizeof(uint32_t) + pyramid.bytes(); }
+
+	// What bytes() would come to for a w by h frame, before making one
+	static size_t bytesFor(int w, int h);
+
+	const uint32_t *pixels;
+	int w;
+	int h;
+
+	// How big the image in the file is, and how many times it got
+	// halved while decoding to get it down to w by h
+	int fullW;
+	int fullH;
+	int decodeScale;
+
+	// Came from the file's icon rather than the file itself
+	bool isIcon;
+
+	// Halved down to SAMPLE_MAX_DIMENSION, built once up front so every
+	// crop after can use it
+	MipPyramid pyramid;
+};
+
+// Safe to use from any thread. The frames themselves are never changed
+// once they're in here, so any number of threads can read one at once.
+class FrameCache
+{
+public:
+	FrameCache(size_t maxBytes = FRAME_CACHE_MAX_BYTES);
+
+	// The frame for a file, if we have one and the file hasn't changed
+	// since. nullptr otherwise.
+	std::shared_ptr<const DecodedFrame> find(const std::wstring &path, uint64_t modified, uint64_t size);
+
+	// Keep a frame, in place of any other one for the same file. Whatever
+	// was used the longest time ago gets dropped until everything fits.
+	void insert(const std::wstring &path, uint64_t modified, uint64_t size, std::shared_ptr<const DecodedFrame> frame);
+
+	// Let go of every frame (anyone still using one keeps it until they're done)
+	void clear();
+
+	// How many bytes of frames we're holding on to
+	size_t retained();
+
+private:
+	struct Entry
+	{
+		uint64_t modified;
+		uint64_t size;
+		std::shared_ptr<const DecodedFrame> frame;
+		uint64_t lastUsed;
+	};
+
+	std::mutex lock;
+	std::unordered_map<std::wstring, Entry> entries;
+	size_t maxBytes;
+	size_t bytes;
+	uint64_t clock;
+};
@@ -0,0 +1,109 @@
+#include <cstring>
+
+#include "Grid.h"
+
+// 3 bits each of red, green and blue
+#define GRID_BINS 512
+
+// Running totals for one cell
+struct CellTotals
+{
+	uint64_t sum[3];
+	uint64_t count;
+
+	uint32_t binCount[GRID_BINS];
+	uint64_t binSum[GRID_BINS][3];
+};
+
+// The same way around as ColorSet, red in the top byte and fully opaque
+static uint32_t packColor(uint64_t r, uint64_t g, uint64_t b, uint64_t count)
+{
+	if (count == 0)
+		return 0xFF;
+
+	uint32_t red = (uint32_t)((r + count / 2) / count);
+	uint32_t green = (uint32_t)((g + count / 2) / count);
+	uint32_t blue = (uint32_t)((b + count / 2) / count);
+
+	return (red << 24) | (green << 16) | (blue << 8) | 0xFF;
+}
+
+void analyzeGrid(const ImageView &view, int columns, int rows, GridColors *grid)
+{
+	grid->columns = columns;
+	grid->rows = rows;
+	grid->cells.assign((size_t)columns * rows, CellColors());
+
+	if (view.format.bytesPerPixel != 4 || view.w <= 0 || view.h <= 0)
+		return;
+
+	// Which cell each column of pixels falls in. The edges go in the same
+	// places as they do for rows below.
+	std::vector<int> columnCell(view.w);
+	for (int column = 0; column < columns; ++column)
+	{
+		int left = (int)((int64_t)column * view.w / columns);
+		int right = (int)((int64_t)(column + 1) * view.w / columns);
+
+		for (int x = left; x < right; ++x)
+		{
+			columnCell[x] = column;
+		}
+	}
+
+	// Only one row of cells is being added up at a time, and the pixels
+	// for it are all together, so every pixel still only gets read once
+	std::vector<CellTotals> totals(columns);
+
+	for (int row = 0; row < rows; ++row)
+	{
+		int top = (int)((int64_t)row * view.h / rows);
+		int bottom = (int)((int64_t)(row + 1) * view.h / rows);
+
+		memset(totals.data(), 0, totals.size() * sizeof(CellTotals));
+
+		for (int y = top; y < bottom; ++y)
+		{
+			const uint8_t *pixel = view.row(y);
+
+			for (int x = 0; x < view.w; ++x, pixel += 4)
+			{
+				CellTotals &cell = totals[columnCell[x]];
+				int bin = ((pixel[0] >> 5) << 6) | ((pixel[1] >> 5) << 3) | (pixel[2] >> 5);
+
+				cell.sum[0] += pixel[0];
+				cell.sum[1] += pixel[1];
+				cell.sum[2] += pixel[2];
+				cell.count++;
+
+				cell.binCount[bin]++;
+				cell.binSum[bin][0] += pixel[0];
+				cell.binSum[bin][1] += pixel[1];
+				cell.binSum[bin][2] += pixel[2];
+			}
+		}
+
+		for (int column = 0; column < columns; ++column)
+		{
+			const CellTotals &cell = totals[column];
+			CellColors &colors = grid->cells[(size_t)row * columns + column];
+
+			colors.avg = packColor(cell.sum[0], cell.sum[1], cell.sum[2], cell.count);
+
+			// Rec. 601 luma of the average
+			colors.lum = (0.299f * ((colors.avg >> 24) & 0xFF) + 0.587f * ((colors.avg >> 16) & 0xFF) + 0.114f * ((colors.avg >> 8) & 0xFF)) / 255.0f;
+
+			// First of the most common wins a tie
+			int best = 0;
+			for (int bin = 1; bin < GRID_BINS; ++bin)
+			{
+				if (cell.binCount[bin] > cell.binCount[best])
+				{
+					best = bin;
+				}
+			}
+
+			colors.dominant = packColor(cell.binSum[best][0], cell.binSum[best][1], cell.binSum[best][2], cell.binCount[best]);
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ImageView.h"
+
+// Colors for each cell of the image split up into a grid, for skins that
+// stretch across a whole monitor (taskbars and such) and want to fit in
+// with whatever's under each part of them, without a container for every
+// part.
+//
+// Most cells each way Grid= can ask for
+#define GRID_MAX_CELLS 16
+
+// One cell's worth. Colors are the same way around as ColorSet's.
+struct CellColors
+{
+	// Every pixel in the cell averaged together
+	uint32_t avg;
+
+	// How bright that average is, 0-1
+	float lum;
+
+	// The most common color in the cell (the average of whichever pixels
+	// are the most common once they're rounded to 3 bits a channel)
+	uint32_t dominant;
+};
+
+struct GridColors
+{
+	int columns;
+	int rows;
+
+	// Left to right, then top to bottom
+	std::vector<CellColors> cells;
+
+	// nullptr if the cell isn't in the grid
+	const CellColors* cell(int column, int row) const
+	{
+		if (column < 0 || column >= columns || row < 0 || row >= rows)
+			return nullptr;
+
+		return &cells[(size_t)row * columns + column];
+	}
+};
+
+// Splits an RGBA view into columns by rows cells (each between 1 and
+// GRID_MAX_CELLS) and works out the colors of all of them in one pass
+// over the pixels. Cells get as close to the same size as they can, so
+// a grid with more cells than pixels has some empty ones, which come out
+// black.
+void analyzeGrid(const ImageView &view, int columns, int rows, GridColors *grid);
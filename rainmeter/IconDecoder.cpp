@@ -0,0 +1,469 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "BufferPool.h"
+#include "ContentHash.h"
+#include "IconDecoder.h"
+#include "stb_image.h"
+
+// Resource types, from WinUser.h
+#define RESOURCE_ICON 3
+#define RESOURCE_GROUP_ICON 14
+
+// Bounds checked little-endian reads. Anything past the end reads as 0, so
+// a cut off or broken file just looks like one with nothing useful in it.
+struct Bytes
+{
+	const uint8_t *data;
+	size_t size;
+
+	bool has(size_t offset, size_t length) const
+	{
+		return offset <= size && length <= size - offset;
+	}
+
+	uint32_t u8(size_t offset) const
+	{
+		return has(offset, 1) ? data[offset] : 0;
+	}
+
+	uint32_t u16(size_t offset) const
+	{
+		return has(offset, 2) ? data[offset] | (data[offset + 1] << 8) : 0;
+	}
+
+	uint32_t u32(size_t offset) const
+	{
+		return has(offset, 4) ? data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) | ((uint32_t)data[offset + 3] << 24) : 0;
+	}
+};
+
+// One of the sizes an icon comes in, from an ICONDIRENTRY or GRPICONDIRENTRY
+struct IconEntry
+{
+	int w;
+	int h;
+	int bitCount;
+	const uint8_t *data;
+	size_t size;
+};
+
+static bool isPng(const uint8_t *data, size_t size)
+{
+	return size >= 8 && memcmp(data, "\x89PNG\r\n\x1A\n", 8) == 0;
+}
+
+static IconEntry makeEntry(const Bytes &dir, size_t offset, const uint8_t *data, size_t size)
+{
+	IconEntry entry;
+
+	// 0 means 256, since that doesn't fit in a byte
+	entry.w = dir.u8(offset) ? (int)dir.u8(offset) : 256;
+	entry.h = dir.u8(offset + 1) ? (int)dir.u8(offset + 1) : 256;
+	entry.bitCount = (int)dir.u16(offset + 6);
+	entry.data = data;
+	entry.size = size;
+
+	// PNGs are full color whatever the directory says
+	if (isPng(data, size))
+	{
+		entry.bitCount = std::max(entry.bitCount, 32);
+	}
+
+	return entry;
+}
+
+// Whether a makes a better icon to sample than b
+static bool betterIcon(const IconEntry &a, const IconEntry &b)
+{
+	int sizeA = std::max(a.w, a.h);
+	int sizeB = std::max(b.w, b.h);
+	bool bigA = sizeA >= ICON_TARGET_SIZE;
+	bool bigB = sizeB >= ICON_TARGET_SIZE;
+
+	if (bigA != bigB)
+		return bigA;
+
+	if (sizeA != sizeB)
+		return bigA ? sizeA < sizeB : sizeA > sizeB;
+
+	return a.bitCount > b.bitCount;
+}
+
+uint32_t* decodeIconImage(const uint8_t *data, size_t size, int *w, int *h)
+{
+	*w = -1;
+	*h = -1;
+
+	// Vista onwards stores the big ones as plain PNGs
+	if (isPng(data, size))
+	{
+		if (size > INT32_MAX)
+			return nullptr;
+
+		// Check the size before stb goes and allocates for it
+		int n;
+		if (!stbi_info_from_memory_format(data, (int)size, w, h, &n, STBI_FORMAT_PNG) || *w > ICON_MAX_DIMENSION || *h > ICON_MAX_DIMENSION)
+		{
+			*w = -1;
+			*h = -1;
+			return nullptr;
+		}
+
+		int scale = 0;
+		return (uint32_t*)stbi_load_from_memory_format(data, (int)size, w, h, &n, 4, &scale, STBI_FORMAT_PNG);
+	}
+
+	// Otherwise it's a DIB, with the height doubled to count the mask
+	Bytes bytes = { data, size };
+	uint32_t headerSize = bytes.u32(0);
+	int width = (int)bytes.u32(4);
+	int height = (int)bytes.u32(8) / 2;
+	int bitCount = (int)bytes.u16(14);
+	uint32_t compression = bytes.u32(16);
+	uint32_t colorsUsed = bytes.u32(32);
+
+	if (headerSize < 40 || width <= 0 || height <= 0 || width > ICON_MAX_DIMENSION || height > ICON_MAX_DIMENSION)
+		return nullptr;
+
+	// BI_RGB, or BI_BITFIELDS which only ever turns up on 32 bit ones with
+	// the usual masks
+	if (compression != 0 && !(compression == 3 && bitCount == 32))
+		return nullptr;
+
+	if (bitCount != 1 && bitCount != 4 && bitCount != 8 && bitCount != 24 && bitCount != 32)
+		return nullptr;
+
+	// Everything below is an offset from the header, so make sure each
+	// piece is actually there before adding the next one on. On 32 bit a
+	// huge headerSize would otherwise wrap around to somewhere small.
+	if (headerSize > size)
+		return nullptr;
+
+	size_t paletteOffset = headerSize + (compression == 3 && headerSize == 40 ? 12 : 0);
+	size_t paletteSize = 0;
+	if (bitCount <= 8)
+	{
+		paletteSize = colorsUsed != 0 && colorsUsed < (1u << bitCount) ? colorsUsed : (1u << bitCount);
+	}
+
+	if (!bytes.has(paletteOffset, paletteSize * 4))
+		return nullptr;
+
+	size_t colorOffset = paletteOffset + paletteSize * 4;
+	size_t colorStride = (((size_t)width * bitCount + 31) / 32) * 4;
+	size_t maskOffset = colorOffset + colorStride * height;
+	size_t maskStride = (((size_t)width + 31) / 32) * 4;
+
+	if (!bytes.has(colorOffset, colorStride * height))
+		return nullptr;
+
+	// The mask is meant to always be there, but if it isn't everything's
+	// just opaque
+	bool hasMask = bytes.has(maskOffset, maskStride * height);
+
+	// 32 bit icons from before XP have nothing in the alpha, and lean on
+	// the mask instead
+	bool hasAlpha = false;
+	if (bitCount == 32)
+	{
+		for (int y = 0; y < height && !hasAlpha; ++y)
+		{
+			const uint8_t *row = data + colorOffset + colorStride * y;
+			for (int x = 0; x < width; ++x)
+			{
+				if (row[x * 4 + 3] != 0)
+				{
+					hasAlpha = true;
+					break;
+				}
+			}
+		}
+	}
+
+	// Same place stb_image gets its memory, so stbi_image_free works on these too
+	uint8_t *pixels = (uint8_t*)poolAlloc((size_t)width * height * 4);
+	if (pixels == nullptr)
+		return nullptr;
+
+	for (int y = 0; y < height; ++y)
+	{
+		// Stored bottom-up
+		const uint8_t *src = data + colorOffset + colorStride * (height - 1 - y);
+		const uint8_t *mask = hasMask ? data + maskOffset + maskStride * (height - 1 - y) : nullptr;
+		uint8_t *dst = pixels + (size_t)y * width * 4;
+
+		for (int x = 0; x < width; ++x, dst += 4)
+		{
+			const uint8_t *bgr;
+			uint8_t alpha = 255;
+
+			switch (bitCount)
+			{
+			case 32:
+				bgr = src + x * 4;
+				alpha = hasAlpha ? bgr[3] : 255;
+				break;
+			case 24:
+				bgr = src + x * 3;
+				break;
+			default:
+			{
+				// Palette indexes, packed from the top bit down
+				int bit = x * bitCount;
+				int index = (src[bit / 8] >> (8 - bitCount - bit % 8)) & ((1 << bitCount) - 1);
+				bgr = (size_t)index < paletteSize ? data + paletteOffset + index * 4 : data + paletteOffset;
+				break;
+			}
+			}
+
+			// A set bit in the mask is a transparent pixel
+			if (!hasAlpha && mask != nullptr && (mask[x / 8] >> (7 - x % 8)) & 1)
+			{
+				alpha = 0;
+			}
+
+			dst[0] = bgr[2];
+			dst[1] = bgr[1];
+			dst[2] = bgr[0];
+			dst[3] = alpha;
+		}
+	}
+
+	*w = width;
+	*h = height;
+
+	return (uint32_t*)pixels;
+}
+
+// An .ico or .cur: ICONDIR, then an ICONDIRENTRY for each size pointing at
+// where its image is in the file
+static void findIconFileEntries(const Bytes &file, std::vector<IconEntry> *entries)
+{
+	uint32_t count = file.u16(4);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		size_t entry = 6 + (size_t)i * 16;
+		uint32_t length = file.u32(entry + 8);
+		uint32_t offset = file.u32(entry + 12);
+
+		if (!file.has(entry, 16) || !file.has(offset, length))
+			break;
+
+		entries->push_back(makeEntry(file, entry, file.data + offset, length));
+	}
+}
+
+// Enough of a PE file's layout to find things by RVA
+struct PeImage
+{
+	Bytes file;
+	size_t sections;
+	uint32_t sectionCount;
+
+	// Where in the file an RVA ends up, or 0 if it isn't in any section
+	size_t offset(uint32_t rva) const
+	{
+		for (uint32_t i = 0; i < sectionCount; ++i)
+		{
+			size_t section = sections + (size_t)i * 40;
+			uint32_t virtualSize = file.u32(section + 8);
+			uint32_t virtualAddress = file.u32(section + 12);
+			uint32_t rawSize = file.u32(section + 16);
+			uint32_t rawOffset = file.u32(section + 20);
+
+			if (rva >= virtualAddress && rva - virtualAddress < std::max(virtualSize, rawSize))
+			{
+				// Somewhere past the end of the file is as good as nowhere,
+				// and checking this way round can't wrap on 32 bit
+				if (!file.has(rawOffset, rva - virtualAddress))
+					return 0;
+
+				return (size_t)rawOffset + (rva - virtualAddress);
+			}
+		}
+
+		return 0;
+	}
+};
+
+// Finds the entry with this ID in an IMAGE_RESOURCE_DIRECTORY (or the first
+// one at all, for id < 0) and returns what it points at, relative to the
+// start of the resources. High bit set means another directory. 0 if it
+// isn't there.
+static uint32_t findResource(const Bytes &file, size_t resources, uint32_t directory, int id)
+{
+	if (!file.has(resources, directory))
+		return 0;
+
+	size_t dir = resources + directory;
+	uint32_t count = file.u16(dir + 12) + file.u16(dir + 14);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		size_t entry = dir + 16 + (size_t)i * 8;
+		if (!file.has(entry, 8))
+			break;
+
+		uint32_t name = file.u32(entry);
+
+		// Named entries come first and never match an ID
+		if (id < 0 || (!(name & 0x80000000) && name == (uint32_t)id))
+		{
+			return file.u32(entry + 4);
+		}
+	}
+
+	return 0;
+}
+
+// Walks type -> name -> language down to the data for a resource, taking
+// the first name (for id < 0) and whatever language comes first
+static bool loadResource(const PeImage &image, size_t resources, int type, int id, const uint8_t **data, size_t *size)
+{
+	uint32_t names = findResource(image.file, resources, 0, type);
+	if (!(names & 0x80000000))
+		return false;
+
+	uint32_t languages = findResource(image.file, resources, names & 0x7FFFFFFF, id);
+	if (!(languages & 0x80000000))
+		return false;
+
+	uint32_t entry = findResource(image.file, resources, languages & 0x7FFFFFFF, -1);
+	if (entry == 0 || (entry & 0x80000000))
+		return false;
+
+	// IMAGE_RESOURCE_DATA_ENTRY, which has an RVA rather than an offset
+	if (!image.file.has(resources, entry))
+		return false;
+
+	uint32_t rva = image.file.u32(resources + entry);
+	uint32_t length = image.file.u32(resources + entry + 4);
+	size_t offset = image.offset(rva);
+
+	if (offset == 0 || !image.file.has(offset, length))
+		return false;
+
+	*data = image.file.data + offset;
+	*size = length;
+
+	return true;
+}
+
+// A program: the first RT_GROUP_ICON is the one Explorer shows, and each
+// GRPICONDIRENTRY in it names the RT_ICON holding that size
+static void findProgramEntries(const Bytes &file, std::vector<IconEntry> *entries)
+{
+	size_t pe = file.u32(0x3C);
+	if (!file.has(pe, 24) || memcmp(file.data + pe, "PE\0\0", 4) != 0)
+		return;
+
+	PeImage image;
+	image.file = file;
+	image.sectionCount = file.u16(pe + 6);
+
+	size_t optional = pe + 24;
+	size_t optionalSize = file.u16(pe + 20);
+	image.sections = optional + optionalSize;
+
+	// The data directories start in a different place for 64 bit programs
+	uint32_t magic = file.u16(optional);
+	size_t directories;
+	if (magic == 0x10B)
+		directories = optional + 96;
+	else if (magic == 0x20B)
+		directories = optional + 112;
+	else
+		return;
+
+	// Resources are the third data directory
+	if (file.u32(directories - 4) < 3 || directories + 3 * 8 > optional + optionalSize)
+		return;
+
+	size_t resources = image.offset(file.u32(directories + 2 * 8));
+	if (resources == 0)
+		return;
+
+	const uint8_t *groupData;
+	size_t groupSize;
+	if (!loadResource(image, resources, RESOURCE_GROUP_ICON, -1, &groupData, &groupSize))
+		return;
+
+	Bytes group = { groupData, groupSize };
+	uint32_t count = group.u16(4);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		size_t entry = 6 + (size_t)i * 14;
+		if (!group.has(entry, 14))
+			break;
+
+		const uint8_t *iconData;
+		size_t iconSize;
+		if (loadResource(image, resources, RESOURCE_ICON, (int)group.u16(entry + 12), &iconData, &iconSize))
+		{
+			entries->push_back(makeEntry(group, entry, iconData, iconSize));
+		}
+	}
+}
+
+// Every size of icon in the file, best first
+static void findEntries(const uint8_t *data, size_t size, std::vector<IconEntry> *entries)
+{
+	Bytes file = { data, size };
+
+	if (file.has(0, 6) && file.u16(0) == 0 && (file.u16(2) == 1 || file.u16(2) == 2))
+	{
+		findIconFileEntries(file, entries);
+	}
+	else if (file.has(0, 64) && data[0] == 'M' && data[1] == 'Z')
+	{
+		findProgramEntries(file, entries);
+	}
+
+	std::stable_sort(entries->begin(), entries->end(), betterIcon);
+}
+
+uint32_t* decodeIcon(const uint8_t *data, size_t size, int *w, int *h)
+{
+	*w = -1;
+	*h = -1;
+
+	std::vector<IconEntry> entries;
+	findEntries(data, size, &entries);
+
+	// Tries each entry from best to worst until one decodes
+	for (const IconEntry &entry : entries)
+	{
+		uint32_t *pixels = decodeIconImage(entry.data, entry.size, w, h);
+		if (pixels != nullptr)
+		{
+			return pixels;
+		}
+	}
+
+	return nullptr;
+}
+
+bool hashIcon(const uint8_t *data, size_t size, uint64_t *hash)
+{
+	std::vector<IconEntry> entries;
+	findEntries(data, size, &entries);
+
+	if (entries.empty())
+		return false;
+
+	// In the order decodeIcon tries them, since which one it ends up with
+	// can depend on the ones before it not decoding
+	ContentHasher hasher;
+	for (const IconEntry &entry : entries)
+	{
+		hasher.update(entry.data, entry.size);
+	}
+
+	*hash = hasher.digest();
+
+	return true;
+}
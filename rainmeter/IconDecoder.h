@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Reading icons straight out of .ico/.cur files and the resources of
+// programs (.exe, .dll and the like), rather than asking the shell for
+// them. The shell way means a round trip through the system image list,
+// GDI bitmaps and a colour swap afterwards, and only works on Windows.
+//
+// The size of icon we'd most like, which is as big as sampling ever looks
+// at anyway. The smallest one at least this big wins, or the biggest one if
+// there isn't one that big, with more colors breaking a tie.
+#define ICON_TARGET_SIZE 256
+
+// Anything bigger than this in an icon is more likely broken than real
+#define ICON_MAX_DIMENSION 1024
+
+// Decodes the best icon in an .ico/.cur file, or the first icon group in a
+// program's resources, into the same RGBA layout stb_image uses (alpha
+// included). Handles PNG entries as well as 1, 4, 8, 24 and 32 bit ones.
+// The pixels come out of the buffer pool, so stbi_image_free frees them.
+// Returns nullptr if there's no icon we can read in there.
+uint32_t* decodeIcon(const uint8_t *data, size_t size, int *w, int *h);
+
+// The same for just one entry's worth of icon (a PNG, or a BITMAPINFOHEADER
+// followed by the colors and then the mask, like an .ico entry or an
+// RT_ICON resource)
+uint32_t* decodeIconImage(const uint8_t *data, size_t size, int *w, int *h);
+
+// A fingerprint of just the icons in an .ico/.cur file or program, for
+// telling when two files would decode to the same icon without decoding
+// either. Programs built from the same project usually share theirs, even
+// though the rest of the file differs. Reads the directories and hashes
+// the entries, so it's a fraction of what decoding them takes. Returns
+// false if there are no icons in there.
+bool hashIcon(const uint8_t *data, size_t size, uint64_t *hash);
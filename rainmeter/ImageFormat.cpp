@@ -0,0 +1,125 @@
+#include <cstring>
+
+#include "ImageFormat.h"
+#include "stb_image.h"
+
+static const wchar_t *formatNames[FORMAT_MAX] =
+{
+	L"Unknown",
+	L"JPEG",
+	L"PNG",
+	L"BMP",
+	L"GIF",
+	L"PSD",
+	L"PIC",
+	L"PNM",
+	L"HDR",
+	L"ICO",
+	L"Executable",
+	L"Shortcut",
+	L"WebP",
+	L"TIFF",
+	L"HEIF",
+	L"ZIP",
+	L"PDF",
+	L"Compound"
+};
+
+// Whether the file has these bytes at offset
+static bool hasBytes(const uint8_t *data, size_t size, size_t offset, const char *bytes, size_t length)
+{
+	return size >= offset + length && memcmp(data + offset, bytes, length) == 0;
+}
+
+ImageFormat sniffFormat(const uint8_t *data, size_t size)
+{
+	if (data == nullptr || size < 4)
+		return FORMAT_UNKNOWN;
+
+	// Images stb can read, checked the same way stb's own tests do
+	if (hasBytes(data, size, 0, "\xFF\xD8\xFF", 3))
+		return FORMAT_JPEG;
+
+	if (hasBytes(data, size, 0, "\x89PNG\r\n\x1A\n", 8))
+		return FORMAT_PNG;
+
+	if (hasBytes(data, size, 0, "GIF87a", 6) || hasBytes(data, size, 0, "GIF89a", 6))
+		return FORMAT_GIF;
+
+	if (hasBytes(data, size, 0, "BM", 2))
+		return FORMAT_BMP;
+
+	if (hasBytes(data, size, 0, "8BPS", 4))
+		return FORMAT_PSD;
+
+	if (hasBytes(data, size, 0, "\x53\x80\xF6\x34", 4) && hasBytes(data, size, 88, "PICT", 4))
+		return FORMAT_PIC;
+
+	// stb only does the binary greyscale and RGB ones
+	if (data[0] == 'P' && (data[1] == '5' || data[1] == '6'))
+		return FORMAT_PNM;
+
+	if (hasBytes(data, size, 0, "#?RADIANCE\n", 11) || hasBytes(data, size, 0, "#?RGBE\n", 7))
+		return FORMAT_HDR;
+
+	// Icons and cursors. A TGA could start with the same bytes, but never
+	// with an image count after them.
+	if ((hasBytes(data, size, 0, "\0\0\1\0", 4) || hasBytes(data, size, 0, "\0\0\2\0", 4)) && size >= 6 && (data[4] | data[5]) != 0)
+		return FORMAT_ICO;
+
+	// .exe, .dll, .cpl, .scr and friends
+	if (hasBytes(data, size, 0, "MZ", 2))
+		return FORMAT_EXECUTABLE;
+
+	if (hasBytes(data, size, 0, "\x4C\0\0\0\x01\x14\x02\0", 8))
+		return FORMAT_SHORTCUT;
+
+	if (hasBytes(data, size, 0, "RIFF", 4) && hasBytes(data, size, 8, "WEBP", 4))
+		return FORMAT_WEBP;
+
+	if (hasBytes(data, size, 0, "II*\0", 4) || hasBytes(data, size, 0, "MM\0*", 4))
+		return FORMAT_TIFF;
+
+	// HEIC, AVIF and anything else in an ISO media box
+	if (hasBytes(data, size, 4, "ftyp", 4))
+		return FORMAT_HEIF;
+
+	// Also .docx, .jar, .appx, ...
+	if (hasBytes(data, size, 0, "PK\3\4", 4))
+		return FORMAT_ZIP;
+
+	if (hasBytes(data, size, 0, "%PDF", 4))
+		return FORMAT_PDF;
+
+	// .msi, .doc, .xls and the like
+	if (hasBytes(data, size, 0, "\xD0\xCF\x11\xE0\xA1\xB1\x1A\xE1", 8))
+		return FORMAT_COMPOUND;
+
+	return FORMAT_UNKNOWN;
+}
+
+bool stbCanRead(ImageFormat format)
+{
+	return format <= FORMAT_HDR;
+}
+
+int stbFormat(ImageFormat format)
+{
+	switch (format)
+	{
+	case FORMAT_JPEG: return STBI_FORMAT_JPEG;
+	case FORMAT_PNG: return STBI_FORMAT_PNG;
+	case FORMAT_BMP: return STBI_FORMAT_BMP;
+	case FORMAT_GIF: return STBI_FORMAT_GIF;
+	case FORMAT_PSD: return STBI_FORMAT_PSD;
+	case FORMAT_PIC: return STBI_FORMAT_PIC;
+	case FORMAT_PNM: return STBI_FORMAT_PNM;
+	case FORMAT_HDR: return STBI_FORMAT_HDR;
+	default: return STBI_FORMAT_ANY;
+	}
+}
+
+const wchar_t *formatName(ImageFormat format)
+{
+	return format >= 0 && format < FORMAT_MAX ? formatNames[format] : L"Unknown";
+}
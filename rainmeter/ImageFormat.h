@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// What a file is, going by its first few bytes rather than its name.
+//
+// stb_image works this out by asking each of its decoders in turn, and
+// anything none of them want then goes off to the shell for its icon.
+// Knowing up front means images go straight to the one decoder that can
+// read them, and everything else (programs, shortcuts, WebPs, ...) goes
+// straight to its icon without being hashed or run past every decoder
+// first.
+enum ImageFormat
+{
+	// Nothing we recognize. Could still be a TGA, which doesn't have any
+	// magic bytes to go by, so stb gets to try everything.
+	FORMAT_UNKNOWN,
+
+	// What stb can read
+	FORMAT_JPEG,
+	FORMAT_PNG,
+	FORMAT_BMP,
+	FORMAT_GIF,
+	FORMAT_PSD,
+	FORMAT_PIC,
+	FORMAT_PNM,
+	FORMAT_HDR,
+
+	// What it can't, so it's the icon or nothing
+	FORMAT_ICO,
+	FORMAT_EXECUTABLE,
+	FORMAT_SHORTCUT,
+	FORMAT_WEBP,
+	FORMAT_TIFF,
+	FORMAT_HEIF,
+	FORMAT_ZIP,
+	FORMAT_PDF,
+	FORMAT_COMPOUND,
+
+	FORMAT_MAX
+};
+
+// Works out the format from however much of the start of the file we have
+// (16 bytes is enough for everything but PIC, which wants 92)
+ImageFormat sniffFormat(const uint8_t *data, size_t size);
+
+// Whether stb has a decoder for it (FORMAT_UNKNOWN included, since it might)
+bool stbCanRead(ImageFormat format);
+
+// The hint to hand stbi_load_from_memory_format for it
+int stbFormat(ImageFormat format);
+
+// Like JPEG or WebP, for logging
+const wchar_t *formatName(ImageFormat format);
@@ -0,0 +1,64 @@
+#include <cstring>
+
+#include "ImageView.h"
+
+const PixelFormat PIXEL_RGBA = { 4, 0x000000FF, 0x0000FF00, 0x00FF0000 };
+
+ImageView makeView(const uint32_t *pixels, int w, int h)
+{
+	return makeView(reinterpret_cast<const uint8_t*>(pixels), w, h, (ptrdiff_t)w * sizeof(uint32_t), PIXEL_RGBA);
+}
+
+ImageView makeView(const uint8_t *data, int w, int h, ptrdiff_t stride, const PixelFormat &format)
+{
+	ImageView view;
+	view.data = data;
+	view.w = w;
+	view.h = h;
+	view.stride = stride;
+	view.format = format;
+	return view;
+}
+
+ImageView cropView(const ImageView &view, int left, int top, int right, int bottom)
+{
+	if (left > view.w || top > view.h)
+	{
+		return view;
+	}
+
+	if (left < 0)
+		left = 0;
+	if (top < 0)
+		top = 0;
+	if (right > view.w)
+		right = view.w;
+	if (bottom > view.h)
+		bottom = view.h;
+
+	ImageView result = view;
+	result.w = right - left;
+	result.h = bottom - top;
+
+	if (result.w > 0 && result.h > 0)
+	{
+		result.data = view.row(top) + (ptrdiff_t)left * view.format.bytesPerPixel;
+	}
+
+	return result;
+}
+
+bool copyView(const ImageView &view, uint32_t *pixels)
+{
+	if (view.format.bytesPerPixel == 4 && view.format.rMask == PIXEL_RGBA.rMask && view.format.gMask == PIXEL_RGBA.gMask && view.format.bMask == PIXEL_RGBA.bMask)
+	{
+		for (int y = 0; y < view.h; ++y)
+		{
+			memcpy(&pixels[(size_t)y * view.w], view.row(y), view.w * sizeof(uint32_t));
+		}
+
+		return true;
+	}
+
+	return convertPixels(pixels, view.data, view.w, view.h, view.stride, &view.format);
+}
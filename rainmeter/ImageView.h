@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "PixelConvert.h"
+
+// RGBA with red in the lowest byte. What stb_image hands back, and what
+// everything after decoding works in.
+extern const PixelFormat PIXEL_RGBA;
+
+// A window onto pixels somebody else owns. Cropping one is just pointer
+// math, nothing gets copied, so whoever owns the pixels has to keep them
+// around for as long as the view is in use.
+struct ImageView
+{
+	const uint8_t *data;
+	int w;
+	int h;
+
+	// Bytes from the start of one row to the next
+	ptrdiff_t stride;
+
+	PixelFormat format;
+
+	const uint8_t* row(int y) const { return data + y * stride; }
+
+	// Rows follow each other with no gaps (so it can be handed to things
+	// that just want a pointer and a size)
+	bool contiguous() const { return stride == (ptrdiff_t)w * format.bytesPerPixel; }
+};
+
+// View a packed RGBA image
+ImageView makeView(const uint32_t *pixels, int w, int h);
+
+// View anything else
+ImageView makeView(const uint8_t *data, int w, int h, ptrdiff_t stride, const PixelFormat &format);
+
+// Crop a view to [left, right) x [top, bottom). The edges are clamped to the
+// view, and if the rectangle starts past the right/bottom edge the view comes
+// back untouched (the same as cropping always has). Anything else that ends
+// up empty comes back with a width or height <= 0.
+ImageView cropView(const ImageView &view, int left, int top, int right, int bottom);
+
+// Copy a view into a packed buffer of w * h RGBA pixels, converting it if
+// it's in some other format. Returns false if it's a format convertPixels
+// can't handle.
+bool copyView(const ImageView &view, uint32_t *pixels);
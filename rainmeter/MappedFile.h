@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A whole file mapped into memory read-only, so it can be hashed and
+// decoded straight out of the page cache instead of being copied through
+// stdio a little at a time. Each platform has its own open/close (see
+// MappedFileWin32.cpp and MappedFilePosix.cpp).
+//
+// Whoever mapped it has to keep it open for as long as they're looking at
+// data(), and nobody should be writing to the file in the meantime.
+//
+// Files on network drives get read into a buffer instead. A mapping of one
+// of those faults when the share drops out, where a read just fails.
+class MappedFile
+{
+public:
+	MappedFile() : bytes(nullptr), length(0), owned(false) {}
+	~MappedFile() { close(); }
+
+	// Returns false if it couldn't be opened or mapped. An empty file opens
+	// fine, there's just nothing to look at.
+	bool open(const std::wstring &path);
+	void close();
+
+	const uint8_t *data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	// No copying, there's only one mapping to unmap
+	MappedFile(const MappedFile&) = delete;
+	MappedFile &operator=(const MappedFile&) = delete;
+
+	const uint8_t *bytes;
+	size_t length;
+
+	// Read into a buffer from the pool rather than mapped
+	bool owned;
+};
@@ -0,0 +1,65 @@
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MappedFile.h"
+#include "PathPosix.h"
+
+bool MappedFile::open(const std::wstring &path)
+{
+	close();
+
+	int fd = ::open(toUtf8(path).c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+	{
+		::close(fd);
+		return false;
+	}
+
+	// mmap won't take a length of zero
+	if (info.st_size == 0)
+	{
+		::close(fd);
+		return true;
+	}
+
+	void *mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// The mapping holds its own reference to the file
+	::close(fd);
+
+	if (mapped == MAP_FAILED)
+	{
+		return false;
+	}
+
+	// It's going to be read front to back, once
+	madvise(mapped, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+	bytes = (const uint8_t*)mapped;
+	length = (size_t)info.st_size;
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (bytes != nullptr)
+	{
+		munmap((void*)bytes, length);
+	}
+
+	bytes = nullptr;
+	length = 0;
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifdef _WIN32
+
+#include <Windows.h>
+
+#include "BufferPool.h"
+#include "MappedFile.h"
+
+// UNC paths and mapped network drives
+static bool isRemote(const std::wstring &path)
+{
+	if (path.compare(0, 2, L"\\\\") == 0)
+	{
+		return true;
+	}
+
+	if (path.size() >= 2 && path[1] == L':')
+	{
+		wchar_t root[] = { path[0], L':', L'\\', 0 };
+		return GetDriveTypeW(root) == DRIVE_REMOTE;
+	}
+
+	return false;
+}
+
+// Reads the whole thing into a buffer from the pool
+static const uint8_t *readWhole(HANDLE file, size_t length)
+{
+	uint8_t *buffer = (uint8_t*)poolAlloc(length);
+	if (buffer == nullptr)
+	{
+		return nullptr;
+	}
+
+	size_t done = 0;
+	while (done < length)
+	{
+		DWORD chunk = (DWORD)(length - done < 0x40000000 ? length - done : 0x40000000);
+		DWORD got = 0;
+
+		if (!ReadFile(file, buffer + done, chunk, &got, NULL) || got == 0)
+		{
+			poolFree(buffer);
+			return nullptr;
+		}
+
+		done += got;
+	}
+
+	return buffer;
+}
+
+bool MappedFile::open(const std::wstring &path)
+{
+	close();
+
+	// Only sharing reads, same as _wfopen_s did, so nobody can change the
+	// file out from under the mapping
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || (ULONGLONG)fileSize.QuadPart > (SIZE_T)-1)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	// Windows won't map an empty file
+	if (fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return true;
+	}
+
+	if (isRemote(path))
+	{
+		bytes = readWhole(file, (size_t)fileSize.QuadPart);
+		owned = true;
+	}
+	else
+	{
+		HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+		{
+			bytes = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+			// The view keeps everything it needs alive
+			CloseHandle(mapping);
+		}
+	}
+
+	CloseHandle(file);
+
+	if (bytes == nullptr)
+	{
+		owned = false;
+		return false;
+	}
+
+	length = (size_t)fileSize.QuadPart;
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (bytes != nullptr)
+	{
+		if (owned)
+		{
+			poolFree((void*)bytes);
+		}
+		else
+		{
+			UnmapViewOfFile(bytes);
+		}
+	}
+
+	bytes = nullptr;
+	length = 0;
+	owned = false;
+}
+
+#endif
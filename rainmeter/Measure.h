@@ -1,78 +1,160 @@
-#pragma once
-
-enum MeasureType
-{
-	MEASURE_CONTAINER,
-	MEASURE_BG1,
-	MEASURE_BG2,
-	MEASURE_FG1,
-	MEASURE_FG2,
-	MEASURE_AVG_LUM,
-	MEASURE_AVG_COLOR,
-	MEASURE_L1,
-	MEASURE_L2,
-	MEASURE_L3,
-	MEASURE_L4,
-	MEASURE_D1,
-	MEASURE_D2,
-	MEASURE_D3,
-	MEASURE_D4
-};
-
-enum ImageType
-{
-	IMG_DESKTOP,
-	IMG_FILE
-};
-
-struct Image
-{
-	void *rm;
-	void *skin;
-	HWND hWnd;
-	std::wstring name;
-	ImageType type;
-	std::wstring path;
-	FILETIME lastMod;
-	RECT cropRect;
-	RECT cachedCrop;
-	LONG skinX;
-	LONG skinY;
-	bool draggingSkin;
-	bool dirty;
-	bool forceIcon;
-	bool customCrop;
-	bool contextAware;
-	RECT contextRect;
-
-	uint32_t bg1;
-	uint32_t bg2;
-	uint32_t fg1;
-	uint32_t fg2;
-
-	uint32_t l1;
-	uint32_t l2;
-	uint32_t l3;
-	uint32_t l4;
-
-	uint32_t d1;
-	uint32_t d2;
-	uint32_t d3;
-	uint32_t d4;
-
-	uint32_t fallback_bg1;
-	uint32_t fallback_bg2;
-	uint32_t fallback_fg1;
-	uint32_t fallback_fg2;
-
-	float lum;
-	uint32_t avg;
-};
-
-struct Measure
-{
-	MeasureType type;
-	std::shared_ptr<Image> parent;
-	bool useHex;
-	std::wstring value;
-};
+#pragma once
+
+#include "ColorSet.h"
+#include "Counters.h"
+#include "Stats.h"
+#include "SampleRegistry.h"
+#include "Sampler.h"
+
+enum MeasureType
+{
+	MEASURE_CONTAINER,
+	MEASURE_BG1,
+	MEASURE_BG2,
+	MEASURE_FG1,
+	MEASURE_FG2,
+	MEASURE_AVG_LUM,
+	MEASURE_AVG_COLOR,
+	MEASURE_L1,
+	MEASURE_L2,
+	MEASURE_L3,
+	MEASURE_L4,
+	MEASURE_D1,
+	MEASURE_D2,
+	MEASURE_D3,
+	MEASURE_D4,
+	MEASURE_COUNTER,
+	MEASURE_STATS,
+	MEASURE_CELL_AVG_COLOR,
+	MEASURE_CELL_AVG_LUM,
+	MEASURE_CELL_DOMINANT,
+
+	// A child whose Parent= or Color= didn't make sense. Reports nothing.
+	MEASURE_INVALID
+};
+
+enum ImageType
+{
+	IMG_DESKTOP,
+	IMG_FILE
+};
+
+struct Image
+{
+	void *rm;
+	void *skin;
+	HWND hWnd;
+	std::wstring name;
+	ImageType type;
+	std::wstring path;
+	FILETIME lastMod;
+	uint64_t fileSize;
+
+	// The path we've asked the change notifier to keep an eye on, and
+	// the last change we saw
+	std::wstring watchedPath;
+	uint64_t watchSeen;
+
+	RECT cropRect;
+	RECT cachedCrop;
+	LONG skinX;
+	LONG skinY;
+	bool draggingSkin;
+	bool dirty;
+	bool forceIcon;
+	bool customCrop;
+	bool contextAware;
+	RECT contextRect;
+	RECT cachedContext;
+
+	// How big images get shrunk down for sampling
+	SampleMode sampleMode;
+	int sampleBudget;
+
+	// How big a decoded image can be and still be kept around for when
+	// the crop changes, in bytes (0 to never keep it)
+	size_t frameBudget;
+
+	// How many cells across and down to work out colors for, 0 for none
+	int gridColumns;
+	int gridRows;
+
+	// The skin moved (or the context area changed), so the colors need
+	// shuffling again but the image itself is the same
+	bool contextDirty;
+
+	uint32_t fallback_bg1;
+	uint32_t fallback_bg2;
+	uint32_t fallback_fg1;
+	uint32_t fallback_fg2;
+
+	// Only ever read/written with std::atomic_load/std::atomic_store
+	// since the worker thread publishes new sets while children read them
+	std::shared_ptr<const ColorSet> colors;
+
+	// Same deal, for the cells. nullptr when there aren't any (or the
+	// image couldn't be sampled).
+	std::shared_ptr<const GridColors> grid;
+
+	// The sample we're following, if it's one that can be shared with
+	// other containers, and the last generation of it we picked up
+	std::shared_ptr<SharedSample> shared;
+	uint64_t sharedGeneration;
+};
+
+// Everything the worker thread needs to sample an image, copied out of
+// the Image when the job is queued so the worker never touches state the
+// main thread might be changing
+struct SampleJob
+{
+	ImageType type;
+	std::wstring path;
+
+	// Read the desktop straight from the screen rather than the file
+	bool captureDesktop;
+	bool is24H2;
+
+	bool forceIcon;
+	bool customCrop;
+	RECT cropRect;
+
+	SampleMode sampleMode;
+	int sampleBudget;
+	size_t frameBudget;
+	int gridColumns;
+	int gridRows;
+
+	// Keep the capture around for finding the area under each skin
+	bool contextAware;
+
+	// The monitor the skin is on, in virtual screen coordinates
+	RECT monitor;
+
+	// Identity of the file, as of when the job was queued
+	uint64_t modified;
+	uint64_t size;
+};
+
+struct Measure
+{
+	MeasureType type;
+	std::shared_ptr<Image> parent;
+
+	// Whether this measure created its parent (and so counts towards
+	// containerCount), rather than just being a child reading from it
+	bool ownsImage;
+
+	bool useHex;
+	std::wstring value;
+
+	// Which counter a MEASURE_COUNTER reports
+	Counter counter;
+
+	// Which figure for which stage a MEASURE_STATS reports
+	Stage stage;
+	Stat stat;
+
+	// Which cell a MEASURE_CELL_* reports, from the top left
+	int cellColumn;
+	int cellRow;
+};
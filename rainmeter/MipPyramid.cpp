@@ -0,0 +1,217 @@
+#include <algorithm>
+
+#include "BufferPool.h"
+#include "MipPyramid.h"
+#include "ThreadPool.h"
+
+// Levels are halved a band of rows per task; each output row only needs
+// two input rows, so bands can be bigger than Downsample's
+#define PYRAMID_BAND_ROWS 32
+
+#ifdef PIXEL_X86
+#include <emmintrin.h>
+#endif
+
+// Averages pixels [x * 2, x * 2 + 1] of two rows into dst[x], for x from
+// first up to (not including) last, rounding to the nearest
+static void reduceRowScalar(const uint8_t *top, const uint8_t *bottom, uint8_t *dst, int first, int last)
+{
+	for (int x = first; x < last; ++x)
+	{
+		const uint8_t *a = top + x * 8;
+		const uint8_t *b = bottom + x * 8;
+
+		for (int c = 0; c < 4; ++c)
+		{
+			dst[x * 4 + c] = (uint8_t)((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) >> 2);
+		}
+	}
+}
+
+#ifdef PIXEL_X86
+// Four destination pixels at a time: add the rows together as 16 bit,
+// then each pixel to its neighbour, then back down to bytes
+static void reduceRowSSE2(const uint8_t *top, const uint8_t *bottom, uint8_t *dst, int first, int last)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	int x = first;
+
+	for (; x + 4 <= last; x += 4)
+	{
+		__m128i t0 = _mm_loadu_si128((const __m128i*)(top + x * 8));
+		__m128i t1 = _mm_loadu_si128((const __m128i*)(top + x * 8 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(bottom + x * 8));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(bottom + x * 8 + 16));
+
+		// Top + bottom, two source pixels to a register
+		__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(t0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(t0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(t1, zero), _mm_unpacklo_epi8(b1, zero));
+		__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(t1, zero), _mm_unpackhi_epi8(b1, zero));
+
+		// Left + right, one destination pixel to each half
+		__m128i h0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+		__m128i h1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+
+		h0 = _mm_srli_epi16(_mm_add_epi16(h0, two), 2);
+		h1 = _mm_srli_epi16(_mm_add_epi16(h1, two), 2);
+
+		_mm_storeu_si128((__m128i*)(dst + x * 4), _mm_packus_epi16(h0, h1));
+	}
+
+	reduceRowScalar(top, bottom, dst, x, last);
+}
+#endif
+
+// Halves src into dst, which is (src.w + 1) / 2 by (src.h + 1) / 2
+static void reduceLevel(const ImageView &src, uint32_t *dst, PixelKernel kernel)
+{
+	void (*reduceRow)(const uint8_t*, const uint8_t*, uint8_t*, int, int) = reduceRowScalar;
+
+#ifdef PIXEL_X86
+	if (kernel != PIXEL_KERNEL_SCALAR && bestPixelKernel() != PIXEL_KERNEL_SCALAR)
+		reduceRow = reduceRowSSE2;
+#endif
+
+	int dstW = (src.w + 1) / 2;
+	int dstH = (src.h + 1) / 2;
+
+	// Destination pixels with a whole 2x2 block behind them
+	int pairs = src.w / 2;
+
+	parallelFor(dstH, PYRAMID_BAND_ROWS, [&](int first, int last)
+	{
+		for (int y = first; y < last; ++y)
+		{
+			// An odd last row gets averaged with itself
+			const uint8_t *top = src.row(y * 2);
+			const uint8_t *bottom = src.row(std::min(y * 2 + 1, src.h - 1));
+			uint8_t *out = (uint8_t*)&dst[(size_t)y * dstW];
+
+			reduceRow(top, bottom, out, 0, pairs);
+
+			// And so does an odd last column
+			if (pairs < dstW)
+			{
+				const uint8_t *a = top + pairs * 8;
+				const uint8_t *b = bottom + pairs * 8;
+
+				for (int c = 0; c < 4; ++c)
+				{
+					out[pairs * 4 + c] = (uint8_t)((a[c] * 2 + b[c] * 2 + 2) >> 2);
+				}
+			}
+		}
+	});
+}
+
+// Size of the level after a w by h one, false if there isn't one
+static bool nextLevel(int *w, int *h, int minSize)
+{
+	int nextW = (*w + 1) / 2;
+	int nextH = (*h + 1) / 2;
+
+	if (nextW < minSize || nextH < minSize)
+		return false;
+
+	// 1x1 halves to 1x1, so a minSize of 1 would never stop otherwise
+	if (nextW == *w && nextH == *h)
+		return false;
+
+	*w = nextW;
+	*h = nextH;
+
+	return true;
+}
+
+MipPyramid::MipPyramid(const ImageView &view, int minSize, PixelKernel kernel) :
+	retained(0)
+{
+	views.push_back(view);
+
+	if (view.format.bytesPerPixel != 4 || minSize < 1)
+		return;
+
+	int w = view.w;
+	int h = view.h;
+
+	while (nextLevel(&w, &h, minSize))
+	{
+		const ImageView &last = views.back();
+
+		// Out of memory just means fewer levels. Crops get read from a
+		// bigger one than they could have been, but they still work.
+		uint32_t *pixels = (uint32_t*)poolAlloc((size_t)w * h * sizeof(uint32_t));
+		if (pixels == nullptr)
+			break;
+
+		reduceLevel(last, pixels, kernel);
+
+		buffers.push_back(pixels);
+		views.push_back(makeView(pixels, w, h));
+		retained += (size_t)w * h * sizeof(uint32_t);
+	}
+}
+
+size_t MipPyramid::bytesFor(int w, int h, int minSize)
+{
+	size_t total = 0;
+
+	if (minSize < 1)
+		return 0;
+
+	while (nextLevel(&w, &h, minSize))
+	{
+		total += (size_t)w * h * sizeof(uint32_t);
+	}
+
+	return total;
+}
+
+MipPyramid::~MipPyramid()
+{
+	for (uint32_t *pixels : buffers)
+	{
+		poolFree(pixels);
+	}
+}
+
+ImageView MipPyramid::region(int left, int top, int right, int bottom, int minSize, int *scale) const
+{
+	const ImageView &full = views[0];
+
+	// Same rules as cropView: starting past the edge means the whole thing
+	if (left > full.w || top > full.h)
+	{
+		left = top = 0;
+		right = full.w;
+		bottom = full.h;
+	}
+
+	left = std::max(left, 0);
+	top = std::max(top, 0);
+	right = std::min(right, full.w);
+	bottom = std::min(bottom, full.h);
+
+	int level = 0;
+
+	if (right > left && bottom > top)
+	{
+		while (level + 1 < levels() && ((right - left) >> (level + 1)) >= minSize && ((bottom - top) >> (level + 1)) >= minSize)
+		{
+			++level;
+		}
+	}
+
+	if (scale != nullptr)
+		*scale = level;
+
+	if (level == 0)
+		return cropView(full, left, top, right, bottom);
+
+	// Round the far edges up so we don't lose a sliver along them
+	int round = (1 << level) - 1;
+
+	return cropView(views[level], left >> level, top >> level, (right + round) >> level, (bottom + round) >> level);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ImageView.h"
+#include "PixelConvert.h"
+
+// An image along with copies of it at half size, quarter size and so on,
+// each made by averaging 2x2 blocks of the one before. Several crops of the
+// same image (or the same crop at different sizes) can then each be read
+// from the smallest copy that still has as much detail as they need,
+// rather than all of them going through every pixel of the full size one.
+//
+// Odd widths/heights round up, the last column/row being averaged with
+// itself. Every kernel gives exactly the same output.
+class MipPyramid
+{
+public:
+	// Keeps halving the view (which has to be RGBA) for as long as the
+	// result is still at least minSize pixels each way (or until there's
+	// no memory for the next one). The view itself is the first level and
+	// doesn't get copied, so the pixels it points at have to be around for
+	// as long as the pyramid is.
+	MipPyramid(const ImageView &view, int minSize, PixelKernel kernel = PIXEL_KERNEL_AUTO);
+	~MipPyramid();
+
+	MipPyramid(const MipPyramid&) = delete;
+	MipPyramid& operator=(const MipPyramid&) = delete;
+
+	// How many levels there are, including the full size one
+	int levels() const { return (int)views.size(); }
+
+	// Level 0 is the original, each one after is half the size of the last
+	const ImageView& level(int i) const { return views[i]; }
+
+	// Crops to [left, right) x [top, bottom) of the original, the same as
+	// cropView would, but out of the smallest level that's still at least
+	// minSize pixels each way for that area. The edges get rounded outwards
+	// on the smaller levels. scale (if given) gets which level it was.
+	ImageView region(int left, int top, int right, int bottom, int minSize, int *scale = nullptr) const;
+
+	// Memory used by the smaller levels
+	size_t bytes() const { return retained; }
+
+	// What bytes() would come to for a w by h image, without building it
+	static size_t bytesFor(int w, int h, int minSize);
+
+private:
+	std::vector<ImageView> views;
+	std::vector<uint32_t*> buffers;
+	size_t retained;
+};
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "PaletteCache.h"
+
+// Bump this whenever the way we sample changes, so old palettes get thrown out
+#define PALETTE_CACHE_VERSION 4
+
+static const char paletteCacheMagic[4] = { 'C', 'H', 'P', 'C' };
+
+PaletteCache::PaletteCache(size_t maxEntries) :
+	maxEntries(maxEntries), clock(0), dirty(false)
+{
+}
+
+bool PaletteCache::find(const PaletteKey &key, ColorSet *colors)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto it = entries.find(makeKey(key));
+	if (it == entries.end())
+	{
+		return false;
+	}
+
+	it->second.lastUsed = ++clock;
+	*colors = it->second.colors;
+
+	return true;
+}
+
+void PaletteCache::insert(const PaletteKey &key, const ColorSet &colors)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	Entry &entry = entries[makeKey(key)];
+	entry.colors = colors;
+	entry.lastUsed = ++clock;
+	dirty = true;
+
+	// Over budget, drop whatever was used the longest time ago
+	if (entries.size() > maxEntries)
+	{
+		auto oldest = entries.begin();
+		for (auto it = entries.begin(); it != entries.end(); ++it)
+		{
+			if (it->second.lastUsed < oldest->second.lastUsed)
+			{
+				oldest = it;
+			}
+		}
+
+		entries.erase(oldest);
+	}
+}
+
+void PaletteCache::clear()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	entries.clear();
+	dirty = true;
+}
+
+bool PaletteCache::load(FILE *fp)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	entries.clear();
+	clock = 0;
+	dirty = false;
+
+	char magic[4];
+	uint32_t version, count;
+
+	if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, paletteCacheMagic, sizeof(magic)) != 0)
+		return false;
+	if (fread(&version, sizeof(version), 1, fp) != 1 || version != PALETTE_CACHE_VERSION)
+		return false;
+	if (fread(&count, sizeof(count), 1, fp) != 1)
+		return false;
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t keySize;
+		if (fread(&keySize, sizeof(keySize), 1, fp) != 1 || keySize > 65536)
+		{
+			entries.clear();
+			return false;
+		}
+
+		std::string key(keySize, '\0');
+		Entry entry;
+
+		if ((keySize > 0 && fread(&key[0], keySize, 1, fp) != 1) || fread(&entry.colors, sizeof(entry.colors), 1, fp) != 1)
+		{
+			entries.clear();
+			return false;
+		}
+
+		// The file is in least recently used order
+		entry.lastUsed = ++clock;
+		entries[key] = entry;
+	}
+
+	return true;
+}
+
+bool PaletteCache::save(FILE *fp)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	std::vector<const std::pair<const std::string, Entry>*> sorted;
+	sorted.reserve(entries.size());
+	for (const auto &entry : entries)
+	{
+		sorted.push_back(&entry);
+	}
+
+	std::sort(sorted.begin(), sorted.end(), [](const std::pair<const std::string, Entry> *a, const std::pair<const std::string, Entry> *b)
+	{
+		return a->second.lastUsed < b->second.lastUsed;
+	});
+
+	uint32_t version = PALETTE_CACHE_VERSION;
+	uint32_t count = (uint32_t)sorted.size();
+
+	bool ok = fwrite(paletteCacheMagic, sizeof(paletteCacheMagic), 1, fp) == 1;
+	ok = ok && fwrite(&version, sizeof(version), 1, fp) == 1;
+	ok = ok && fwrite(&count, sizeof(count), 1, fp) == 1;
+
+	for (size_t i = 0; ok && i < sorted.size(); ++i)
+	{
+		const std::string &key = sorted[i]->first;
+		uint32_t keySize = (uint32_t)key.size();
+
+		ok = fwrite(&keySize, sizeof(keySize), 1, fp) == 1;
+		ok = ok && (keySize == 0 || fwrite(key.data(), keySize, 1, fp) == 1);
+		ok = ok && fwrite(&sorted[i]->second.colors, sizeof(ColorSet), 1, fp) == 1;
+	}
+
+	if (ok)
+	{
+		dirty = false;
+	}
+
+	return ok;
+}
+
+bool PaletteCache::changed()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return dirty;
+}
+
+std::string PaletteCache::makeKey(const PaletteKey &key)
+{
+	// Just pack everything into a string of bytes, it only has to match
+	// keys built by this same code
+	std::string result;
+	result.reserve(key.path.size() * sizeof(wchar_t) + 64);
+
+	result.append(reinterpret_cast<const char*>(&key.modified), sizeof(key.modified));
+	result.append(reinterpret_cast<const char*>(&key.size), sizeof(key.size));
+	result.append(reinterpret_cast<const char*>(key.crop), sizeof(key.crop));
+	result.append(reinterpret_cast<const char*>(key.monitor), sizeof(key.monitor));
+	result.push_back(key.forceIcon ? 1 : 0);
+	result.push_back((char)key.sampleMode);
+	result.append(reinterpret_cast<const char*>(&key.sampleBudget), sizeof(key.sampleBudget));
+	result.append(reinterpret_cast<const char*>(key.grid), sizeof(key.grid));
+	result.push_back(key.capture ? 1 : 0);
+	result.push_back(key.keepContext ? 1 : 0);
+	result.append(reinterpret_cast<const char*>(key.path.data()), key.path.size() * sizeof(wchar_t));
+
+	return result;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "ColorSet.h"
+
+// Everything a sampled palette depends on. If none of it changed, the
+// colors won't have either, so there's no need to decode the file again.
+struct PaletteKey
+{
+	std::wstring path;
+
+	// Identity of the file on disk
+	uint64_t modified;
+	uint64_t size;
+
+	// left, top, right, bottom, all zero when not cropping
+	int32_t crop[4];
+
+	// The monitor the crop was mapped onto, when that matters
+	int32_t monitor[4];
+
+	bool forceIcon;
+
+	// SampleMode, and the budget when it has one (0 otherwise)
+	uint8_t sampleMode;
+	int32_t sampleBudget;
+
+	// Grid columns and rows, both 0 without one
+	uint8_t grid[2];
+
+	// Read from the screen rather than the file, and whether the whole
+	// capture is kept for context aware colors
+	bool capture;
+	bool keepContext;
+};
+
+// Palettes we've already worked out, kept around between Rainmeter
+// sessions so loading a pile of skins doesn't mean decoding a pile of
+// wallpapers again.
+//
+// The colors stored are the ones straight out of Chameleon, before any
+// context aware shuffling, since that depends on where the skin is.
+//
+// Safe to use from any thread. Reading/writing the file is left to the
+// caller so this doesn't need to know where it lives or how to open it.
+class PaletteCache
+{
+public:
+	PaletteCache(size_t maxEntries = 512);
+
+	bool find(const PaletteKey &key, ColorSet *colors);
+	void insert(const PaletteKey &key, const ColorSet &colors);
+
+	// Forget everything
+	void clear();
+
+	// Replace whatever we have with the contents of a cache file.
+	// Returns false (and leaves us empty) if it isn't one we understand.
+	bool load(FILE *fp);
+
+	// Write everything out, least recently used first
+	bool save(FILE *fp);
+
+	// Whether anything was added since the last load/save
+	bool changed();
+
+	// Packs a key into bytes, two keys match if their bytes do
+	static std::string makeKey(const PaletteKey &key);
+
+private:
+	struct Entry
+	{
+		ColorSet colors;
+		uint64_t lastUsed;
+	};
+
+	std::mutex lock;
+	std::unordered_map<std::string, Entry> entries;
+	size_t maxEntries;
+	uint64_t clock;
+	bool dirty;
+};
@@ -0,0 +1,42 @@
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <cstdint>
+
+#include "PathPosix.h"
+
+std::string toUtf8(const std::wstring &text)
+{
+	std::string out;
+
+	for (wchar_t wc : text)
+	{
+		uint32_t c = (uint32_t)wc;
+
+		if (c < 0x80)
+		{
+			out += (char)c;
+		}
+		else if (c < 0x800)
+		{
+			out += (char)(0xC0 | (c >> 6));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			out += (char)(0xE0 | (c >> 12));
+			out += (char)(0x80 | ((c >> 6) & 0x3F));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			out += (char)(0xF0 | (c >> 18));
+			out += (char)(0x80 | ((c >> 12) & 0x3F));
+			out += (char)(0x80 | ((c >> 6) & 0x3F));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+	}
+
+	return out;
+}
+
+#endif
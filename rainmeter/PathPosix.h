@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+
+// Paths are kept as wide strings everywhere else, but POSIX wants bytes.
+// Shared by MappedFilePosix.cpp and FileWatcherInotify.cpp.
+std::string toUtf8(const std::wstring &text);
@@ -0,0 +1,381 @@
+#include <cstring>
+
+#include "PixelConvert.h"
+#include "ThreadPool.h"
+
+// How many rows each thread converts at a time
+#define CONVERT_BAND_ROWS 64
+
+#ifdef PIXEL_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC lets us use any intrinsic anywhere
+#define PIXEL_AVX2_TARGET
+#else
+#include <immintrin.h>
+#include <cpuid.h>
+// GCC/Clang need to be told a function is allowed to use AVX2
+#define PIXEL_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+// Where one channel lives in a pixel, and how to get it to 8 bits
+struct Channel
+{
+	int shift;
+	uint32_t mask;
+	int bits;
+
+	// For the SIMD kernels, which do ((v << up) >> down) | (v >> extra).
+	// Shifting a 32-bit lane by 32 or more gives 0, which is handy.
+	int up;
+	int down;
+	int extra;
+};
+
+struct Channels
+{
+	Channel r, g, b;
+	int bytesPerPixel;
+};
+
+static bool setupChannel(Channel *channel, uint32_t mask)
+{
+	channel->shift = 0;
+	channel->bits = 0;
+	channel->mask = 0;
+
+	if (mask == 0)
+	{
+		// No bits at all, the channel is just always 0
+		channel->up = 0;
+		channel->down = 32;
+		channel->extra = 32;
+		return true;
+	}
+
+	while (!(mask & 1))
+	{
+		mask >>= 1;
+		++channel->shift;
+	}
+
+	channel->mask = mask;
+
+	while (mask & 1)
+	{
+		mask >>= 1;
+		++channel->bits;
+	}
+
+	// Bits that aren't next to each other? Not a real format.
+	if (mask != 0)
+		return false;
+
+	if (channel->bits >= 8)
+	{
+		// Just keep the top 8
+		channel->up = 0;
+		channel->down = channel->bits - 8;
+		channel->extra = 32;
+	}
+	else
+	{
+		// Repeat the bits to fill the bottom (so 5-bit 31 becomes 255, not 248).
+		// Narrower than 4 needs more than one repeat, that's left to the scalar code.
+		channel->up = 8 - channel->bits;
+		channel->down = 0;
+		channel->extra = 2 * channel->bits - 8;
+	}
+
+	return true;
+}
+
+// The reference version of getting a channel to 8 bits
+static inline uint32_t expandChannel(uint32_t pixel, const Channel &channel)
+{
+	uint32_t v = (pixel >> channel.shift) & channel.mask;
+
+	if (channel.bits >= 8)
+		return v >> (channel.bits - 8);
+
+	if (channel.bits == 0)
+		return 0;
+
+	uint32_t result = 0;
+	for (int pos = 8 - channel.bits; pos > -channel.bits; pos -= channel.bits)
+	{
+		result |= pos >= 0 ? (v << pos) : (v >> -pos);
+	}
+
+	return result & 0xFF;
+}
+
+static inline uint32_t loadPixel(const uint8_t *src, int bytesPerPixel)
+{
+	switch (bytesPerPixel)
+	{
+	case 2:
+		return src[0] | (src[1] << 8);
+	case 3:
+		return src[0] | (src[1] << 8) | (src[2] << 16);
+	default:
+		uint32_t pixel;
+		memcpy(&pixel, src, sizeof(pixel));
+		return pixel;
+	}
+}
+
+static void convertRowScalar(uint32_t *dst, const uint8_t *src, int count, const Channels &channels)
+{
+	for (int x = 0; x < count; ++x)
+	{
+		uint32_t pixel = loadPixel(&src[x * channels.bytesPerPixel], channels.bytesPerPixel);
+
+		dst[x] = 0xFF000000 | (expandChannel(pixel, channels.b) << 16) | (expandChannel(pixel, channels.g) << 8) | expandChannel(pixel, channels.r);
+	}
+}
+
+static bool isBGRX(const Channels &channels)
+{
+	return channels.bytesPerPixel == 4
+		&& channels.r.shift == 16 && channels.r.bits == 8
+		&& channels.g.shift == 8 && channels.g.bits == 8
+		&& channels.b.shift == 0 && channels.b.bits == 8;
+}
+
+// The SIMD kernels only do the single repeat, see setupChannel
+static bool simdFriendly(const Channels &channels)
+{
+	return (channels.r.bits == 0 || channels.r.bits >= 4)
+		&& (channels.g.bits == 0 || channels.g.bits >= 4)
+		&& (channels.b.bits == 0 || channels.b.bits >= 4);
+}
+
+#ifdef PIXEL_X86
+
+//
+// SSE2, 4 pixels at a time
+//
+
+static inline __m128i expandChannelSSE2(__m128i pixels, const Channel &channel)
+{
+	__m128i v = _mm_and_si128(_mm_srl_epi32(pixels, _mm_cvtsi32_si128(channel.shift)), _mm_set1_epi32((int)channel.mask));
+	__m128i high = _mm_srl_epi32(_mm_sll_epi32(v, _mm_cvtsi32_si128(channel.up)), _mm_cvtsi32_si128(channel.down));
+	return _mm_or_si128(high, _mm_srl_epi32(v, _mm_cvtsi32_si128(channel.extra)));
+}
+
+static inline __m128i packChannelsSSE2(__m128i pixels, const Channels &channels)
+{
+	__m128i r = expandChannelSSE2(pixels, channels.r);
+	__m128i g = _mm_slli_epi32(expandChannelSSE2(pixels, channels.g), 8);
+	__m128i b = _mm_slli_epi32(expandChannelSSE2(pixels, channels.b), 16);
+	return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, _mm_set1_epi32((int)0xFF000000)));
+}
+
+static void convertRowSSE2(uint32_t *dst, const uint8_t *src, int count, const Channels &channels)
+{
+	int x = 0;
+
+	if (isBGRX(channels))
+	{
+		// Swap red and blue, keep green, fill in the alpha
+		const __m128i green = _mm_set1_epi32(0x0000FF00);
+		const __m128i low = _mm_set1_epi32(0x000000FF);
+		const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+		for (; x + 4 <= count; x += 4)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i*)&src[x * 4]);
+			__m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), low);
+			__m128i b = _mm_slli_epi32(_mm_and_si128(p, low), 16);
+			__m128i result = _mm_or_si128(_mm_or_si128(r, b), _mm_or_si128(_mm_and_si128(p, green), alpha));
+			_mm_storeu_si128((__m128i*)&dst[x], result);
+		}
+	}
+	else if (channels.bytesPerPixel == 4)
+	{
+		for (; x + 4 <= count; x += 4)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i*)&src[x * 4]);
+			_mm_storeu_si128((__m128i*)&dst[x], packChannelsSSE2(p, channels));
+		}
+	}
+	else if (channels.bytesPerPixel == 2)
+	{
+		const __m128i zero = _mm_setzero_si128();
+
+		for (; x + 8 <= count; x += 8)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i*)&src[x * 2]);
+			_mm_storeu_si128((__m128i*)&dst[x], packChannelsSSE2(_mm_unpacklo_epi16(p, zero), channels));
+			_mm_storeu_si128((__m128i*)&dst[x + 4], packChannelsSSE2(_mm_unpackhi_epi16(p, zero), channels));
+		}
+	}
+	else if (channels.bytesPerPixel == 3)
+	{
+		// No byte shuffles in SSE2, so grab each pixel with a 4-byte load
+		// (the last one reads a byte into the next pixel, hence the + 5)
+		for (; x + 5 <= count; x += 4)
+		{
+			const uint8_t *s = &src[x * 3];
+			uint32_t p0, p1, p2, p3;
+			memcpy(&p0, s, 4);
+			memcpy(&p1, s + 3, 4);
+			memcpy(&p2, s + 6, 4);
+			memcpy(&p3, s + 9, 4);
+
+			__m128i p = _mm_and_si128(_mm_setr_epi32((int)p0, (int)p1, (int)p2, (int)p3), _mm_set1_epi32(0x00FFFFFF));
+			_mm_storeu_si128((__m128i*)&dst[x], packChannelsSSE2(p, channels));
+		}
+	}
+
+	convertRowScalar(&dst[x], &src[x * channels.bytesPerPixel], count - x, channels);
+}
+
+//
+// AVX2, 8 pixels at a time
+//
+
+PIXEL_AVX2_TARGET static inline __m256i expandChannelAVX2(__m256i pixels, const Channel &channel)
+{
+	__m256i v = _mm256_and_si256(_mm256_srl_epi32(pixels, _mm_cvtsi32_si128(channel.shift)), _mm256_set1_epi32((int)channel.mask));
+	__m256i high = _mm256_srl_epi32(_mm256_sll_epi32(v, _mm_cvtsi32_si128(channel.up)), _mm_cvtsi32_si128(channel.down));
+	return _mm256_or_si256(high, _mm256_srl_epi32(v, _mm_cvtsi32_si128(channel.extra)));
+}
+
+PIXEL_AVX2_TARGET static inline __m256i packChannelsAVX2(__m256i pixels, const Channels &channels)
+{
+	__m256i r = expandChannelAVX2(pixels, channels.r);
+	__m256i g = _mm256_slli_epi32(expandChannelAVX2(pixels, channels.g), 8);
+	__m256i b = _mm256_slli_epi32(expandChannelAVX2(pixels, channels.b), 16);
+	return _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, _mm256_set1_epi32((int)0xFF000000)));
+}
+
+PIXEL_AVX2_TARGET static void convertRowAVX2(uint32_t *dst, const uint8_t *src, int count, const Channels &channels)
+{
+	int x = 0;
+
+	if (isBGRX(channels))
+	{
+		// B G R X -> R G B A, one byte shuffle per pixel
+		const __m256i order = _mm256_setr_epi8(
+			2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1,
+			2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+		const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+
+		for (; x + 8 <= count; x += 8)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i*)&src[x * 4]);
+			_mm256_storeu_si256((__m256i*)&dst[x], _mm256_or_si256(_mm256_shuffle_epi8(p, order), alpha));
+		}
+	}
+	else if (channels.bytesPerPixel == 4)
+	{
+		for (; x + 8 <= count; x += 8)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i*)&src[x * 4]);
+			_mm256_storeu_si256((__m256i*)&dst[x], packChannelsAVX2(p, channels));
+		}
+	}
+	else if (channels.bytesPerPixel == 2)
+	{
+		for (; x + 8 <= count; x += 8)
+		{
+			__m256i p = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&src[x * 2]));
+			_mm256_storeu_si256((__m256i*)&dst[x], packChannelsAVX2(p, channels));
+		}
+	}
+	else if (channels.bytesPerPixel == 3)
+	{
+		// Spread 4 packed 3-byte pixels per 128-bit half out into 32-bit lanes.
+		// The second half starts 12 bytes in and reads 16, hence the + 10.
+		const __m256i spread = _mm256_setr_epi8(
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+		for (; x + 10 <= count; x += 8)
+		{
+			const uint8_t *s = &src[x * 3];
+			__m256i p = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)s)), _mm_loadu_si128((const __m128i*)(s + 12)), 1);
+			_mm256_storeu_si256((__m256i*)&dst[x], packChannelsAVX2(_mm256_shuffle_epi8(p, spread), channels));
+		}
+	}
+
+	convertRowScalar(&dst[x], &src[x * channels.bytesPerPixel], count - x, channels);
+}
+
+static bool cpuHasAVX2()
+{
+#ifdef _MSC_VER
+	int regs[4];
+
+	__cpuid(regs, 0);
+	if (regs[0] < 7)
+		return false;
+
+	// The CPU has to support AVX and the OS has to save the registers for it
+	__cpuid(regs, 1);
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	bool avx = (regs[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // PIXEL_X86
+
+PixelKernel bestPixelKernel()
+{
+#ifdef PIXEL_X86
+	static const PixelKernel best = cpuHasAVX2() ? PIXEL_KERNEL_AVX2 : PIXEL_KERNEL_SSE2;
+	return best;
+#else
+	return PIXEL_KERNEL_SCALAR;
+#endif
+}
+
+bool convertPixels(uint32_t *dst, const uint8_t *src, int w, int h, ptrdiff_t stride, const PixelFormat *format, PixelKernel kernel)
+{
+	if (format->bytesPerPixel < 2 || format->bytesPerPixel > 4)
+		return false;
+
+	Channels channels;
+	channels.bytesPerPixel = format->bytesPerPixel;
+
+	if (!setupChannel(&channels.r, format->rMask) || !setupChannel(&channels.g, format->gMask) || !setupChannel(&channels.b, format->bMask))
+		return false;
+
+	// Don't hand out anything faster than the CPU can actually run
+	PixelKernel best = bestPixelKernel();
+	if (kernel == PIXEL_KERNEL_AUTO || kernel > best)
+		kernel = best;
+
+	if (!simdFriendly(channels))
+		kernel = PIXEL_KERNEL_SCALAR;
+
+	void (*convertRow)(uint32_t*, const uint8_t*, int, const Channels&) = convertRowScalar;
+
+#ifdef PIXEL_X86
+	if (kernel == PIXEL_KERNEL_AVX2)
+		convertRow = convertRowAVX2;
+	else if (kernel == PIXEL_KERNEL_SSE2)
+		convertRow = convertRowSSE2;
+#endif
+
+	// Big captures get split up across threads, rows don't depend on each other
+	parallelFor(h, CONVERT_BAND_ROWS, [&](int first, int last)
+	{
+		for (int y = first; y < last; ++y)
+		{
+			convertRow(&dst[(size_t)y * w], &src[y * stride], w, channels);
+		}
+	});
+
+	return true;
+}
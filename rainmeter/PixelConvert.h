@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Describes packed pixels the same way a BITMAPINFO does: how many bytes
+// each one takes, and which bits hold red, green and blue.
+//
+// The usual suspects:
+//   BGRX 32-bit   4, 0x00FF0000, 0x0000FF00, 0x000000FF
+//   BGR 24-bit    3, 0x00FF0000, 0x0000FF00, 0x000000FF
+//   X1R5G5B5      2, 0x00007C00, 0x000003E0, 0x0000001F
+//   R5G6B5        2, 0x0000F800, 0x000007E0, 0x0000001F
+struct PixelFormat
+{
+	int bytesPerPixel;
+	uint32_t rMask;
+	uint32_t gMask;
+	uint32_t bMask;
+};
+
+// Which implementation to use. Mostly there so the SIMD versions can be
+// checked against the plain one; asking for something the CPU can't do
+// quietly uses the best thing it can.
+enum PixelKernel
+{
+	PIXEL_KERNEL_AUTO,
+	PIXEL_KERNEL_SCALAR,
+	PIXEL_KERNEL_SSE2,
+	PIXEL_KERNEL_AVX2
+};
+
+// Converts rows of packed pixels into the RGBA layout stb_image uses
+// (red in the lowest byte) with the alpha set to opaque. Channels narrower
+// than 8 bits are expanded so full brightness stays full brightness,
+// wider ones keep their top 8 bits. Every kernel gives exactly the same
+// output.
+//
+// stride is the number of bytes from one source row to the next (DIB rows
+// are padded to 4 bytes), dst is packed w by h.
+//
+// Returns false if it doesn't know how to handle the format.
+bool convertPixels(uint32_t *dst, const uint8_t *src, int w, int h, ptrdiff_t stride, const PixelFormat *format, PixelKernel kernel = PIXEL_KERNEL_AUTO);
+
+// The kernel PIXEL_KERNEL_AUTO ends up using on this machine
+PixelKernel bestPixelKernel();
+
+// Defined when building for x86 (32 or 64 bit), where SSE2 can be taken
+// for granted. Anything with an SSE2 path checks this, then
+// bestPixelKernel() to see whether the caller wants it.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXEL_X86
+#endif
@@ -0,0 +1,50 @@
+#include "SampleRegistry.h"
+
+std::shared_ptr<SharedSample> SampleRegistry::subscribe(const PaletteKey &key, bool *created)
+{
+	std::string id = PaletteCache::makeKey(key);
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	std::weak_ptr<SharedSample> &slot = samples[id];
+
+	std::shared_ptr<SharedSample> sample = slot.lock();
+	if (sample != nullptr)
+	{
+		*created = false;
+		return sample;
+	}
+
+	// The last subscriber letting go takes it back out of the registry
+	sample = std::shared_ptr<SharedSample>(new SharedSample, [this, id](SharedSample *dead)
+	{
+		release(id, dead);
+	});
+
+	slot = sample;
+	*created = true;
+
+	return sample;
+}
+
+size_t SampleRegistry::size()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return samples.size();
+}
+
+void SampleRegistry::release(const std::string &key, SharedSample *sample)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		// Someone might have already subscribed to a replacement, leave that alone
+		auto it = samples.find(key);
+		if (it != samples.end() && it->second.expired())
+		{
+			samples.erase(it);
+		}
+	}
+
+	delete sample;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "ColorSet.h"
+#include "Grid.h"
+#include "PaletteCache.h"
+#include "SummedAreaTable.h"
+
+// A captured desktop, kept around so each container on it can look up the
+// average color of whatever's under its skin
+struct ContextFrame
+{
+	ContextFrame(const ImageView &view, int left, int top, bool flipped) :
+		table(view), left(left), top(top), flipped(flipped) { }
+
+	SummedAreaTable table;
+
+	// Desktop coordinates of the frame's top left corner
+	int left;
+	int top;
+
+	// Stored bottom-up, like a DIB
+	bool flipped;
+};
+
+// One sample's worth of results, shared by every container that would
+// have sampled the exact same thing (same file, crop and so on)
+struct SharedSample
+{
+	SharedSample() : generation(0), retry(false) { }
+
+	// Bumped every time new results are published, 0 until the first ones
+	std::atomic<uint64_t> generation;
+
+	// The worker couldn't get at the file and someone should queue it again
+	std::atomic<bool> retry;
+
+	// The palette straight out of Chameleon, before any context shuffling.
+	// nullptr once published means the file couldn't be sampled and each
+	// container should use its own fallback colors.
+	// Only ever read/written with std::atomic_load/std::atomic_store.
+	std::shared_ptr<const ColorSet> palette;
+
+	// The capture the palette came from, if it was one and anyone wanted
+	// context aware colors. Same rules as palette.
+	std::shared_ptr<const ContextFrame> context;
+
+	// The colors of each cell, if it was sampled with a Grid. Same rules
+	// as palette.
+	std::shared_ptr<const GridColors> grid;
+
+	// Called from the worker when it's done
+	void publish(std::shared_ptr<const ColorSet> result, std::shared_ptr<const ContextFrame> frame, std::shared_ptr<const GridColors> cells = nullptr)
+	{
+		std::atomic_store(&context, frame);
+		std::atomic_store(&grid, cells);
+		std::atomic_store(&palette, result);
+		++generation;
+	}
+};
+
+// Hands out SharedSamples so containers with the same inputs end up
+// subscribed to the same one. Subscriptions are just shared_ptrs, and
+// the entry goes away as soon as the last one is let go of.
+class SampleRegistry
+{
+public:
+	// Get the sample for key, creating it if nobody has it yet.
+	// created is set if it's brand new and still needs to be worked out.
+	std::shared_ptr<SharedSample> subscribe(const PaletteKey &key, bool *created);
+
+	// Number of distinct samples currently subscribed to
+	size_t size();
+
+private:
+	void release(const std::string &key, SharedSample *sample);
+
+	std::mutex lock;
+	std::unordered_map<std::string, std::weak_ptr<SharedSample>> samples;
+};
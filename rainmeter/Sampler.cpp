@@ -0,0 +1,263 @@
+#include <climits>
+#include <cstdlib>
+
+#include <chameleon.h>
+
+#include "stb_image.h"
+
+#include "BufferPool.h"
+#include "Downsample.h"
+#include "MipPyramid.h"
+#include "Sampler.h"
+#include "Stats.h"
+
+// Chameleon hands colors back as RGBA with red in the top byte, Rainmeter
+// wants it the other way around (and fully opaque)
+static uint32_t swapColor(uint32_t color)
+{
+#ifdef _MSC_VER
+	return _byteswap_ulong(color) | 0xFF;
+#else
+	return __builtin_bswap32(color) | 0xFF;
+#endif
+}
+
+uint32_t* createImage(int w, int h)
+{
+	// Same place stb_image gets its memory, so stbi_image_free works on these too
+	return (uint32_t*)poolAlloc((size_t)w * h * sizeof(uint32_t));
+}
+
+int pickDecodeScale(int w, int h, int left, int top, int right, int bottom, int minSize)
+{
+	// Only the part of the region that's actually in the image counts
+	if (left < 0)
+		left = 0;
+	if (top < 0)
+		top = 0;
+	if (right > w)
+		right = w;
+	if (bottom > h)
+		bottom = h;
+
+	if (right <= left || bottom <= top)
+		return 0;
+
+	int scale = 0;
+	while (scale < 3 && ((right - left) >> (scale + 1)) >= minSize && ((bottom - top) >> (scale + 1)) >= minSize)
+	{
+		++scale;
+	}
+
+	return scale;
+}
+
+void analyzeView(const ImageView &view, bool isIcon, ColorSet *colors, SampleMode mode, int budget, GridColors *grid)
+{
+	// Resize image for Chameleon, straight out of the (possibly cropped) view
+	StageTimer resizeTimer(STAGE_RESIZE);
+	uint32_t *sampleData = nullptr;
+	int w = view.w;
+	int h = view.h;
+
+	if (w > SAMPLE_MAX_DIMENSION || h > SAMPLE_MAX_DIMENSION)
+	{
+		int newWidth = (w < SAMPLE_MAX_DIMENSION ? w : SAMPLE_MAX_DIMENSION);
+		int newHeight = (h < SAMPLE_MAX_DIMENSION ? h : SAMPLE_MAX_DIMENSION);
+		sampleData = createImage(newWidth, newHeight);
+
+		// Box filtered in one pass over just the part of the image the view
+		// covers, or just a sample of it if that's what was asked for (and
+		// it's actually less than all of it). Views are always RGBA by now,
+		// so neither can fail.
+		if (mode == SAMPLE_MODE_STRATIFIED && (int64_t)budget < (int64_t)w * h)
+		{
+			stratifiedSampleView(view, sampleData, newWidth, newHeight, budget);
+		}
+		else
+		{
+			downsampleView(view, sampleData, newWidth, newHeight);
+		}
+
+		w = newWidth;
+		h = newHeight;
+	}
+	else if (!view.contiguous())
+	{
+		// Small enough already, but Chameleon wants the rows back to back
+		sampleData = createImage(w, h);
+		copyView(view, sampleData);
+	}
+
+	resizeTimer.stop();
+
+	// The cells only need averages, so the shrunk image is plenty to go on
+	if (grid != nullptr)
+	{
+		StageTimer gridTimer(STAGE_GRID);
+		analyzeGrid(sampleData != nullptr ? makeView(sampleData, w, h) : view, grid->columns, grid->rows, grid);
+	}
+
+	// Run through Chameleon
+	Chameleon *chameleon = createChameleon();
+
+	StageTimer processTimer(STAGE_PROCESS);
+	chameleonProcessImage(chameleon, sampleData != nullptr ? sampleData : (uint32_t*)view.data, w, h, isIcon);
+	processTimer.stop();
+
+	StageTimer keyColorsTimer(STAGE_KEY_COLORS);
+
+	if (isIcon)
+	{
+		chameleonFindKeyColors(chameleon, chameleonDefaultIconParams(), false);
+	}
+	else
+	{
+		chameleonFindKeyColors(chameleon, chameleonDefaultImageParams(), true);
+	}
+
+	keyColorsTimer.stop();
+
+	colors->bg1 = swapColor(chameleonGetColor(chameleon, CHAMELEON_BACKGROUND1));
+	colors->bg2 = swapColor(chameleonGetColor(chameleon, CHAMELEON_BACKGROUND2));
+	colors->fg1 = swapColor(chameleonGetColor(chameleon, CHAMELEON_FOREGROUND1));
+	colors->fg2 = swapColor(chameleonGetColor(chameleon, CHAMELEON_FOREGROUND2));
+
+	colors->l1 = swapColor(chameleonGetColor(chameleon, CHAMELEON_LIGHT1));
+	colors->l2 = swapColor(chameleonGetColor(chameleon, CHAMELEON_LIGHT2));
+	colors->l3 = swapColor(chameleonGetColor(chameleon, CHAMELEON_LIGHT3));
+	colors->l4 = swapColor(chameleonGetColor(chameleon, CHAMELEON_LIGHT4));
+
+	colors->d1 = swapColor(chameleonGetColor(chameleon, CHAMELEON_DARK1));
+	colors->d2 = swapColor(chameleonGetColor(chameleon, CHAMELEON_DARK2));
+	colors->d3 = swapColor(chameleonGetColor(chameleon, CHAMELEON_DARK3));
+	colors->d4 = swapColor(chameleonGetColor(chameleon, CHAMELEON_DARK4));
+
+	colors->avg = swapColor(chameleonGetColor(chameleon, CHAMELEON_AVERAGE));
+
+	colors->lum = chameleonGetLuminance(chameleon, CHAMELEON_AVERAGE);
+
+	destroyChameleon(chameleon);
+
+	if (sampleData != nullptr)
+		poolFree(sampleData);
+}
+
+// Moves the crop from desktop coordinates into those of a w by h wallpaper
+static void mapToWallpaper(const SampleCrop &crop, int w, int h, int *left, int *top, int *right, int *bottom)
+{
+	// adjust the cropping rectangle origin from global desktop space to monitor space
+	*left = crop.left - crop.monitorLeft;
+	*right = crop.right - crop.monitorLeft;
+	*top = crop.top - crop.monitorTop;
+	*bottom = crop.bottom - crop.monitorTop;
+
+	// we assume the image is set to "fill" to keep the code simple
+	// this is just a basic ratio transform of the coordinates from
+	// monitor space to image space
+	float scale = 1.0f;
+	float widthRatio = ((float)w) / ((float)crop.monitorW);
+	float heightRatio = ((float)h) / ((float)crop.monitorH);
+	if (widthRatio < heightRatio)
+		scale = widthRatio;
+	else
+		scale = heightRatio;
+
+	*left = (int)(*left * scale);
+	*right = (int)(*right * scale);
+	*top = (int)(*top * scale);
+	*bottom = (int)(*bottom * scale);
+}
+
+void cropRegion(const SampleCrop &crop, int w, int h, int region[4])
+{
+	region[0] = 0;
+	region[1] = 0;
+	region[2] = w;
+	region[3] = h;
+
+	if (crop.custom)
+	{
+		region[0] = crop.left;
+		region[1] = crop.top;
+		region[2] = crop.right;
+		region[3] = crop.bottom;
+
+		if (crop.onWallpaper)
+			mapToWallpaper(crop, w, h, &region[0], &region[1], &region[2], &region[3]);
+	}
+}
+
+uint32_t* decodeImage(const uint8_t *data, size_t size, ImageFormat format, const SampleCrop &crop, int *w, int *h, int *fullW, int *fullH, int *scale)
+{
+	*fullW = 0;
+	*fullH = 0;
+	*scale = 0;
+
+	// stb only takes an int for the size. Nothing that big is an image
+	// we could do anything with anyway.
+	if (size == 0 || size > INT_MAX)
+		return nullptr;
+
+	// Big JPEGs can be decoded at 1/2, 1/4 or 1/8 size for a fraction of
+	// the time and memory, and we're about to shrink them to 256x256 anyway.
+	// Work out how big the part we're going to use is so we don't go
+	// below that.
+	int n;
+	if (stbi_info_from_memory_format(data, (int)size, fullW, fullH, &n, stbFormat(format)))
+	{
+		int region[4];
+		cropRegion(crop, *fullW, *fullH, region);
+
+		*scale = pickDecodeScale(*fullW, *fullH, region[0], region[1], region[2], region[3], SAMPLE_MAX_DIMENSION);
+	}
+
+	return (uint32_t*)stbi_load_from_memory_format(data, (int)size, w, h, &n, 4, scale, stbFormat(format));
+}
+
+ImageView cropDecoded(const ImageView &image, const MipPyramid *pyramid, int scale, const SampleCrop &crop, bool *outOfBounds)
+{
+	// Everything from here on looks at the image through a view, so
+	// cropping is just moving a pointer around rather than copying
+	ImageView view = image;
+	*outOfBounds = false;
+
+	if (crop.custom)
+	{
+		int left = crop.left;
+		int top = crop.top;
+		int right = crop.right;
+		int bottom = crop.bottom;
+
+		// Adjust cropping for monitor malarkey thanks to 24H2!
+		if (crop.onWallpaper)
+		{
+			mapToWallpaper(crop, view.w, view.h, &left, &top, &right, &bottom);
+		}
+		else if (scale > 0)
+		{
+			// The image got decoded smaller than it is, so shrink the crop to match.
+			// Round the far edges up so we don't lose a sliver along them.
+			int round = (1 << scale) - 1;
+			left >>= scale;
+			top >>= scale;
+			right = (right + round) >> scale;
+			bottom = (bottom + round) >> scale;
+		}
+
+		*outOfBounds = left > view.w || top > view.h;
+
+		if (pyramid != nullptr)
+		{
+			// Read from the smallest copy of the image that still has at
+			// least as much detail as we're going to shrink it to
+			view = pyramid->region(left, top, right, bottom, SAMPLE_MAX_DIMENSION);
+		}
+		else
+		{
+			view = cropView(view, left, top, right, bottom);
+		}
+	}
+
+	return view;
+}
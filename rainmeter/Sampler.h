@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ColorSet.h"
+#include "Grid.h"
+#include "ImageFormat.h"
+#include "ImageView.h"
+
+class MipPyramid;
+
+// The part of sampling that doesn't care where the pixels came from:
+// shrinking them down and running them through Chameleon. Nothing in here
+// knows about Windows or Rainmeter, so the benchmark runs exactly the same
+// code the plugin does.
+
+// Largest width/height we hand to Chameleon, anything bigger gets resized down
+#define SAMPLE_MAX_DIMENSION 256
+
+// How images bigger than that get shrunk
+enum SampleMode
+{
+	// Average every pixel (the default)
+	SAMPLE_MODE_BOX,
+
+	// Only look at a spread out selection of them, up to a budget
+	SAMPLE_MODE_STRATIFIED
+};
+
+// How many pixels stratified sampling looks at unless told otherwise: one
+// for each pixel Chameleon gets
+#define SAMPLE_DEFAULT_BUDGET (SAMPLE_MAX_DIMENSION * SAMPLE_MAX_DIMENSION)
+
+// A w by h RGBA image from the buffer pool, free it with stbi_image_free
+// or poolFree
+uint32_t* createImage(int w, int h);
+
+// How many times a w by h image can be halved while decoding (0-3, for
+// 1/1 to 1/8 size) with the region we're going to sample (left, top,
+// right, bottom) still being at least minSize pixels in each direction
+int pickDecodeScale(int w, int h, int left, int top, int right, int bottom, int minSize);
+
+// Resizes the view down to SAMPLE_MAX_DIMENSION if it's bigger, has
+// Chameleon pick the colors and fills them into colors (byte swapped the
+// way Rainmeter wants them). The view can't be empty. budget only matters
+// for SAMPLE_MODE_STRATIFIED.
+//
+// If grid isn't nullptr it also gets the colors of grid->columns by
+// grid->rows cells, out of the same shrunk image Chameleon gets.
+void analyzeView(const ImageView &view, bool isIcon, ColorSet *colors, SampleMode mode = SAMPLE_MODE_BOX, int budget = SAMPLE_DEFAULT_BUDGET, GridColors *grid = nullptr);
+
+// The part of an image that gets sampled
+struct SampleCrop
+{
+	// Otherwise it's the whole image
+	bool custom;
+
+	// In the full size image's coordinates, before any decode scale
+	int left;
+	int top;
+	int right;
+	int bottom;
+
+	// 24H2 doesn't let us grab the desktop so we read the wallpaper file
+	// instead, which means the crop (in desktop coordinates) has to be
+	// moved onto a wallpaper filling the monitor at monitorLeft, monitorTop
+	// (monitorW by monitorH)
+	bool onWallpaper;
+	int monitorLeft;
+	int monitorTop;
+	int monitorW;
+	int monitorH;
+};
+
+// The part of a w by h image the crop covers (left, top, right, bottom),
+// as far as picking how small it can be decoded goes
+void cropRegion(const SampleCrop &crop, int w, int h, int region[4]);
+
+// Decodes a file stb can read (going by sniffFormat) to RGBA, as small as
+// it can while the cropped part is still at least SAMPLE_MAX_DIMENSION
+// each way. fullW/fullH get the size it really is and scale how many
+// times it got halved. Free it with stbi_image_free, nullptr if it
+// couldn't be decoded.
+uint32_t* decodeImage(const uint8_t *data, size_t size, ImageFormat format, const SampleCrop &crop, int *w, int *h, int *fullW, int *fullH, int *scale);
+
+// The part of an image decoded at 1/2^scale size that gets handed to
+// analyzeView. With a pyramid of the image, the crop gets read from the
+// smallest level that still has enough detail. outOfBounds is set if the
+// crop starts past the edge of the image. Empty if there's nothing left.
+ImageView cropDecoded(const ImageView &image, const MipPyramid *pyramid, int scale, const SampleCrop &crop, bool *outOfBounds);
@@ -0,0 +1,136 @@
+#include "SourceFailures.h"
+
+RetryBackoff::RetryBackoff(std::chrono::steady_clock::duration minDelay, std::chrono::steady_clock::duration maxDelay, size_t maxEntries) :
+	minDelay(minDelay), maxDelay(maxDelay), maxEntries(maxEntries)
+{
+}
+
+void RetryBackoff::failed(const std::wstring &path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	// A skin pointed at a folder full of files that are all locked could
+	// keep adding to this forever. Starting over just means they each get
+	// tried once more straight away.
+	if (failures.size() >= maxEntries && failures.find(path) == failures.end())
+	{
+		failures.clear();
+	}
+
+	Failure &failure = failures[path];
+	failure.count++;
+
+	// Doubles each time, stopping at maxDelay well before it could overflow
+	std::chrono::steady_clock::duration delay = minDelay;
+	for (int i = 1; i < failure.count && delay < maxDelay; ++i)
+	{
+		delay *= 2;
+	}
+
+	if (delay > maxDelay)
+	{
+		delay = maxDelay;
+	}
+
+	failure.retryAt = std::chrono::steady_clock::now() + delay;
+}
+
+void RetryBackoff::succeeded(const std::wstring &path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (!failures.empty())
+	{
+		failures.erase(path);
+	}
+}
+
+bool RetryBackoff::ready(const std::wstring &path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto it = failures.find(path);
+	if (it == failures.end())
+	{
+		return true;
+	}
+
+	return std::chrono::steady_clock::now() >= it->second.retryAt;
+}
+
+std::chrono::steady_clock::time_point RetryBackoff::retryAt(const std::wstring &path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto it = failures.find(path);
+	if (it == failures.end())
+	{
+		return std::chrono::steady_clock::time_point();
+	}
+
+	return it->second.retryAt;
+}
+
+void RetryBackoff::clear()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	failures.clear();
+}
+
+DecodeRoutes::DecodeRoutes(size_t maxEntries) :
+	maxEntries(maxEntries)
+{
+}
+
+DecodeRoute DecodeRoutes::find(const std::wstring &path, uint64_t modified, uint64_t size)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto it = entries.find(path);
+	if (it == entries.end())
+	{
+		return DECODE_IMAGE;
+	}
+
+	// The file changed, so it might be something stb can read now
+	if (it->second.modified != modified || it->second.size != size)
+	{
+		entries.erase(it);
+
+		return DECODE_IMAGE;
+	}
+
+	return it->second.route;
+}
+
+void DecodeRoutes::insert(const std::wstring &path, uint64_t modified, uint64_t size, DecodeRoute route)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (route == DECODE_IMAGE)
+	{
+		entries.erase(path);
+
+		return;
+	}
+
+	// Nobody's going to have this many broken files at once, so whoever
+	// does can just find out about them all again
+	if (entries.size() >= maxEntries && entries.find(path) == entries.end())
+	{
+		entries.clear();
+	}
+
+	Entry &entry = entries[path];
+	entry.modified = modified;
+	entry.size = size;
+	entry.route = route;
+}
+
+void DecodeRoutes::clear()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	entries.clear();
+}
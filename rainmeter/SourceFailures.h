@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Remembering what went wrong with a file, so something that's broken
+// doesn't get the full treatment on every update.
+//
+// How long a file the worker couldn't open waits before it's tried again,
+// doubling every time it fails in a row up to RETRY_MAX_DELAY
+#define RETRY_MIN_DELAY std::chrono::milliseconds(250)
+#define RETRY_MAX_DELAY std::chrono::milliseconds(16000)
+
+// Most files RetryBackoff keeps track of before it starts over
+#define RETRY_MAX_ENTRIES 1024
+
+// Most files DecodeRoutes keeps a decision for before it starts over
+#define DECODE_ROUTES_MAX_ENTRIES 1024
+
+// Keeps track of files the worker couldn't open (locked by whatever's
+// writing them, on a share that's gone away, ...) and when each one is
+// worth trying again.
+//
+// Safe to use from any thread. The worker says how it went, and the main
+// thread asks whether it's time yet.
+class RetryBackoff
+{
+public:
+	RetryBackoff(std::chrono::steady_clock::duration minDelay = RETRY_MIN_DELAY, std::chrono::steady_clock::duration maxDelay = RETRY_MAX_DELAY, size_t maxEntries = RETRY_MAX_ENTRIES);
+
+	// The file couldn't be opened, so wait longer than last time
+	void failed(const std::wstring &path);
+
+	// The file opened fine, so forget it ever failed
+	void succeeded(const std::wstring &path);
+
+	// Whether it's been long enough since the file last failed to try it
+	// again (or it never has)
+	bool ready(const std::wstring &path);
+
+	// When the file can next be tried (the epoch if it's never failed)
+	std::chrono::steady_clock::time_point retryAt(const std::wstring &path);
+
+	void clear();
+
+private:
+	struct Failure
+	{
+		int count;
+		std::chrono::steady_clock::time_point retryAt;
+	};
+
+	std::mutex lock;
+	std::unordered_map<std::wstring, Failure> failures;
+	std::chrono::steady_clock::duration minDelay;
+	std::chrono::steady_clock::duration maxDelay;
+	size_t maxEntries;
+};
+
+// How a file has to be decoded, once we've found out the hard way
+enum DecodeRoute
+{
+	// An image stb can read (or we don't know yet, so try it)
+	DECODE_IMAGE,
+
+	// stb can't read it, so it's straight to the file's icon
+	DECODE_ICON,
+
+	// Neither stb nor the shell can make anything of it
+	DECODE_NOTHING
+};
+
+// The files stb couldn't read, so the next time one comes up it skips
+// mapping, hashing and failing to decode it all over again. Each decision
+// is only good for the exact file it was made for. Asking with a different
+// modified time or size throws it away.
+//
+// Safe to use from any thread.
+class DecodeRoutes
+{
+public:
+	DecodeRoutes(size_t maxEntries = DECODE_ROUTES_MAX_ENTRIES);
+
+	// DECODE_IMAGE unless we already know better
+	DecodeRoute find(const std::wstring &path, uint64_t modified, uint64_t size);
+
+	// Remember how the file had to be decoded (DECODE_IMAGE just forgets it)
+	void insert(const std::wstring &path, uint64_t modified, uint64_t size, DecodeRoute route);
+
+	void clear();
+
+private:
+	struct Entry
+	{
+		uint64_t modified;
+		uint64_t size;
+		DecodeRoute route;
+	};
+
+	std::mutex lock;
+	std::unordered_map<std::wstring, Entry> entries;
+	size_t maxEntries;
+};
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cstdio>
+#include <cwchar>
+#include <mutex>
+
+#include "Stats.h"
+
+// The last few timings for a stage, oldest overwritten first
+struct StageWindow
+{
+	std::mutex lock;
+	int64_t samples[STATS_WINDOW];
+	size_t next;
+	uint64_t count;
+};
+
+static StageWindow windows[STAGE_MAX];
+
+// Have to stay in the same order as the enums
+static const wchar_t *stageNames[STAGE_MAX] =
+{
+	L"FileInfo",
+	L"Wallpaper",
+	L"Hash",
+	L"Decode",
+	L"Capture",
+	L"Resize",
+	L"Process",
+	L"KeyColors",
+	L"Grid",
+	L"Context",
+	L"Sample"
+};
+
+static const wchar_t *statNames[STAT_MAX] =
+{
+	L"Min",
+	L"Avg",
+	L"P95",
+	L"Max",
+	L"Count"
+};
+
+void recordStage(Stage stage, std::chrono::steady_clock::duration elapsed)
+{
+	StageWindow &window = windows[stage];
+	std::lock_guard<std::mutex> guard(window.lock);
+
+	window.samples[window.next] = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	window.next = (window.next + 1) % STATS_WINDOW;
+	window.count++;
+}
+
+StageStats readStage(Stage stage)
+{
+	StageStats stats = { 0 };
+	int64_t sorted[STATS_WINDOW];
+	size_t filled;
+
+	{
+		StageWindow &window = windows[stage];
+		std::lock_guard<std::mutex> guard(window.lock);
+
+		stats.count = window.count;
+		filled = (size_t)std::min<uint64_t>(window.count, STATS_WINDOW);
+		std::copy(window.samples, window.samples + filled, sorted);
+	}
+
+	if (filled == 0)
+	{
+		return stats;
+	}
+
+	// Only 128 of them, sorting is plenty quick
+	std::sort(sorted, sorted + filled);
+
+	int64_t total = 0;
+	for (size_t i = 0; i < filled; ++i)
+	{
+		total += sorted[i];
+	}
+
+	// Nearest rank, so with a handful of samples it's just the slowest one
+	size_t rank = (filled * 95 + 99) / 100;
+
+	stats.minimum = sorted[0] / 1e6;
+	stats.average = (double)total / filled / 1e6;
+	stats.p95 = sorted[rank - 1] / 1e6;
+	stats.maximum = sorted[filled - 1] / 1e6;
+
+	return stats;
+}
+
+double readStat(Stage stage, Stat stat)
+{
+	StageStats stats = readStage(stage);
+
+	switch (stat)
+	{
+	case STAT_MINIMUM:
+		return stats.minimum;
+	case STAT_AVERAGE:
+		return stats.average;
+	case STAT_P95:
+		return stats.p95;
+	case STAT_MAXIMUM:
+		return stats.maximum;
+	case STAT_COUNT:
+		return (double)stats.count;
+	default:
+		return 0;
+	}
+}
+
+void resetStats()
+{
+	for (StageWindow &window : windows)
+	{
+		std::lock_guard<std::mutex> guard(window.lock);
+		window.next = 0;
+		window.count = 0;
+	}
+}
+
+Stage findStage(const wchar_t *name)
+{
+	for (int i = 0; i < STAGE_MAX; ++i)
+	{
+		if (wcscmp(name, stageNames[i]) == 0)
+		{
+			return (Stage)i;
+		}
+	}
+
+	return STAGE_MAX;
+}
+
+Stat findStat(const wchar_t *name)
+{
+	for (int i = 0; i < STAT_MAX; ++i)
+	{
+		if (wcscmp(name, statNames[i]) == 0)
+		{
+			return (Stat)i;
+		}
+	}
+
+	return STAT_MAX;
+}
+
+const wchar_t *stageName(Stage stage)
+{
+	return stage < STAGE_MAX ? stageNames[stage] : L"";
+}
+
+std::wstring describeStage(Stage stage)
+{
+	StageStats stats = readStage(stage);
+	if (stats.count == 0)
+	{
+		return L"";
+	}
+
+	wchar_t line[160];
+	swprintf(line, sizeof(line) / sizeof(line[0]), L"%ls: min %.2fms avg %.2fms p95 %.2fms max %.2fms (%llu runs)",
+		stageNames[stage], stats.minimum, stats.average, stats.p95, stats.maximum, (unsigned long long)stats.count);
+
+	return line;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// How long each part of sampling takes, so a slow refresh can be pinned on
+// the right thing. Every stage keeps its last STATS_WINDOW timings and the
+// figures are worked out over those. Skins can read them with a
+// Color=Stats child measure.
+//
+// Like Counters, nothing in here knows about Windows or Rainmeter.
+#define STATS_WINDOW 128
+
+enum Stage
+{
+	// CreateFileW/GetFileTime to see if the file changed
+	STAGE_FILE_INFO,
+
+	// Asking Windows which wallpaper is on the monitor
+	STAGE_WALLPAPER,
+
+	// Fingerprinting the file to see if we've seen it before
+	STAGE_HASH,
+
+	// Reading the image (or icon) off disk
+	STAGE_DECODE,
+
+	// BitBlt and converting the desktop capture
+	STAGE_CAPTURE,
+
+	// Shrinking the image down for Chameleon
+	STAGE_RESIZE,
+
+	// chameleonProcessImage
+	STAGE_PROCESS,
+
+	// chameleonFindKeyColors
+	STAGE_KEY_COLORS,
+
+	// Working out the colors of each cell for Grid=
+	STAGE_GRID,
+
+	// Finding the area under the skin and shuffling the colors to suit
+	STAGE_CONTEXT,
+
+	// Everything the worker does for one sample, start to finish
+	STAGE_SAMPLE,
+
+	STAGE_MAX
+};
+
+enum Stat
+{
+	STAT_MINIMUM,
+	STAT_AVERAGE,
+	STAT_P95,
+	STAT_MAXIMUM,
+
+	// How many times the stage has run, ever (not just in the window)
+	STAT_COUNT,
+
+	STAT_MAX
+};
+
+// Figures for one stage, in milliseconds
+struct StageStats
+{
+	uint64_t count;
+	double minimum;
+	double average;
+	double p95;
+	double maximum;
+};
+
+// Safe to call from any thread
+void recordStage(Stage stage, std::chrono::steady_clock::duration elapsed);
+StageStats readStage(Stage stage);
+double readStat(Stage stage, Stat stat);
+
+// Forget everything recorded so far
+void resetStats();
+
+// Look up a stage/stat by the name skins use for it (like Decode or P95).
+// Return STAGE_MAX/STAT_MAX if there's no such thing.
+Stage findStage(const wchar_t *name);
+Stat findStat(const wchar_t *name);
+const wchar_t *stageName(Stage stage);
+
+// A line summing up the stage for the log, empty if it's never run
+std::wstring describeStage(Stage stage);
+
+// Times from when it's created until stop() (or it goes out of scope, so
+// early returns still count) and records it against the stage.
+//
+// A timer started inside another one (hashing in the middle of decoding,
+// say) can be given the outer one, which then leaves out the time the
+// inner one took so it isn't counted against both stages.
+class StageTimer
+{
+public:
+	StageTimer(Stage stage, StageTimer *outer = nullptr) : stage(stage), outer(outer), start(std::chrono::steady_clock::now()), running(true) {}
+	~StageTimer() { stop(); }
+
+	void stop()
+	{
+		if (running)
+		{
+			std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+			recordStage(stage, elapsed);
+			running = false;
+
+			if (outer != nullptr)
+				outer->start += elapsed;
+		}
+	}
+
+private:
+	Stage stage;
+	StageTimer *outer;
+	std::chrono::steady_clock::time_point start;
+	bool running;
+};
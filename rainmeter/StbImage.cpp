@@ -0,0 +1,32 @@
+// The stb libraries get compiled here, away from anything Windows
+// specific, so the benchmark can build exactly the same decoder
+
+#include "BufferPool.h"
+
+// Decoded images and the scratch space for decoding/resizing them are
+// the biggest things we allocate, so they all come out of the pool
+#define STBI_MALLOC(size) poolAlloc(size)
+#define STBI_REALLOC(ptr, size) poolRealloc(ptr, size)
+#define STBI_FREE(ptr) poolFree(ptr)
+
+#define STBIR_MALLOC(size, context) ((void)(context), poolAlloc(size))
+#define STBIR_FREE(ptr, context) ((void)(context), poolFree(ptr))
+
+#ifdef _MSC_VER
+#define STBI_MSC_SECURE_CRT
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define STBI_SSE2
+#define STBI__X86_TARGET
+#endif
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#define STBIR_SATURATE_INT
+#include "stb_image_resize.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
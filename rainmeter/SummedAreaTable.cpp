@@ -0,0 +1,136 @@
+#include "SummedAreaTable.h"
+#include "ThreadPool.h"
+
+// How many rows each thread builds at a time
+#define TABLE_BAND_ROWS 64
+
+SummedAreaTable::SummedAreaTable(const ImageView &view) :
+	w(view.w), h(view.h), table((size_t)(view.w + 1) * (view.h + 1) * 3, 0)
+{
+	int bands = (h + TABLE_BAND_ROWS - 1) / TABLE_BAND_ROWS;
+
+	// Every row depends on the one above it, which doesn't split up well.
+	// With only one thread (or not much image) just go top to bottom.
+	if (parallelThreads() < 2 || bands < 2)
+	{
+		buildRows(view, 0, h);
+		return;
+	}
+
+	// Otherwise every band gets built on its own as if it were the top of
+	// the image...
+	parallelFor(bands, 1, [&](int first, int last)
+	{
+		for (int band = first; band < last; ++band)
+		{
+			int top = band * TABLE_BAND_ROWS;
+			buildRows(view, top, (h - top > TABLE_BAND_ROWS) ? top + TABLE_BAND_ROWS : h);
+		}
+	});
+
+	// ...then the bottom row of each band is fixed up in order, since each
+	// needs the one before it. That's only one row per band...
+	for (int band = 1; band < bands; ++band)
+	{
+		int bottom = (h - band * TABLE_BAND_ROWS > TABLE_BAND_ROWS) ? (band + 1) * TABLE_BAND_ROWS : h;
+		carryInto(bottom - 1, bottom);
+	}
+
+	// ...and once those are right, the rest of each band can be fixed up
+	// on its own. It's all integer adds that wrap the same way, so the end
+	// result is identical to building it top to bottom.
+	parallelFor(bands - 1, 1, [&](int first, int last)
+	{
+		for (int band = first + 1; band <= last; ++band)
+		{
+			int top = band * TABLE_BAND_ROWS;
+			int bottom = (h - top > TABLE_BAND_ROWS) ? top + TABLE_BAND_ROWS : h;
+			carryInto(top, bottom - 1);
+		}
+	});
+}
+
+void SummedAreaTable::buildRows(const ImageView &view, int first, int last)
+{
+	// The first row and column stay 0 so the lookups don't need any special
+	// cases, and that row doubles as nothing above the first row of a band
+	for (int y = first; y < last; ++y)
+	{
+		const uint32_t *row = reinterpret_cast<const uint32_t*>(view.row(y));
+		const uint32_t *above = &table[((size_t)(y == first ? 0 : y) * (w + 1) + 1) * 3];
+		uint32_t *out = &table[((size_t)(y + 1) * (w + 1) + 1) * 3];
+
+		uint32_t r = 0, g = 0, b = 0;
+
+		for (int x = 0; x < w; ++x)
+		{
+			uint32_t pixel = row[x];
+
+			// Running totals along the row, plus everything above
+			r += pixel & 0xFF;
+			g += (pixel >> 8) & 0xFF;
+			b += (pixel >> 16) & 0xFF;
+
+			out[x * 3 + 0] = above[x * 3 + 0] + r;
+			out[x * 3 + 1] = above[x * 3 + 1] + g;
+			out[x * 3 + 2] = above[x * 3 + 2] + b;
+		}
+	}
+}
+
+void SummedAreaTable::carryInto(int first, int last)
+{
+	// The last row of the band above, which is already right
+	int top = first - first % TABLE_BAND_ROWS;
+	const uint32_t *carry = &table[((size_t)top * (w + 1) + 1) * 3];
+
+	for (int y = first; y < last; ++y)
+	{
+		uint32_t *out = &table[((size_t)(y + 1) * (w + 1) + 1) * 3];
+
+		for (int x = 0; x < w * 3; ++x)
+		{
+			out[x] += carry[x];
+		}
+	}
+}
+
+uint64_t SummedAreaTable::sum(int left, int top, int right, int bottom, uint64_t totals[3]) const
+{
+	totals[0] = totals[1] = totals[2] = 0;
+
+	if (left < 0)
+		left = 0;
+	if (top < 0)
+		top = 0;
+	if (right > w)
+		right = w;
+	if (bottom > h)
+		bottom = h;
+
+	if (right <= left || bottom <= top)
+		return 0;
+
+	// Take it in bands small enough that none of them can wrap
+	uint64_t width = right - left;
+	int bandHeight = (int)(maxArea / width);
+	if (bandHeight < 1)
+		bandHeight = 1;
+
+	for (int y = top; y < bottom; y += bandHeight)
+	{
+		int bandBottom = (bottom - y > bandHeight) ? y + bandHeight : bottom;
+
+		const uint32_t *a = entry(left, y);
+		const uint32_t *b = entry(right, y);
+		const uint32_t *c = entry(left, bandBottom);
+		const uint32_t *d = entry(right, bandBottom);
+
+		for (int i = 0; i < 3; ++i)
+		{
+			totals[i] += (uint32_t)(d[i] - b[i] - c[i] + a[i]);
+		}
+	}
+
+	return width * (bottom - top);
+}
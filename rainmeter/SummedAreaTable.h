@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ImageView.h"
+
+// An integral image: every entry holds the total of all the pixels above
+// and to the left of it, per channel. Once it's built, the sum (and so the
+// average) of any rectangle is four lookups no matter how big it is.
+//
+// Totals are kept in 32 bits and allowed to wrap around. The difference
+// that makes up a rectangle's sum still comes out right as long as the
+// real sum fits, and sum() splits up rectangles too big for that.
+class SummedAreaTable
+{
+public:
+	// The view has to be RGBA (red in the lowest byte) like everything
+	// else. Alpha is ignored.
+	SummedAreaTable(const ImageView &view);
+
+	// Totals for the channels in [left, right) x [top, bottom), clamped to
+	// the image, lowest byte's channel first. Returns how many pixels that
+	// covered.
+	uint64_t sum(int left, int top, int right, int bottom, uint64_t totals[3]) const;
+
+	int width() const { return w; }
+	int height() const { return h; }
+
+	// Roughly how much memory this is holding on to
+	size_t bytes() const { return table.size() * sizeof(uint32_t); }
+
+private:
+	// Fills in the rows for [first, last) as if first were the top of the image
+	void buildRows(const ImageView &view, int first, int last);
+
+	// Adds the row of totals above a band to every row in it
+	void carryInto(int first, int last);
+
+	// Exact as long as the rectangle has fewer pixels than this
+	static const uint64_t maxArea = 0xFFFFFFFFull / 255;
+
+	const uint32_t *entry(int x, int y) const { return &table[((size_t)y * (w + 1) + x) * 3]; }
+
+	int w;
+	int h;
+	std::vector<uint32_t> table;
+};
@@ -0,0 +1,229 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t threads) :
+	generation(0), quit(false)
+{
+	if (threads < 1)
+		threads = 1;
+
+	for (size_t i = 0; i < threads; ++i)
+	{
+		queues.emplace_back(new Queue);
+	}
+
+	// Queue 0 is the caller's, the helpers get the rest
+	for (size_t i = 1; i < threads; ++i)
+	{
+		helpers.emplace_back(&ThreadPool::helperLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		quit = true;
+	}
+
+	wake.notify_all();
+
+	for (std::thread &helper : helpers)
+	{
+		helper.join();
+	}
+}
+
+void ThreadPool::parallelFor(int count, int grain, const std::function<void(int, int)> &body)
+{
+	if (count <= 0)
+		return;
+
+	if (grain < 1)
+		grain = 1;
+
+	// Not worth waking anybody up for
+	if (helpers.empty() || count <= grain)
+	{
+		body(0, count);
+		return;
+	}
+
+	std::lock_guard<std::mutex> one(running);
+
+	int chunkCount = (count + grain - 1) / grain;
+
+	Batch batch;
+	batch.body = &body;
+	batch.remaining = chunkCount;
+
+	// Hand out contiguous runs of chunks, so each thread starts off working
+	// through one part of the image in order
+	size_t queueCount = queues.size();
+	for (size_t q = 0; q < queueCount; ++q)
+	{
+		int first = (int)(chunkCount * q / queueCount);
+		int last = (int)(chunkCount * (q + 1) / queueCount);
+
+		std::lock_guard<std::mutex> guard(queues[q]->lock);
+		for (int c = first; c < last; ++c)
+		{
+			int begin = c * grain;
+			int end = (count - begin > grain) ? begin + grain : count;
+			queues[q]->chunks.push_back({ &batch, begin, end });
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		++generation;
+	}
+
+	wake.notify_all();
+
+	// Pitch in until there's nothing left to take...
+	Chunk chunk;
+	while (takeChunk(0, &chunk))
+	{
+		runChunk(chunk);
+	}
+
+	// ...then wait for whatever the helpers are still in the middle of
+	std::unique_lock<std::mutex> guard(stateLock);
+	done.wait(guard, [&batch] { return batch.remaining.load() == 0; });
+}
+
+bool ThreadPool::takeChunk(size_t index, Chunk *chunk)
+{
+	{
+		Queue &own = *queues[index];
+		std::lock_guard<std::mutex> guard(own.lock);
+
+		if (!own.chunks.empty())
+		{
+			*chunk = own.chunks.front();
+			own.chunks.pop_front();
+			return true;
+		}
+	}
+
+	for (size_t i = 1; i < queues.size(); ++i)
+	{
+		Queue &other = *queues[(index + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(other.lock);
+
+		if (!other.chunks.empty())
+		{
+			*chunk = other.chunks.back();
+			other.chunks.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::runChunk(const Chunk &chunk)
+{
+	(*chunk.batch->body)(chunk.begin, chunk.end);
+
+	// Nothing can touch the batch after this, whoever's waiting on it is
+	// free to go once it hits 0
+	if (--chunk.batch->remaining == 0)
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		done.notify_all();
+	}
+}
+
+void ThreadPool::helperLoop(size_t index)
+{
+	uint64_t seen;
+
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		seen = generation;
+	}
+
+	while (true)
+	{
+		Chunk chunk;
+		if (takeChunk(index, &chunk))
+		{
+			runChunk(chunk);
+			continue;
+		}
+
+		// Nothing left anywhere, sleep until the next loop comes along
+		std::unique_lock<std::mutex> guard(stateLock);
+		wake.wait(guard, [this, seen] { return quit || generation != seen; });
+
+		if (quit)
+			break;
+
+		seen = generation;
+	}
+}
+
+// ---------------------------------------------------------------------------
+
+static std::mutex sharedLock;
+static std::unique_ptr<ThreadPool> sharedPool;
+static size_t sharedThreads = 0;
+
+static size_t defaultThreads()
+{
+	size_t cores = std::thread::hardware_concurrency();
+
+	if (cores < 1)
+		return 1;
+
+	return cores < PARALLEL_MAX_THREADS ? cores : PARALLEL_MAX_THREADS;
+}
+
+void parallelFor(int count, int grain, const std::function<void(int, int)> &body)
+{
+	if (count <= 0)
+		return;
+
+	// Held the whole way through, so the pool can't be replaced out from
+	// under a loop
+	std::lock_guard<std::mutex> guard(sharedLock);
+
+	if (sharedThreads == 0)
+	{
+		sharedThreads = defaultThreads();
+	}
+
+	if (sharedPool == nullptr && sharedThreads > 1)
+	{
+		sharedPool.reset(new ThreadPool(sharedThreads));
+	}
+
+	if (sharedPool == nullptr)
+	{
+		body(0, count);
+		return;
+	}
+
+	sharedPool->parallelFor(count, grain, body);
+}
+
+void setParallelThreads(size_t threads)
+{
+	std::lock_guard<std::mutex> guard(sharedLock);
+
+	sharedThreads = threads < 1 ? 1 : threads;
+	sharedPool.reset();
+}
+
+size_t parallelThreads()
+{
+	std::lock_guard<std::mutex> guard(sharedLock);
+	return sharedThreads == 0 ? defaultThreads() : sharedThreads;
+}
+
+void stopParallelThreads()
+{
+	std::lock_guard<std::mutex> guard(sharedLock);
+	sharedPool.reset();
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Splits a big loop (rows of an image, usually) across a few threads.
+// Each thread gets its own queue of chunks to start with, a contiguous run
+// of them so it stays in one part of the image, and when it runs out it
+// steals from the far end of somebody else's. The thread asking for the
+// loop works on it too rather than just waiting.
+//
+// Which thread ran which chunk isn't fixed, so anything using this has to
+// come out the same no matter how the chunks get split up: every chunk
+// writes its own part of the output and nothing gets added up across
+// chunks.
+class ThreadPool
+{
+public:
+	// threads counts the caller, so 1 means no extra threads at all
+	ThreadPool(size_t threads);
+	~ThreadPool();
+
+	// Runs body(begin, end) over [0, count) in chunks of grain (the last
+	// one can be smaller) and returns once they've all finished. Only one
+	// loop runs at a time, a second caller waits for the first.
+	void parallelFor(int count, int grain, const std::function<void(int, int)> &body);
+
+	size_t threads() const { return helpers.size() + 1; }
+
+private:
+	struct Batch
+	{
+		const std::function<void(int, int)> *body;
+		std::atomic<int> remaining;
+	};
+
+	struct Chunk
+	{
+		Batch *batch;
+		int begin;
+		int end;
+	};
+
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<Chunk> chunks;
+	};
+
+	void helperLoop(size_t index);
+
+	// Our own queue from the front, anyone else's from the back
+	bool takeChunk(size_t index, Chunk *chunk);
+	void runChunk(const Chunk &chunk);
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> helpers;
+
+	// One loop at a time
+	std::mutex running;
+
+	std::mutex stateLock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t generation;
+	bool quit;
+};
+
+// The pool everything in sampling shares, created the first time it's
+// needed. Safe to call from any thread, but a loop can't start another
+// one from inside itself.
+#define PARALLEL_MAX_THREADS 4
+
+void parallelFor(int count, int grain, const std::function<void(int, int)> &body);
+
+// How many threads loops get split over, including the one asking. The
+// default is one per core up to PARALLEL_MAX_THREADS, since sampling
+// happens in the background and shouldn't take over the whole machine.
+void setParallelThreads(size_t threads);
+size_t parallelThreads();
+
+// Stop the extra threads until something needs them again
+void stopParallelThreads();
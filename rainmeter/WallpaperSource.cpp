@@ -0,0 +1,83 @@
+#include <algorithm>
+
+#include "Counters.h"
+#include "WallpaperSource.h"
+
+WallpaperCache::WallpaperCache(WallpaperSource *source, std::chrono::steady_clock::duration recheckInterval) :
+	source(source), recheckInterval(recheckInterval), valid(false), queryCount(0)
+{
+}
+
+void WallpaperCache::update()
+{
+	if (source == nullptr)
+	{
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+
+	// Always ask the source, or it'd keep saying something changed the
+	// next time we looked
+	bool changed = source->changed();
+
+	if (valid && !changed && now - lastQuery < recheckInterval)
+	{
+		countEvent(COUNTER_WALLPAPER_HITS);
+		return;
+	}
+
+	countEvent(COUNTER_WALLPAPER_MISSES);
+
+	std::vector<MonitorWallpaper> found;
+	valid = source->query(&found);
+	lastQuery = now;
+	queryCount++;
+
+	// Nothing rather than something stale, so nobody samples the wrong
+	// wallpaper. We'll ask again next time.
+	if (valid)
+	{
+		monitors.swap(found);
+	}
+	else
+	{
+		monitors.clear();
+	}
+}
+
+const MonitorWallpaper* WallpaperCache::monitorFor(int left, int top, int right, int bottom) const
+{
+	const MonitorWallpaper *best = nullptr;
+	int64_t bestArea = 0;
+	int64_t bestDistance = 0;
+
+	for (const MonitorWallpaper &monitor : monitors)
+	{
+		int64_t w = (int64_t)std::min(right, monitor.right) - std::max(left, monitor.left);
+		int64_t h = (int64_t)std::min(bottom, monitor.bottom) - std::max(top, monitor.top);
+		int64_t area = w > 0 && h > 0 ? w * h : 0;
+
+		// How far apart they are, for when the window's not on any of them
+		int64_t dx = std::max<int64_t>(0, std::max((int64_t)monitor.left - right, (int64_t)left - monitor.right));
+		int64_t dy = std::max<int64_t>(0, std::max((int64_t)monitor.top - bottom, (int64_t)top - monitor.bottom));
+		int64_t distance = dx * dx + dy * dy;
+
+		if (best == nullptr || area > bestArea || (area == 0 && bestArea == 0 && distance < bestDistance))
+		{
+			best = &monitor;
+			bestArea = area;
+			bestDistance = distance;
+		}
+	}
+
+	return best;
+}
+
+#ifndef _WIN32
+// No wallpapers to find anywhere else
+WallpaperSource* createWallpaperSource()
+{
+	return nullptr;
+}
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One monitor, in virtual screen coordinates, and the wallpaper on it
+struct MonitorWallpaper
+{
+	int left;
+	int top;
+	int right;
+	int bottom;
+
+	std::wstring path;
+};
+
+// Where the monitors and their wallpapers come from. Windows has its own
+// (see WallpaperSourceWin32.cpp), FakeWallpaperSource.h stands in for it
+// anywhere else, and everything else only ever talks to this.
+class WallpaperSource
+{
+public:
+	virtual ~WallpaperSource() {}
+
+	// Every monitor and what's on it. Returns false if we couldn't find out.
+	virtual bool query(std::vector<MonitorWallpaper> *monitors) = 0;
+
+	// Whether the monitors or wallpapers might have changed since the last
+	// time this was called. A source with no way of telling should always
+	// say yes.
+	virtual bool changed() = 0;
+};
+
+// The source for whatever we're running on, or nullptr if there isn't one
+WallpaperSource* createWallpaperSource();
+
+// How long we go without asking again even if nobody said anything
+// changed, in case a change slips by without a notification
+#define WALLPAPER_RECHECK_INTERVAL std::chrono::milliseconds(5000)
+
+// The last answer from the source, shared between every desktop container
+// so finding out the wallpaper hasn't changed doesn't mean asking Windows
+// about every monitor on every update. It only asks again when the source
+// says something changed, the last try failed, or it's been
+// recheckInterval since it last asked.
+//
+// Main thread only.
+class WallpaperCache
+{
+public:
+	WallpaperCache(WallpaperSource *source, std::chrono::steady_clock::duration recheckInterval = WALLPAPER_RECHECK_INTERVAL);
+
+	// Asks the source again if it needs to. Call it before asking about
+	// anything.
+	void update();
+
+	// The monitor a window covering [left, right) x [top, bottom) is
+	// mostly on, the closest one if it isn't on any of them, or nullptr if
+	// we don't know about any monitors
+	const MonitorWallpaper* monitorFor(int left, int top, int right, int bottom) const;
+
+	// How many times the source has actually been asked
+	uint64_t queries() const { return queryCount; }
+
+private:
+	std::unique_ptr<WallpaperSource> source;
+	std::chrono::steady_clock::duration recheckInterval;
+	std::chrono::steady_clock::time_point lastQuery;
+
+	std::vector<MonitorWallpaper> monitors;
+	bool valid;
+	uint64_t queryCount;
+};
@@ -0,0 +1,183 @@
+#ifdef _WIN32
+
+#include <Windows.h>
+#include <VersionHelpers.h>
+#include <Shobjidl.h>
+
+#include "WallpaperSource.h"
+
+// Bumped whenever Windows tells the window below the displays or the
+// wallpaper changed. There's only ever the one source, and it all happens
+// on Rainmeter's thread.
+static uint64_t wallpaperNotifications = 0;
+
+static const wchar_t wallpaperWindowClass[] = L"ChameleonWallpaperWatcher";
+
+static LRESULT CALLBACK wallpaperWindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	switch (msg)
+	{
+	case WM_DISPLAYCHANGE:
+		++wallpaperNotifications;
+		break;
+
+	case WM_SETTINGCHANGE:
+		// Lots of other settings come through here too, none of which we care about
+		if (wParam == SPI_SETDESKWALLPAPER)
+		{
+			++wallpaperNotifications;
+		}
+		break;
+	}
+
+	return DefWindowProcW(hWnd, msg, wParam, lParam);
+}
+
+static BOOL CALLBACK addMonitor(HMONITOR monitor, HDC hdc, LPRECT rect, LPARAM data)
+{
+	std::vector<MonitorWallpaper> *monitors = (std::vector<MonitorWallpaper>*)data;
+
+	MonitorWallpaper found;
+	found.left = rect->left;
+	found.top = rect->top;
+	found.right = rect->right;
+	found.bottom = rect->bottom;
+	monitors->push_back(found);
+
+	return TRUE;
+}
+
+// Both of the notifications we want get broadcast to every top level window,
+// so we make one to hear them. Rainmeter's message loop delivers them like it
+// does for the skins' windows. It's never shown.
+class Win32WallpaperSource : public WallpaperSource
+{
+public:
+	Win32WallpaperSource() :
+		window(nullptr), module(nullptr), seen(wallpaperNotifications)
+	{
+		// Our DLL rather than Rainmeter, so the class goes away with us
+		GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCWSTR)&wallpaperWindowProc, &module);
+
+		WNDCLASSEXW windowClass = { 0 };
+		windowClass.cbSize = sizeof(windowClass);
+		windowClass.lpfnWndProc = wallpaperWindowProc;
+		windowClass.hInstance = module;
+		windowClass.lpszClassName = wallpaperWindowClass;
+
+		if (RegisterClassExW(&windowClass) != 0)
+		{
+			window = CreateWindowExW(WS_EX_TOOLWINDOW, wallpaperWindowClass, L"", WS_POPUP, 0, 0, 0, 0, NULL, NULL, module, NULL);
+		}
+	}
+
+	~Win32WallpaperSource()
+	{
+		if (window != nullptr)
+		{
+			DestroyWindow(window);
+		}
+
+		UnregisterClassW(wallpaperWindowClass, module);
+	}
+
+	bool query(std::vector<MonitorWallpaper> *monitors)
+	{
+		monitors->clear();
+
+		if (IsWindows8OrGreater())
+		{
+			// Use the multi-desktop fun version!
+			// Because making these just a few loose functions would have been too easy
+			IDesktopWallpaper *wp = nullptr;
+
+			CoCreateInstance(__uuidof(DesktopWallpaper), NULL, CLSCTX_ALL, IID_PPV_ARGS(&wp));
+			if (wp == nullptr)
+			{
+				return false;
+			}
+
+			UINT monCount = 0;
+			wp->GetMonitorDevicePathCount(&monCount);
+
+			for (UINT i = 0; i < monCount; ++i)
+			{
+				LPWSTR monPath;
+				if (wp->GetMonitorDevicePathAt(i, &monPath) != S_OK)
+				{
+					continue;
+				}
+
+				// Monitors that aren't plugged in any more are still in the
+				// list, they just don't have a rectangle
+				RECT rect;
+				LPWSTR wallPath;
+				if (wp->GetMonitorRECT(monPath, &rect) == S_OK && wp->GetWallpaper(monPath, &wallPath) == S_OK)
+				{
+					MonitorWallpaper found;
+					found.left = rect.left;
+					found.top = rect.top;
+					found.right = rect.right;
+					found.bottom = rect.bottom;
+					found.path = wallPath;
+					monitors->push_back(found);
+
+					CoTaskMemFree(wallPath);
+				}
+
+				CoTaskMemFree(monPath);
+			}
+
+			wp->Release();
+
+			return true;
+		}
+
+		// Use the "boring" WinXP - Win7 version, same wallpaper everywhere
+		EnumDisplayMonitors(NULL, NULL, addMonitor, (LPARAM)monitors);
+
+		WCHAR wallPath[MAX_PATH + 1];
+		ZeroMemory((void*)wallPath, sizeof(WCHAR) * (MAX_PATH + 1));
+
+		if (!SystemParametersInfoW(SPI_GETDESKWALLPAPER, MAX_PATH, (void*)wallPath, 0))
+		{
+			wallPath[0] = L'\0';
+		}
+
+		for (MonitorWallpaper &monitor : *monitors)
+		{
+			monitor.path = wallPath;
+		}
+
+		return true;
+	}
+
+	bool changed()
+	{
+		// Without the window we'd never hear about anything
+		if (window == nullptr)
+		{
+			return true;
+		}
+
+		if (seen != wallpaperNotifications)
+		{
+			seen = wallpaperNotifications;
+			return true;
+		}
+
+		return false;
+	}
+
+private:
+	HWND window;
+	HMODULE module;
+	uint64_t seen;
+};
+
+WallpaperSource* createWallpaperSource()
+{
+	return new Win32WallpaperSource();
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include "Worker.h"
+
+Worker::Worker(std::function<void()> onStart, std::function<void()> onStop) :
+	onStart(onStart), onStop(onStop), busy(false), quit(false)
+{
+	// Only start the thread once everything above is set up
+	thread = std::thread(&Worker::loop, this);
+}
+
+Worker::~Worker()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		jobs.clear();
+		quit = true;
+	}
+
+	wake.notify_all();
+	thread.join();
+}
+
+void Worker::enqueue(const void *key, std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		bool replaced = false;
+		for (Job &waiting : jobs)
+		{
+			if (waiting.key == key)
+			{
+				waiting.run = std::move(job);
+				replaced = true;
+				break;
+			}
+		}
+
+		if (!replaced)
+		{
+			jobs.push_back({ key, std::move(job) });
+		}
+	}
+
+	wake.notify_one();
+}
+
+void Worker::cancel(const void *key)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	for (auto it = jobs.begin(); it != jobs.end(); ++it)
+	{
+		if (it->key == key)
+		{
+			jobs.erase(it);
+			break;
+		}
+	}
+
+	if (jobs.empty() && !busy)
+	{
+		idle.notify_all();
+	}
+}
+
+void Worker::wait()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	idle.wait(guard, [this] { return jobs.empty() && !busy; });
+}
+
+size_t Worker::pending()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return jobs.size() + (busy ? 1 : 0);
+}
+
+void Worker::loop()
+{
+	if (onStart)
+	{
+		onStart();
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (true)
+	{
+		wake.wait(guard, [this] { return quit || !jobs.empty(); });
+
+		if (quit)
+		{
+			break;
+		}
+
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+		busy = true;
+
+		// Don't hold the lock while the job runs or nobody could queue anything
+		guard.unlock();
+		job.run();
+		job.run = nullptr;
+		guard.lock();
+
+		busy = false;
+
+		if (jobs.empty())
+		{
+			idle.notify_all();
+		}
+	}
+
+	guard.unlock();
+
+	if (onStop)
+	{
+		onStop();
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// A single background thread that runs sampling jobs in the order they
+// were queued, so decoding a huge wallpaper doesn't hold up Rainmeter's
+// update loop.
+//
+// Every job is tagged with a key (the SharedSample it's for). Queueing a
+// job for a key that already has one waiting replaces the waiting one,
+// since there's no point sampling an image that changed again before we
+// even got to it. A job that's already running is left alone.
+//
+// Nothing in here knows about Windows or Rainmeter so it can be driven
+// from anywhere.
+class Worker
+{
+public:
+	// onStart/onStop run on the worker thread itself, for anything that
+	// needs per-thread setup (like COM)
+	Worker(std::function<void()> onStart = nullptr, std::function<void()> onStop = nullptr);
+	~Worker();
+
+	// Queue (or replace) the job for key
+	void enqueue(const void *key, std::function<void()> job);
+
+	// Drop the waiting job for key, if there is one
+	void cancel(const void *key);
+
+	// Block until everything queued so far has finished
+	void wait();
+
+	// Number of jobs waiting or running
+	size_t pending();
+
+private:
+	struct Job
+	{
+		const void *key;
+		std::function<void()> run;
+	};
+
+	void loop();
+
+	std::function<void()> onStart;
+	std::function<void()> onStop;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::deque<Job> jobs;
+	bool busy;
+	bool quit;
+
+	std::thread thread;
+};
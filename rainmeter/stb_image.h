@@ -366,6 +366,36 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 // for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
+// Reduced-size loading (Chameleon addition). *scale is the power of two to
+// shrink by (0-3, so 1/1 to 1/8) and comes back as what was actually applied.
+// Only JPEGs are shrunk (using a DC-only or box-averaged IDCT, so the full
+// size image never exists); everything else loads full size with *scale = 0.
+STBIDEF stbi_uc *stbi_load_from_memory_scaled(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int *scale);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_from_file_scaled  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, int *scale);
+#endif
+
+// Format hints (Chameleon addition), for when the caller has already looked
+// at the file's magic bytes. Anything but STBI_FORMAT_ANY only tests for and
+// loads that one format, instead of trying every loader in turn; a file that
+// isn't actually that format just fails. *scale works as for _scaled.
+enum
+{
+   STBI_FORMAT_ANY,
+   STBI_FORMAT_JPEG,
+   STBI_FORMAT_PNG,
+   STBI_FORMAT_BMP,
+   STBI_FORMAT_GIF,
+   STBI_FORMAT_PSD,
+   STBI_FORMAT_PIC,
+   STBI_FORMAT_PNM,
+   STBI_FORMAT_HDR,
+   STBI_FORMAT_TGA
+};
+
+STBIDEF stbi_uc *stbi_load_from_memory_format(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int *scale, int format);
+STBIDEF int      stbi_info_from_memory_format(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int format);
+
 ////////////////////////////////////
 //
 // 16-bits-per-channel interface
@@ -702,6 +732,10 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   int jpeg_scale;         // requested power of two reduction, JPEG only
+   int jpeg_scale_applied; // what the JPEG loader actually did
+   int format;             // STBI_FORMAT_ANY, or the only loader to try
 } stbi__context;
 
 
@@ -712,6 +746,8 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
    s->io.read = NULL;
    s->read_from_callbacks = 0;
+   s->jpeg_scale = s->jpeg_scale_applied = 0;
+   s->format = STBI_FORMAT_ANY;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
 }
@@ -721,6 +757,8 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
 {
    s->io = *c;
    s->io_user_data = user;
+   s->jpeg_scale = s->jpeg_scale_applied = 0;
+   s->format = STBI_FORMAT_ANY;
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->img_buffer_original = s->buffer_start;
@@ -969,6 +1007,49 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
     stbi__vertically_flip_on_load = flag_true_if_should_flip;
 }
 
+// Chameleon addition: only the one loader the caller asked for
+static void *stbi__load_format(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
+{
+   STBI_NOTUSED(bpc);
+   switch (s->format) {
+   #ifndef STBI_NO_JPEG
+   case STBI_FORMAT_JPEG: if (stbi__jpeg_test(s)) return stbi__jpeg_load(s,x,y,comp,req_comp, ri); break;
+   #endif
+   #ifndef STBI_NO_PNG
+   case STBI_FORMAT_PNG:  if (stbi__png_test(s))  return stbi__png_load(s,x,y,comp,req_comp, ri); break;
+   #endif
+   #ifndef STBI_NO_BMP
+   case STBI_FORMAT_BMP:  if (stbi__bmp_test(s))  return stbi__bmp_load(s,x,y,comp,req_comp, ri); break;
+   #endif
+   #ifndef STBI_NO_GIF
+   case STBI_FORMAT_GIF:  if (stbi__gif_test(s))  return stbi__gif_load(s,x,y,comp,req_comp, ri); break;
+   #endif
+   #ifndef STBI_NO_PSD
+   case STBI_FORMAT_PSD:  if (stbi__psd_test(s))  return stbi__psd_load(s,x,y,comp,req_comp, ri, bpc); break;
+   #endif
+   #ifndef STBI_NO_PIC
+   case STBI_FORMAT_PIC:  if (stbi__pic_test(s))  return stbi__pic_load(s,x,y,comp,req_comp, ri); break;
+   #endif
+   #ifndef STBI_NO_PNM
+   case STBI_FORMAT_PNM:  if (stbi__pnm_test(s))  return stbi__pnm_load(s,x,y,comp,req_comp, ri); break;
+   #endif
+   #ifndef STBI_NO_HDR
+   case STBI_FORMAT_HDR:
+      if (stbi__hdr_test(s)) {
+         float *hdr = stbi__hdr_load(s, x,y,comp,req_comp, ri);
+         return stbi__hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp);
+      }
+      break;
+   #endif
+   #ifndef STBI_NO_TGA
+   case STBI_FORMAT_TGA:  if (stbi__tga_test(s))  return stbi__tga_load(s,x,y,comp,req_comp, ri); break;
+   #endif
+   default: break;
+   }
+
+   return stbi__errpuc("unknown image type", "Image not of any known type, or corrupt");
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -976,6 +1057,9 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
    ri->channel_order = STBI_ORDER_RGB; // all current input & output are this, but this is here so we can add BGR order
    ri->num_channels = 0;
 
+   if (s->format != STBI_FORMAT_ANY)
+      return stbi__load_format(s,x,y,comp,req_comp, ri, bpc);
+
    #ifndef STBI_NO_JPEG
    if (stbi__jpeg_test(s)) return stbi__jpeg_load(s,x,y,comp,req_comp, ri);
    #endif
@@ -1179,6 +1263,21 @@ STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req
    return result;
 }
 
+STBIDEF stbi_uc *stbi_load_from_file_scaled(FILE *f, int *x, int *y, int *comp, int req_comp, int *scale)
+{
+   unsigned char *result;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   s.jpeg_scale = *scale;
+   result = stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   *scale = result ? s.jpeg_scale_applied : 0;
+   if (result) {
+      // need to 'unget' all the characters in the IO buffer
+      fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+   }
+   return result;
+}
+
 STBIDEF stbi__uint16 *stbi_load_from_file_16(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    stbi__uint16 *result;
@@ -1226,6 +1325,29 @@ STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, i
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_uc *stbi_load_from_memory_scaled(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int *scale)
+{
+   unsigned char *result;
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   s.jpeg_scale = *scale;
+   result = stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   *scale = result ? s.jpeg_scale_applied : 0;
+   return result;
+}
+
+STBIDEF stbi_uc *stbi_load_from_memory_format(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int *scale, int format)
+{
+   unsigned char *result;
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   s.jpeg_scale = *scale;
+   s.format = format;
+   result = stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   *scale = result ? s.jpeg_scale_applied : 0;
+   return result;
+}
+
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
 {
    stbi__context s;
@@ -1745,8 +1867,11 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+   int scale; // blocks come out of the IDCT as (8 >> scale) pixels square
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
+   void (*reduce_block_kernel)(stbi_uc *out, int out_stride, stbi_uc const *block, int scale);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
 } stbi__jpeg;
@@ -2260,6 +2385,26 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// box-average an 8x8 block of pixels down to 4x4 (scale 1) or 2x2 (scale 2)
+static void stbi__idct_reduce(stbi_uc *out, int out_stride, stbi_uc const *block, int scale)
+{
+   int i,j,x,y;
+   int bs = 8 >> scale, f = 1 << scale;
+   for (j=0; j < bs; ++j) {
+      // sum the rows of each output pixel first, then the columns
+      int col[8] = { 0 };
+      for (y=0; y < f; ++y)
+         for (x=0; x < 8; ++x)
+            col[x] += block[(j*f + y)*8 + x];
+      for (i=0; i < bs; ++i) {
+         int sum = (f * f) >> 1;
+         for (x=0; x < f; ++x)
+            sum += col[i*f + x];
+         out[j*out_stride + i] = (stbi_uc) (sum >> (2 * scale));
+      }
+   }
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2439,6 +2584,43 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 #undef dct_pass
 }
 
+// sse2 version of stbi__idct_reduce, bit-identical to it
+static void stbi__idct_reduce_simd(stbi_uc *out, int out_stride, stbi_uc const *block, int scale)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i ones = _mm_set1_epi16(1);
+   __m128i r[8];
+   int i;
+
+   for (i=0; i < 8; ++i)
+      r[i] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (block + i*8)), zero);
+
+   if (scale == 1) {
+      __m128i bias = _mm_set1_epi32(2);
+      for (i=0; i < 4; ++i) {
+         // add pairs of rows, then madd adds pairs of columns
+         __m128i sum = _mm_madd_epi16(_mm_add_epi16(r[i*2], r[i*2+1]), ones);
+         int px;
+         sum = _mm_srai_epi32(_mm_add_epi32(sum, bias), 2);
+         sum = _mm_packs_epi32(sum, sum);
+         sum = _mm_packus_epi16(sum, sum);
+         px = _mm_cvtsi128_si32(sum);
+         memcpy(out + i*out_stride, &px, 4);
+      }
+   } else {
+      __m128i bias = _mm_set1_epi32(8);
+      for (i=0; i < 2; ++i) {
+         __m128i rows = _mm_add_epi16(_mm_add_epi16(r[i*4], r[i*4+1]), _mm_add_epi16(r[i*4+2], r[i*4+3]));
+         __m128i sum = _mm_madd_epi16(rows, ones);
+         // fold the column pairs together so lanes 0 and 2 hold the 4 wide sums
+         sum = _mm_add_epi32(sum, _mm_srli_epi64(sum, 32));
+         sum = _mm_srai_epi32(_mm_add_epi32(sum, bias), 4);
+         out[i*out_stride + 0] = (stbi_uc) _mm_cvtsi128_si32(sum);
+         out[i*out_stride + 1] = (stbi_uc) _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+      }
+   }
+}
+
 #endif // STBI_SSE2
 
 #ifdef STBI_NEON
@@ -2683,6 +2865,22 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// run the IDCT for one block, shrinking it on the way out if we're loading
+// at reduced size. 1/8 only needs the DC term (which is the block average),
+// 1/2 and 1/4 box-average the full block.
+static void stbi__jpeg_idct(stbi__jpeg *z, stbi_uc *out, int out_stride, short data[64])
+{
+   if (z->scale == 0) {
+      z->idct_block_kernel(out, out_stride, data);
+   } else if (z->scale == 3) {
+      out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+   } else {
+      STBI_SIMD_ALIGN(stbi_uc, block[64]);
+      z->idct_block_kernel(block, 8, data);
+      z->reduce_block_kernel(out, out_stride, block, z->scale);
+   }
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
@@ -2701,7 +2899,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*j*(8>>z->scale)+i*(8>>z->scale), z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2725,11 +2923,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = (i*z->img_comp[n].h + x)*(8>>z->scale);
+                        int y2 = (j*z->img_comp[n].v + y)*(8>>z->scale);
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
                      }
                   }
                }
@@ -2826,7 +3024,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*j*(8>>z->scale)+i*(8>>z->scale), z->img_comp[n].w2, data);
             }
          }
       }
@@ -3045,6 +3243,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
    z->img_mcu_x = (s->img_x + z->img_mcu_w-1) / z->img_mcu_w;
    z->img_mcu_y = (s->img_y + z->img_mcu_h-1) / z->img_mcu_h;
 
+   // reduced-size decoding shrinks every block, so the component
+   // buffers shrink with them
+   z->scale = s->jpeg_scale < 0 ? 0 : s->jpeg_scale > 3 ? 3 : s->jpeg_scale;
+
    for (i=0; i < s->img_n; ++i) {
       // number of effective pixels (e.g. for non-interleaved MCU)
       z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max-1) / h_max;
@@ -3056,8 +3258,8 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale);
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3067,10 +3269,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         // coefficients are always kept for every full size block
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3529,12 +3731,14 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
    j->idct_block_kernel = stbi__idct_block;
+   j->reduce_block_kernel = stbi__idct_reduce;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
 #ifdef STBI_SSE2
    if (stbi__sse2_available()) {
       j->idct_block_kernel = stbi__idct_simd;
+      j->reduce_block_kernel = stbi__idct_reduce_simd;
       j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
       j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
    }
@@ -3581,6 +3785,18 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // everything from here on works on the reduced size image
+   if (z->scale) {
+      int k, round = (1 << z->scale) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale;
+      z->s->img_y = (z->s->img_y + round) >> z->scale;
+      for (k=0; k < z->s->img_n; ++k) {
+         z->img_comp[k].x = (z->img_comp[k].x + round) >> z->scale;
+         z->img_comp[k].y = (z->img_comp[k].y + round) >> z->scale;
+      }
+   }
+   z->s->jpeg_scale_applied = z->scale;
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -3945,13 +4161,18 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
 static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room for n bytes
 {
    char *q;
-   int cur, limit, old_limit;
+   unsigned int cur, limit, old_limit;
    z->zout = zout;
    if (!z->z_expandable) return stbi__err("output buffer limit","Corrupt PNG");
-   cur   = (int) (z->zout     - z->zout_start);
-   limit = old_limit = (int) (z->zout_end - z->zout_start);
-   while (cur + n > limit)
+   cur   = (unsigned int) (z->zout     - z->zout_start);
+   limit = old_limit = (unsigned int) (z->zout_end - z->zout_start);
+   // Chameleon fix: a corrupt stream could otherwise double this until it wraps
+   // around to zero and then loop forever (this is how later stb_images do it)
+   if (UINT_MAX - cur < (unsigned) n) return stbi__err("outofmem", "Out of memory");
+   while (cur + n > limit) {
+      if (limit > UINT_MAX / 2) return stbi__err("outofmem", "Out of memory");
       limit *= 2;
+   }
    q = (char *) STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
    STBI_NOTUSED(old_limit);
    if (q == NULL) return stbi__err("outofmem", "Out of memory");
@@ -7107,8 +7328,48 @@ static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp)
 }
 #endif
 
+// Chameleon addition: only the one format the caller asked for
+static int stbi__info_format(stbi__context *s, int *x, int *y, int *comp)
+{
+   switch (s->format) {
+   #ifndef STBI_NO_JPEG
+   case STBI_FORMAT_JPEG: return stbi__jpeg_info(s, x, y, comp);
+   #endif
+   #ifndef STBI_NO_PNG
+   case STBI_FORMAT_PNG:  return stbi__png_info(s, x, y, comp);
+   #endif
+   #ifndef STBI_NO_GIF
+   case STBI_FORMAT_GIF:  return stbi__gif_info(s, x, y, comp);
+   #endif
+   #ifndef STBI_NO_BMP
+   case STBI_FORMAT_BMP:  return stbi__bmp_info(s, x, y, comp);
+   #endif
+   #ifndef STBI_NO_PSD
+   case STBI_FORMAT_PSD:  return stbi__psd_info(s, x, y, comp);
+   #endif
+   #ifndef STBI_NO_PIC
+   case STBI_FORMAT_PIC:  return stbi__pic_info(s, x, y, comp);
+   #endif
+   #ifndef STBI_NO_PNM
+   case STBI_FORMAT_PNM:  return stbi__pnm_info(s, x, y, comp);
+   #endif
+   #ifndef STBI_NO_HDR
+   case STBI_FORMAT_HDR:  return stbi__hdr_info(s, x, y, comp);
+   #endif
+   #ifndef STBI_NO_TGA
+   case STBI_FORMAT_TGA:  return stbi__tga_info(s, x, y, comp);
+   #endif
+   default: break;
+   }
+
+   return stbi__err("unknown image type", "Image not of any known type, or corrupt");
+}
+
 static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
 {
+   if (s->format != STBI_FORMAT_ANY)
+      return stbi__info_format(s, x, y, comp);
+
    #ifndef STBI_NO_JPEG
    if (stbi__jpeg_info(s, x, y, comp)) return 1;
    #endif
@@ -7213,6 +7474,14 @@ STBIDEF int stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y
    return stbi__info_main(&s,x,y,comp);
 }
 
+STBIDEF int stbi_info_from_memory_format(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int format)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   s.format = format;
+   return stbi__info_main(&s,x,y,comp);
+}
+
 STBIDEF int stbi_info_from_callbacks(stbi_io_callbacks const *c, void *user, int *x, int *y, int *comp)
 {
    stbi__context s;